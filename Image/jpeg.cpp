@@ -37,14 +37,41 @@ my_error_exit( j_common_ptr cinfo )
 
 namespace Image
 {
-	void JPEGReadImage( std::string fileName , Image32& img )
+	void JPEGReadImage( std::string fileName , Image32& img , unsigned int scaleDenom )
 	{
 		FILE *fp = fopen( fileName.c_str() , "rb" );
 		if( !fp ) THROW( "Failed to open file for reading: %s" , fileName.c_str() );
-		JPEGReadImage( fp , img );
+		JPEGReadImage( fp , img , scaleDenom );
 		fclose(fp);
 	}
 
+	void JPEGReadSize( std::string fileName , int &width , int &height )
+	{
+		struct jpeg_decompress_struct cinfo;
+		struct my_error_mgr jerr;
+
+		FILE *fp = fopen( fileName.c_str() , "rb" );
+		if( !fp ) THROW( "Failed to open file for reading: %s" , fileName.c_str() );
+
+		cinfo.err = jpeg_std_error( &jerr.pub );
+		jerr.pub.error_exit = my_error_exit;
+
+		if( setjmp( jerr.setjmp_buffer ) )
+		{
+			jpeg_destroy_decompress( &cinfo );
+			fclose( fp );
+			THROW( "JPEG error occured" );
+		}
+
+		jpeg_create_decompress( &cinfo );
+		jpeg_stdio_src( &cinfo , fp );
+		(void) jpeg_read_header( &cinfo , TRUE );
+		width = cinfo.image_width;
+		height = cinfo.image_height;
+		jpeg_destroy_decompress( &cinfo );
+		fclose( fp );
+	}
+
 	void JPEGWriteImage( const Image32& img , std::string fileName , int quality )
 	{
 		FILE *fp = fopen( fileName.c_str() , "wb" );
@@ -53,8 +80,10 @@ namespace Image
 		fclose(fp);
 	}
 
-	void JPEGReadImage( FILE *fp , Image32& img )
+	void JPEGReadImage( FILE *fp , Image32& img , unsigned int scaleDenom )
 	{
+		if( scaleDenom!=1 && scaleDenom!=2 && scaleDenom!=4 && scaleDenom!=8 ) THROW( "Scale denominator must be 1, 2, 4, or 8: %u" , scaleDenom );
+
 		struct jpeg_decompress_struct cinfo;
 		struct my_error_mgr jerr;
 
@@ -76,6 +105,8 @@ namespace Image
 		jpeg_stdio_src( &cinfo , fp );
 
 		(void) jpeg_read_header( &cinfo , TRUE );
+		cinfo.scale_num = 1;
+		cinfo.scale_denom = scaleDenom;
 		(void) jpeg_start_decompress( &cinfo );
 
 		row_stride = cinfo.output_width * cinfo.output_components;
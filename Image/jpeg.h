@@ -5,10 +5,15 @@
 
 namespace Image
 {
-	/** This function read in a JPEG file, returning 0 on failure.*/
-	void JPEGReadImage( std::string fileName , Image32& img );
-	/** This function read in a JPEG file, returning 0 on failure.*/
-	void JPEGReadImage( FILE *fp , Image32& img );
+	/** This function read in a JPEG file, returning 0 on failure.
+	*** The image is decoded at 1/scaleDenom of its resolution (rounded up), with scaleDenom one of 1, 2, 4, or 8, using the reduced-size inverse DCT. */
+	void JPEGReadImage( std::string fileName , Image32& img , unsigned int scaleDenom=1 );
+	/** This function read in a JPEG file, returning 0 on failure.
+	*** The image is decoded at 1/scaleDenom of its resolution (rounded up), with scaleDenom one of 1, 2, 4, or 8, using the reduced-size inverse DCT. */
+	void JPEGReadImage( FILE *fp , Image32& img , unsigned int scaleDenom=1 );
+
+	/** This function reads the header of a JPEG file, returning the resolution of the image without decoding it. */
+	void JPEGReadSize( std::string fileName , int &width , int &height );
 
 	/** This function writes out a JPEG file, returning 0 on failure.*/
 	void JPEGWriteImage( const Image32& img , std::string , int quality=100 );
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <Util/exceptions.h>
+#include <Util/timer.h>
+#include "animationRenderer.h"
+#include "scratchArena.h"
+
+using namespace Ray;
+using namespace Util;
+using namespace Image;
+
+///////////////////////
+// AnimationRenderer //
+///////////////////////
+std::string AnimationRenderer::Names[] = { "full" , "projected" , "conservative" };
+
+int AnimationRenderer::Mode( const std::string &name )
+{
+	std::string _name = name;
+	for( size_t i=0 ; i<_name.size() ; i++ ) _name[i] = (char)std::tolower( _name[i] );
+	for( int i=0 ; i<COUNT ; i++ ) if( Names[i]==_name ) return i;
+	THROW( "unrecognized incremental rendering mode: %s" , name.c_str() );
+	return FULL;
+}
+
+AnimationRenderer::AnimationRenderer( Scene &scene , int mode , int threads ) : _scene(scene) , _mode(mode) , _threads(threads) , _rLimit(0) , _cLimit(0) , _retraced(0)
+{
+	if( mode<0 || mode>=COUNT ) THROW( "unrecognized incremental rendering mode: %d" , mode );
+	if( threads<1 ) THROW( "number of threads must be positive: %d" , threads );
+}
+
+void AnimationRenderer::_AddTextureScales( const SceneGeometry &geometry , std::vector< unsigned int > &scales )
+{
+	for( size_t i=0 ; i<geometry._localData.textures.size() ; i++ ) scales.push_back( geometry._localData.textures[i].scale() );
+	for( size_t i=0 ; i<geometry._localData.files.size() ; i++ ) _AddTextureScales( geometry._localData.files[i] , scales );
+}
+
+bool AnimationRenderer::_Same( const AnimatedNode &node1 , const AnimatedNode &node2 )
+{
+	if( node1.keyFramed!=node2.keyFramed ) return false;
+	for( int d=0 ; d<3 ; d++ ) if( node1.bBox[0][d]!=node2.bBox[0][d] || node1.bBox[1][d]!=node2.bBox[1][d] ) return false;
+	for( int r=0 ; r<4 ; r++ ) for( int c=0 ; c<4 ; c++ ) if( node1.toWorld(r,c)!=node2.toWorld(r,c) ) return false;
+	return true;
+}
+
+BoundingBox3D AnimationRenderer::_Union( const BoundingBox3D &bBox1 , const BoundingBox3D &bBox2 )
+{
+	Point3D p[2];
+	for( int d=0 ; d<3 ; d++ ) p[0][d] = std::min< double >( bBox1[0][d] , bBox2[0][d] ) , p[1][d] = std::max< double >( bBox1[1][d] , bBox2[1][d] );
+	return BoundingBox3D( p[0] , p[1] );
+}
+
+BoundingBox3D AnimationRenderer::_Pad( const BoundingBox3D &bBox )
+{
+	double margin = 1e-4 + 1e-6 * ( bBox[1] - bBox[0] ).length();
+	return BoundingBox3D( bBox[0] - Point3D( margin , margin , margin ) , bBox[1] + Point3D( margin , margin , margin ) );
+}
+
+bool AnimationRenderer::_Overlaps( const BoundingBox3D &bBox , const Ray3D &ray )
+{
+	// Clip the ray against the slabs of the box
+	double tMin = 0 , tMax = Infinity;
+	for( int d=0 ; d<3 ; d++ )
+	{
+		if( ray.direction[d]==0 )
+		{
+			if( ray.position[d]<bBox[0][d] || ray.position[d]>bBox[1][d] ) return false;
+			continue;
+		}
+		double t0 = ( bBox[0][d] - ray.position[d] ) / ray.direction[d] , t1 = ( bBox[1][d] - ray.position[d] ) / ray.direction[d];
+		if( t0>t1 ) std::swap( t0 , t1 );
+		tMin = std::max< double >( tMin , t0 ) , tMax = std::min< double >( tMax , t1 );
+		if( tMin>tMax ) return false;
+	}
+	return true;
+}
+
+void AnimationRenderer::_mark( const BoundingBox3D &bBox , const Matrix3D &toCamera , const double frame[4] , int width , int height , std::vector< char > &dirty ) const
+{
+	const Camera &camera = _scene._globalData.camera;
+	double x[] = { Infinity , -Infinity } , y[] = { Infinity , -Infinity };
+	for( int c=0 ; c<8 ; c++ )
+	{
+		Point3D p;
+		for( int d=0 ; d<3 ; d++ ) p[d] = bBox[ (c>>d)&1 ][d];
+		p = toCamera * ( p - camera.position );
+
+		// If the box reaches behind the camera its projection is unbounded
+		if( p[0]<=Epsilon )
+		{
+			std::fill( dirty.begin() , dirty.end() , 1 );
+			return;
+		}
+		double _x = ( p[1] / p[0] - frame[0] ) / frame[1] , _y = ( p[2] / p[0] - frame[2] ) / frame[3];
+		x[0] = std::min< double >( x[0] , _x ) , x[1] = std::max< double >( x[1] , _x );
+		y[0] = std::min< double >( y[0] , _y ) , y[1] = std::max< double >( y[1] , _y );
+	}
+
+	// Grow the rectangle by a pixel to cover the round-off in the camera's rays
+	int i0 = std::max< int >( 0 , (int)floor( x[0] ) - 1 ) , i1 = std::min< int >( width-1 , (int)ceil( x[1] ) + 1 );
+	int j0 = std::max< int >( 0 , (int)floor( y[0] ) - 1 ) , j1 = std::min< int >( height-1 , (int)ceil( y[1] ) + 1 );
+	for( int j=j0 ; j<=j1 ; j++ ) for( int i=i0 ; i<=i1 ; i++ ) dirty[ (size_t)( height-j-1 )*width + i ] = 1;
+}
+
+Point3D AnimationRenderer::_getColor( Ray3D ray , int rDepth , Point3D cLimit , _Path *path ) const
+{
+	if( path ) path->rays.push_back( ray );
+	RayShapeIntersectionInfo iInfo = RayShapeIntersectionInfo();
+	if( _scene.intersect( ray , iInfo , BoundingBox1D( Epsilon , Infinity ) )<Infinity ) return _shade( ray , iInfo , rDepth , cLimit , path );
+	return Point3D();
+}
+
+Point3D AnimationRenderer::_shade( Ray3D ray , const RayShapeIntersectionInfo &iInfo , int rDepth , Point3D cLimit , _Path *path ) const
+{
+	if( path ) path->hits.push_back( iInfo.position );
+	Point3D color = _scene.directColor( ray , iInfo , cLimit );
+	rDepth--;
+
+	Point3D K_S = iInfo.material->specular;
+	if( rDepth>0 && Scene::Propagates( K_S , cLimit ) ) color += _getColor( Scene::ReflectedRay( ray , iInfo ) , rDepth-1 , cLimit/K_S , path ) * K_S;
+
+	Ray3D refracted;
+	Point3D K_T = iInfo.material->transparent;
+	if( Scene::RefractedRay( ray , iInfo , refracted ) && rDepth>0 && Scene::Propagates( K_T , cLimit ) ) color += _getColor( refracted , rDepth-1 , cLimit/K_T , path ) * K_T;
+
+	return Scene::Clamp( color );
+}
+
+Image32 AnimationRenderer::render( double time , int curveFit , int width , int height , int rLimit , double cLimit )
+{
+	_scene.setCurrentTime( time , curveFit );
+	_scene.updateBoundingBox();
+	_scene._setPixelAngle( height );
+
+	// Record the state of the animated parts of the scene (the root list is skipped, as its box is that of the whole scene)
+	std::vector< AnimatedNode > nodes;
+	for( size_t i=0 ; i<_scene._shapeList.shapes.size() ; i++ ) _scene._shapeList.shapes[i]->addAnimatedNodes( Matrix4D::Identity() , nodes );
+	std::vector< unsigned int > scales;
+	_AddTextureScales( _scene , scales );
+	BoundingBox3D bBox = _scene.boundingBox();
+
+	bool full = _mode==FULL || width!=_image.width() || height!=_image.height() || rLimit!=_rLimit || cLimit!=_cLimit || nodes.size()!=_nodes.size() || scales!=_scales;
+	for( size_t i=0 ; i<nodes.size() && !full ; i++ ) full = nodes[i].keyFramed!=_nodes[i].keyFramed;
+	std::vector< char > dirty( (size_t)width*height , full ? 1 : 0 );
+	if( !full )
+	{
+		// The boxes swept by the nodes that changed, and the boxes of the shadows they cast (and used to cast) onto the scene
+		std::vector< BoundingBox3D > boxes , volumes;
+		for( size_t i=0 ; i<nodes.size() ; i++ ) if( ( _mode==CONSERVATIVE || nodes[i].keyFramed ) && !_Same( nodes[i] , _nodes[i] ) ) boxes.push_back( _Pad( _Union( nodes[i].bBox , _nodes[i].bBox ) ) );
+		BoundingBox3D region = _Pad( _Union( bBox , _bBox ) );
+		for( size_t i=0 ; i<boxes.size() ; i++ ) for( size_t l=0 ; l<_scene._globalData.lights.size() ; l++ )
+		{
+			BoundingBox3D volume = _scene._globalData.lights[l]->shadowVolume( boxes[i] , region );
+			if( !volume.isEmpty() ) volumes.push_back( _Pad( volume ) );
+		}
+
+		if( _mode==PROJECTED && boxes.size() )
+		{
+			// Express the directions of the primary rays in the camera's frame, and fit the (linear) map to pixel coordinates
+			const Camera &camera = _scene._globalData.camera;
+			Matrix3D basis;
+			for( int d=0 ; d<3 ; d++ ) basis(d,0) = camera.forward[d] , basis(d,1) = camera.right[d] , basis(d,2) = camera.up[d];
+			Matrix3D toCamera = basis.inverse();
+			Point3D d00 = toCamera * camera.getRay( 0 , 0 , width , height ).direction;
+			Point3D d10 = toCamera * camera.getRay( width-1 , 0 , width , height ).direction;
+			Point3D d01 = toCamera * camera.getRay( 0 , height-1 , width , height ).direction;
+			double frame[4];
+			frame[0] = d00[1] / d00[0] , frame[1] = width>1 ? ( d10[1] / d10[0] - frame[0] ) / ( width-1 ) : 0;
+			frame[2] = d00[2] / d00[0] , frame[3] = height>1 ? ( d01[2] / d01[0] - frame[2] ) / ( height-1 ) : 0;
+			if( !frame[1] || !frame[3] ) std::fill( dirty.begin() , dirty.end() , 1 );
+			else
+			{
+				for( size_t i=0 ; i<boxes.size() ; i++ ) _mark( boxes[i] , toCamera , frame , width , height , dirty );
+				for( size_t i=0 ; i<volumes.size() ; i++ ) _mark( volumes[i] , toCamera , frame , width , height , dirty );
+			}
+		}
+		else if( _mode==CONSERVATIVE && boxes.size() )
+		{
+#pragma omp parallel for num_threads( _threads ) schedule( dynamic , 256 )
+			for( long long p=0 ; p<(long long)dirty.size() ; p++ )
+			{
+				const _Path &path = _paths[p];
+				bool _dirty = false;
+				for( size_t r=0 ; r<path.rays.size() && !_dirty ; r++ ) for( size_t b=0 ; b<boxes.size() && !_dirty ; b++ ) _dirty = _Overlaps( boxes[b] , path.rays[r] );
+				for( size_t h=0 ; h<path.hits.size() && !_dirty ; h++ ) for( size_t v=0 ; v<volumes.size() && !_dirty ; v++ )
+				{
+					_dirty = true;
+					for( int d=0 ; d<3 ; d++ ) if( path.hits[h][d]<volumes[v][0][d] || path.hits[h][d]>volumes[v][1][d] ) _dirty = false;
+				}
+				dirty[p] = _dirty ? 1 : 0;
+			}
+		}
+	}
+
+	if( full )
+	{
+		_image.setSize( width , height );
+		_paths.clear();
+		if( _mode==CONSERVATIVE ) _paths.resize( (size_t)width*height );
+	}
+
+	// Re-trace the dirty pixels
+	std::vector< long long > pixels;
+	for( size_t p=0 ; p<dirty.size() ; p++ ) if( dirty[p] ) pixels.push_back( (long long)p );
+#pragma omp parallel num_threads( _threads )
+	{
+		ScratchArena &arena = ScratchArena::ThreadArena();
+		arena.reserve( ScratchArena::DefaultBlockSize );
+
+#pragma omp for schedule( dynamic , 16 )
+		for( long long k=0 ; k<(long long)pixels.size() ; k++ )
+		{
+			long long p = pixels[k];
+			int i = (int)( p % width ) , j = (int)( p / width );
+			arena.reset();
+			try
+			{
+				_Path *path = _mode==CONSERVATIVE ? &_paths[p] : NULL;
+				if( path ) path->rays.clear() , path->hits.clear();
+				Ray3D ray = _scene._globalData.camera.getRay( i , height-j-1 , width , height );
+				RayShapeIntersectionInfo iInfo = {};
+				Timer timer;
+				double t = _scene.intersect( ray , iInfo );
+				RayTracingStats::AddPrimaryRays( 1 , timer.elapsed() );
+				if( path ) path->rays.push_back( ray );
+				Point3D c = t<Infinity ? _shade( ray , iInfo , rLimit , Point3D( cLimit , cLimit , cLimit ) , path ) : Point3D();
+				Pixel32 pixel;
+				pixel.r = (int)(c[0]*255);
+				pixel.g = (int)(c[1]*255);
+				pixel.b = (int)(c[2]*255);
+				_image( i , j ) = pixel;
+			}
+			catch( std::exception &e ){ ERROR_OUT( "failed to trace pixel ( %d , %d )\n%s" , i , j , e.what() ); }
+		}
+
+		// Fold this thread's statistics into the totals
+		RayTracingStats::Merge();
+	}
+
+	_rLimit = rLimit , _cLimit = cLimit;
+	_nodes.swap( nodes );
+	_scales.swap( scales );
+	_bBox = bBox;
+	_retraced = pixels.size();
+	return _image;
+}
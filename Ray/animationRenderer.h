@@ -0,0 +1,115 @@
+#ifndef ANIMATION_RENDERER_INCLUDED
+#define ANIMATION_RENDERER_INCLUDED
+#include <vector>
+#include <string>
+#include <Util/geometry.h>
+#include <Image/image.h>
+#include "scene.h"
+
+namespace Ray
+{
+	/** This class ray-traces the frames of an animation, re-tracing only the pixels that may have changed since the previous frame.
+	*** After the key-frames are evaluated, the bounding boxes and transformations of the key-framed nodes (and of the nodes containing
+	*** them) are compared to those of the previous frame. The pixels that could be affected by the nodes that changed are re-traced,
+	*** and the others are copied from the previous frame. A pixel can be affected either because one of its rays passes through the
+	*** (old or new) bounding box of a node that changed, or because one of its hits is in the shadow volume that such a box casts from
+	*** a light.
+	*** The frame is re-traced in full if its dimensions differ from those of the previous frame, if the structure of the animated nodes
+	*** changes, or if the resolution at which a texture is decoded changes. */
+	class AnimationRenderer
+	{
+	public:
+		/** The ways in which the pixels to re-trace are found */
+		enum
+		{
+			FULL ,
+			PROJECTED ,
+			CONSERVATIVE ,
+			COUNT
+		};
+
+		/** The names of the modes */
+		static std::string Names[];
+
+		/** This static method returns the mode with the prescribed name. */
+		static int Mode( const std::string &name );
+
+		/** The constructor takes the scene to be rendered, the way in which the pixels to re-trace are found, and the number of threads */
+		AnimationRenderer( Scene &scene , int mode=CONSERVATIVE , int threads=1 );
+
+		/** This method evaluates the key-frames at the prescribed time, with the prescribed curve-fitting scheme, and returns the ray-traced frame. */
+		Image::Image32 render( double time , int curveFit , int width , int height , int rLimit , double cLimit );
+
+		/** This method returns the number of pixels re-traced by the last render. */
+		size_t retraced( void ) const { return _retraced; }
+
+	protected:
+		/** The rays and hits of the path (or tree of paths) traced from a pixel */
+		struct _Path
+		{
+			/** The rays that were intersected with the scene, including those that missed */
+			std::vector< Util::Ray3D > rays;
+
+			/** The positions of the hits, at which the direct lighting was computed */
+			std::vector< Util::Point3D > hits;
+		};
+
+		/** The scene being rendered */
+		Scene &_scene;
+
+		/** The way in which the pixels to re-trace are found */
+		int _mode;
+
+		/** The number of threads */
+		int _threads;
+
+		/** The previous frame */
+		Image::Image32 _image;
+
+		/** The ray-tracing parameters of the previous frame */
+		int _rLimit;
+		double _cLimit;
+
+		/** The paths of the pixels of the previous frame (for the CONSERVATIVE mode) */
+		std::vector< _Path > _paths;
+
+		/** The animated nodes of the previous frame */
+		std::vector< AnimatedNode > _nodes;
+
+		/** The resolutions at which the textures were decoded for the previous frame */
+		std::vector< unsigned int > _scales;
+
+		/** The bounding box of the scene in the previous frame */
+		Util::BoundingBox3D _bBox;
+
+		/** The number of pixels re-traced by the last render */
+		size_t _retraced;
+
+		/** This method adds the resolutions of the textures of the geometry, and of the files it includes, to the list. */
+		static void _AddTextureScales( const SceneGeometry &geometry , std::vector< unsigned int > &scales );
+
+		/** This static method returns true if the two nodes have the same bounding box and transformation. */
+		static bool _Same( const AnimatedNode &node1 , const AnimatedNode &node2 );
+
+		/** This static method returns the bounding box containing the two boxes (which, unlike BoundingBox3D::operator +, keeps flat boxes). */
+		static Util::BoundingBox3D _Union( const Util::BoundingBox3D &bBox1 , const Util::BoundingBox3D &bBox2 );
+
+		/** This static method returns the bounding box grown by a margin that covers the offsets of the secondary and shadow rays. */
+		static Util::BoundingBox3D _Pad( const Util::BoundingBox3D &bBox );
+
+		/** This static method returns true if the semi-infinite ray passes through the bounding box.
+		*** Since ShapeList::intersect does not return the nearest hit, the shapes beyond a hit can change it as well. */
+		static bool _Overlaps( const Util::BoundingBox3D &bBox , const Util::Ray3D &ray );
+
+		/** This method marks the pixels whose primary rays can pass through the bounding box, given the map from the camera's frame to the
+		*** pixel coordinates: the directions have coordinates ( 1 , x , y ) in the camera's frame at the pixel ( ( x - x0 ) / dx , ( y - y0 ) / dy ). */
+		void _mark( const Util::BoundingBox3D &bBox , const Util::Matrix3D &toCamera , const double frame[4] , int width , int height , std::vector< char > &dirty ) const;
+
+		/** This method returns the color of the ray, as Scene::getColor does, adding the rays and hits to the path if it is not NULL. */
+		Util::Point3D _getColor( Util::Ray3D ray , int rDepth , Util::Point3D cLimit , _Path *path ) const;
+
+		/** This method returns the color at the hit, as Scene::shade does, adding the spawned rays and hits to the path if it is not NULL. */
+		Util::Point3D _shade( Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo , int rDepth , Util::Point3D cLimit , _Path *path ) const;
+	};
+}
+#endif // ANIMATION_RENDERER_INCLUDED
@@ -0,0 +1,198 @@
+#include <cmath>
+#include <cstring>
+#include <Util/exceptions.h>
+#include "areaLight.h"
+#include "scene.h"
+
+using namespace Ray;
+using namespace Util;
+
+/** This function advances the state of a splitmix64 generator and returns the next value. */
+static unsigned long long NextRandom( unsigned long long &state )
+{
+	unsigned long long z = ( state += 0x9E3779B97F4A7C15ULL );
+	z = ( z ^ ( z>>30 ) ) * 0xBF58476D1CE4E5B9ULL;
+	z = ( z ^ ( z>>27 ) ) * 0x94D049BB133111EBULL;
+	return z ^ ( z>>31 );
+}
+
+/** This function returns a value uniformly distributed in [0,1). */
+static double UniformRandom( unsigned long long &state ){ return ( NextRandom( state )>>11 ) * ( 1. / 9007199254740992. ); }
+
+/** This function returns a seed obtained by hashing the coordinates of the point. */
+static unsigned long long RandomSeed( Point3D p )
+{
+	unsigned long long state = 0;
+	for( int d=0 ; d<3 ; d++ )
+	{
+		unsigned long long bits;
+		memcpy( &bits , &p[d] , sizeof(bits) );
+		state ^= bits;
+		NextRandom( state );
+	}
+	return state;
+}
+
+///////////////
+// AreaLight //
+///////////////
+const unsigned int AreaLight::_ProbeResolution;
+
+AreaLight::AreaLight( void ) : _type(_RECTANGLE) , _radius(0) , _constAtten(1) , _linearAtten(0) , _quadAtten(0) , _resolution(1) {}
+
+void AreaLight::_read( std::istream &stream )
+{
+	std::string type;
+	stream >> _ambient >> _diffuse >> _specular >> _center >> _constAtten >> _linearAtten >> _quadAtten >> _resolution >> type;
+	if( !stream ) THROW( "Failed to parse %s" , Directive().c_str() );
+	if( !_resolution ) THROW( "number of samples per axis must be positive" );
+	if( type=="rectangle" )
+	{
+		_type = _RECTANGLE;
+		stream >> _edges[0] >> _edges[1];
+	}
+	else if( type=="sphere" )
+	{
+		_type = _SPHERE;
+		stream >> _radius;
+	}
+	else THROW( "unrecognized area light type: %s" , type.c_str() );
+	if( !stream ) THROW( "Failed to parse %s %s" , Directive().c_str() , type.c_str() );
+}
+
+void AreaLight::_write( std::ostream &stream ) const
+{
+	stream << "#" << Directive() << "  " << _ambient << "  " << _diffuse << "  " << _specular << "  " << _center << "  " << _constAtten << " " << _linearAtten << " " << _quadAtten << "  " << _resolution;
+	if( _type==_RECTANGLE ) stream << "  rectangle  " << _edges[0] << "  " << _edges[1];
+	else stream << "  sphere  " << _radius;
+}
+
+bool AreaLight::getAttenuation( Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const
+{
+	// The light is shaded from its center
+	location = _center , constAtten = _constAtten , linearAtten = _linearAtten , quadAtten = _quadAtten;
+	return true;
+}
+
+void AreaLight::setShadowCasters( const ShapeList &shapes ){ _casters.set( shapes , []( const BoundingBox3D & ){ return true; } ); }
+
+BoundingBox3D AreaLight::shadowVolume( const BoundingBox3D &bBox , const BoundingBox3D &region ) const
+{
+	// The shadow rays end anywhere on the extent of the light
+	BoundingBox3D source;
+	if( _type==_RECTANGLE )
+	{
+		Point3D corners[4];
+		for( int i=0 ; i<4 ; i++ ) corners[i] = _center + _edges[0] * ( ( i&1 ) ? 0.5 : -0.5 ) + _edges[1] * ( ( i&2 ) ? 0.5 : -0.5 );
+		source = BoundingBox3D( corners , 4 );
+	}
+	else source = BoundingBox3D( _center - Point3D( _radius , _radius , _radius ) , _center + Point3D( _radius , _radius , _radius ) );
+	return _ShadowVolume( source , bBox , region );
+}
+
+double AreaLight::_attenuation( double distance ) const { return _constAtten + _linearAtten * distance + _quadAtten * distance * distance; }
+
+Point3D AreaLight::getAmbient( Ray3D , const RayShapeIntersectionInfo& iInfo ) const
+{
+	return iInfo.material->ambient * _ambient / _attenuation( ( _center - iInfo.position ).length() );
+}
+
+Point3D AreaLight::getDiffuse( Ray3D , const RayShapeIntersectionInfo& iInfo ) const
+{
+	Point3D L = _center - iInfo.position;
+	double distance = L.length();
+	double cosNL = iInfo.normal.dot( L / distance );
+	if( cosNL<=0 ) return Point3D();
+	return iInfo.material->diffuse * _diffuse * cosNL / _attenuation( distance );
+}
+
+Point3D AreaLight::getSpecular( Ray3D ray , const RayShapeIntersectionInfo& iInfo ) const
+{
+	Point3D L = _center - iInfo.position;
+	double distance = L.length();
+	Point3D V = ( ray.position - iInfo.position ).unit();
+	double cosVR = V.dot( Scene::Reflect( -L / distance , iInfo.normal ) );
+	if( cosVR<=0 ) return Point3D();
+	return iInfo.material->specular * _specular * pow( cosVR , iInfo.material->specularFallOff ) / _attenuation( distance );
+}
+
+Point3D AreaLight::_sample( Point3D p , Point2D s ) const
+{
+	if( _type==_RECTANGLE ) return _center + _edges[0] * ( s[0] - 0.5 ) + _edges[1] * ( s[1] - 0.5 );
+
+	// Map the square to the disk facing the point, with the concentric mapping so that the strata remain compact
+	Point3D w = p - _center;
+	double distance = w.length();
+	if( distance<=_radius ) return _center;
+	w /= distance;
+	Point3D u = Point3D::CrossProduct( w , fabs( w[0] )<0.9 ? Point3D( 1 , 0 , 0 ) : Point3D( 0 , 1 , 0 ) ).unit() , v = Point3D::CrossProduct( w , u );
+	double a = 2. * s[0] - 1. , b = 2. * s[1] - 1. , r , phi;
+	if( a==0 && b==0 ) return _center;
+	if( fabs( a )>fabs( b ) ) r = a , phi = Pi / 4 * b / a;
+	else r = b , phi = Pi / 2 - Pi / 4 * a / b;
+	return _center + ( u * cos( phi ) + v * sin( phi ) ) * r * _radius;
+}
+
+Point3D AreaLight::_transparency( Point3D p , Point3D q , const Shape &shape , Point3D cLimit ) const
+{
+	Point3D L = q - p;
+	double distance = L.length();
+	if( !( distance>0 ) ) return Point3D( 1. , 1. , 1. );
+	L /= distance;
+
+	// As with the other lights, accumulate the transparency of the surfaces hit along the segment
+	Ray3D ray( p + L * 1e-5 , L );
+	Point3D trans( 1. , 1. , 1. );
+	RayShapeIntersectionInfo info;
+	while( trans[0]>cLimit[0] && trans[1]>cLimit[1] && trans[2]>cLimit[2] )
+	{
+		BoundingBox1D range( Epsilon , ( q - ray.position ).dot( L ) );
+		if( range[1][0]<=Epsilon ) break;
+		double t = _casters.built() ? _casters.intersect( ray , info , range ) : shape.intersect( ray , info , range );
+		if( !( t<Infinity ) ) break;
+		trans *= info.material->transparent;
+		ray.position = info.position + L * 1e-5;
+	}
+	return trans;
+}
+
+unsigned int AreaLight::_addTransparencies( Point3D p , unsigned int res , unsigned long long &seed , const Shape &shape , Point3D cLimit , Point3D &sum ) const
+{
+	unsigned int disagreements = 0;
+	Point3D first;
+	for( unsigned int i=0 ; i<res ; i++ ) for( unsigned int j=0 ; j<res ; j++ )
+	{
+		double s0 = UniformRandom( seed ) , s1 = UniformRandom( seed );
+		Point3D trans = _transparency( p , _sample( p , Point2D( ( i + s0 ) / res , ( j + s1 ) / res ) ) , shape , cLimit );
+		if( !i && !j ) first = trans;
+		else if( trans[0]!=first[0] || trans[1]!=first[1] || trans[2]!=first[2] ) disagreements++;
+		sum += trans;
+	}
+	return disagreements;
+}
+
+Point3D AreaLight::transparency( const RayShapeIntersectionInfo &iInfo , const Shape &shape , Point3D cLimit ) const
+{
+	unsigned long long seed = RandomSeed( iInfo.position );
+	Point3D sum;
+
+	// Trace the probes, and only if they disagree trace the stratified samples as well
+	unsigned int sampleNum = _ProbeResolution * _ProbeResolution;
+	bool penumbra = _addTransparencies( iInfo.position , _ProbeResolution , seed , shape , cLimit , sum )>0;
+	if( penumbra )
+	{
+		_addTransparencies( iInfo.position , _resolution , seed , shape , cLimit , sum );
+		sampleNum += _resolution * _resolution;
+	}
+	RayTracingStats::AddAreaLightSamples( sampleNum , penumbra );
+	return sum / sampleNum;
+}
+
+bool AreaLight::isInShadow( const RayShapeIntersectionInfo& iInfo , const Shape* shape ) const
+{
+	// The point is in shadow if no light reaches it from any sample
+	Point3D trans = transparency( iInfo , *shape , Point3D() );
+	return trans[0]<=0 && trans[1]<=0 && trans[2]<=0;
+}
+
+void AreaLight::drawOpenGL( int , GLSLProgram * ) const { WARN_ONCE( "method undefined" ); }
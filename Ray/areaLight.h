@@ -0,0 +1,95 @@
+#ifndef AREA_LIGHT_INCLUDED
+#define AREA_LIGHT_INCLUDED
+#include "light.h"
+#include "shadowCasters.h"
+
+namespace Ray
+{
+	/** This class describes a light-source with a (rectangular or spherical) extent, casting soft shadows.
+	*** The light is shaded as a point-light at its center, with the transparency of the path to the light replaced by the average
+	*** transparency of the paths to stratified samples over the extent of the light.
+	*** The sampling is adaptive: a few probe samples are traced first, and if they agree the point is taken to be either fully lit
+	*** or fully in shadow. Otherwise the point is in the penumbra and the stratified samples are traced as well.
+	*** The sample positions are jittered by a hash of the shading point, so the image does not depend on the number of threads.
+	*** The light is described by:
+	***		#light_area <ambient> <diffuse> <specular> <center> <constant attenuation> <linear attenuation> <quadratic attenuation> <samples per axis> rectangle <edge 1> <edge 2>
+	***		#light_area <ambient> <diffuse> <specular> <center> <constant attenuation> <linear attenuation> <quadratic attenuation> <samples per axis> sphere <radius>
+	*** with the rectangle spanned by the two edges, centered at the center, and the sphere sampled over the disk that faces the shading point. */
+	class AreaLight : public Light
+	{
+		/** The types of extents */
+		enum
+		{
+			_RECTANGLE ,
+			_SPHERE
+		};
+
+		/** The number of probe samples along each axis */
+		static const unsigned int _ProbeResolution = 2;
+
+		/** The type of the extent */
+		int _type;
+
+		/** The center of the light */
+		Util::Point3D _center;
+
+		/** The edges of the rectangle */
+		Util::Point3D _edges[2];
+
+		/** The radius of the sphere */
+		double _radius;
+
+		/** The constant term of the attenuation equation */
+		double _constAtten;
+
+		/** The linear term of the attenuation equation */
+		double _linearAtten;
+
+		/** The quadratic term of the attenuation equation */
+		double _quadAtten;
+
+		/** The number of samples along each axis, traced in the penumbra */
+		unsigned int _resolution;
+
+		/** The scene-graph the shadow rays are traced through */
+		ShadowCasters _casters;
+
+		/** This method returns the attenuation at the prescribed distance from the center. */
+		double _attenuation( double distance ) const;
+
+		/** This method returns the point on the light associated to the prescribed point in the unit square, as seen from the point p. */
+		Util::Point3D _sample( Util::Point3D p , Util::Point2D s ) const;
+
+		/** This method returns the transparency of the path from the point to the prescribed point on the light. */
+		Util::Point3D _transparency( Util::Point3D p , Util::Point3D q , const class Shape &shape , Util::Point3D cLimit ) const;
+
+		/** This method adds the transparencies of the paths to jittered samples, one in each cell of a res x res grid, and returns the
+		*** number of samples whose transparency differs from that of the first. */
+		unsigned int _addTransparencies( Util::Point3D p , unsigned int res , unsigned long long &seed , const class Shape &shape , Util::Point3D cLimit , Util::Point3D &sum ) const;
+	public:
+		/** This static method returns the directive describing the Light. */
+		static std::string Directive( void ){ return "light_area"; }
+
+		/** The default constructor */
+		AreaLight( void );
+
+		///////////////////
+		// Light methods //
+		///////////////////
+	private:
+		void _write( std::ostream &stream ) const;
+		void _read( std::istream &stream );
+	public:
+		std::string name( void ) const { return "area light"; }
+		bool getAttenuation( Util::Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const;
+		void setShadowCasters( const class ShapeList &shapes );
+		Util::BoundingBox3D shadowVolume( const Util::BoundingBox3D &bBox , const Util::BoundingBox3D &region ) const;
+		Util::Point3D getAmbient ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
+		Util::Point3D getDiffuse ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
+		Util::Point3D getSpecular( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
+		bool isInShadow( const class RayShapeIntersectionInfo& iInfo , const class Shape* shape ) const;
+		Util::Point3D transparency( const class RayShapeIntersectionInfo &iInfo , const class Shape &shape , Util::Point3D cLimit ) const;
+		void drawOpenGL( int index , GLSLProgram * glslProgram ) const;
+	};
+}
+#endif // AREA_LIGHT_INCLUDED
@@ -24,3 +24,5 @@ void Box::_write( ostream &stream ) const
 }
 
 size_t Box::primitiveNum( void ) const { return 1; }
+
+unsigned int Box::maxSpanNum( void ) const { return 1; }
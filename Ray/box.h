@@ -37,7 +37,9 @@ namespace Ray
 		void init( const class LocalSceneData& data  );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		bool isInside( Util::Point3D p ) const;
 		void drawOpenGL( GLSLProgram *glslProgram ) const;
 		size_t primitiveNum( void ) const;
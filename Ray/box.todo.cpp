@@ -28,7 +28,6 @@ void Box::updateBoundingBox( void )
 	///////////////////////////////
 	// Set the _bBox object here //
 	///////////////////////////////
-	THROW( "method undefined" );
 	Point3D p1, p2;
 	p1 = center - length / 2.0;
 	p2 = center + length / 2.0;
@@ -49,24 +48,70 @@ void Box::initOpenGL( void )
 	ASSERT_OPEN_GL_STATE();	
 }
 
-double Box::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Box::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
-	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
-
 	/////////////////////////////////////////////////////////////
 	// Compute the intersection of the shape with the ray here //
 	/////////////////////////////////////////////////////////////
-	THROW( "method undefined" );
+	// The first intersection is the first end-point of the span that lies on a face
+	RaySpan span;
+	if( !spans( ray , range , &span ) ) return Infinity;
+	for( int i=0 ; i<2 ; i++ ) if( span.iInfo[i].material && validityLambda( span.t[i] ) )
+	{
+		iInfo = span.iInfo[i];
+		return span.t[i];
+	}
 	return Infinity;
 }
 
+unsigned int Box::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
+
+	// Intersect the slabs, tracking the axes of the faces through which the ray enters and exits
+	double t[2];
+	int axis[] = { -1 , -1 };
+	for( int d=0 ; d<3 ; d++ )
+	{
+		double min = center[d] - length[d] / 2 , max = center[d] + length[d] / 2;
+		if( ray.direction[d]==0 )
+		{
+			if( ray.position[d]<min || ray.position[d]>max ) return 0;
+			continue;
+		}
+		double t0 = ( min - ray.position[d] ) / ray.direction[d] , t1 = ( max - ray.position[d] ) / ray.direction[d];
+		if( t0>t1 ) std::swap( t0 , t1 );
+		if( axis[0]==-1 || t0>t[0] ) t[0] = t0 , axis[0] = d;
+		if( axis[1]==-1 || t1<t[1] ) t[1] = t1 , axis[1] = d;
+	}
+	if( axis[0]==-1 || t[0]>=t[1] || t[1]<range[0][0] || t[0]>range[1][0] ) return 0;
+
+	// Clip the end-points that fall outside of the range
+	bool inRange[] = { t[0]>=range[0][0] , t[1]<=range[1][0] };
+	for( int i=0 ; i<2 ; i++ )
+	{
+		RayShapeIntersectionInfo &iInfo = spans[0].iInfo[i];
+		if( inRange[i] )
+		{
+			spans[0].t[i] = t[i];
+			iInfo.material = _material;
+			iInfo.position = ray( t[i] );
+			iInfo.normal = Point3D();
+			iInfo.normal[ axis[i] ] = ( ray.direction[ axis[i] ]<0 )==( i==0 ) ? 1 : -1;
+			iInfo.texture = Point2D();
+		}
+		else spans[0].t[i] = range[i][0] , iInfo.material = NULL;
+	}
+	return 1;
+}
+
 bool Box::isInside( Point3D p ) const
 {
 	///////////////////////////////////////////////////
 	// Determine if the point is inside the box here //
 	///////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return false;
+	for( int d=0 ; d<3 ; d++ ) if( fabs( p[d] - center[d] )>length[d] / 2 ) return false;
+	return true;
 }
 
 void Box::drawOpenGL( GLSLProgram * glslProgram ) const
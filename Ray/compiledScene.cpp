@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <Util/exceptions.h>
+#include "compiledScene.h"
+#include "scene.h"
+#include "fileInstance.h"
+#include "scratchArena.h"
+
+using namespace Ray;
+using namespace Util;
+
+///////////////////
+// CompiledScene //
+///////////////////
+std::string CompiledScene::Names[] = { "list" , "nearest" , "affine" , "triangle" , "sphere" , "box" , "cone" , "cylinder" , "torus" , "generic" };
+
+void CompiledScene::compile( const SceneGeometry &geometry )
+{
+	_nodes.clear() , _bBoxes.clear() , _sources.clear() , _children.clear() , _materials.clear() , _affines.clear();
+	_triangles.clear() , _spheres.clear() , _boxes.clear() , _cones.clear() , _cylinders.clear() , _tori.clear() , _shapes.clear();
+	_nodeIndices.clear();
+	for( int i=0 ; i<COUNT ; i++ ) _nodeNum[i] = 0;
+	_root = _compile( &geometry._shapeList );
+}
+
+bool CompiledScene::empty( void ) const { return _nodes.empty(); }
+
+size_t CompiledScene::nodeNum( int type ) const { return _nodes.empty() ? 0 : _nodeNum[type]; }
+
+void CompiledScene::updateBoundingBoxes( void ){ for( size_t i=0 ; i<_nodes.size() ; i++ ) _bBoxes[i] = _sources[i]->boundingBox(); }
+
+unsigned int CompiledScene::_addNode( const Shape *shape , unsigned int type , unsigned int index , const std::vector< unsigned int > &children )
+{
+	_Node node;
+	node.type = type , node.index = index;
+	node.begin = (unsigned int)_children.size();
+	_children.insert( _children.end() , children.begin() , children.end() );
+	node.end = (unsigned int)_children.size();
+
+	unsigned int n = (unsigned int)_nodes.size();
+	_nodes.push_back( node );
+	_bBoxes.push_back( shape->boundingBox() );
+	_sources.push_back( shape );
+	_nodeNum[type]++;
+	_nodeIndices[ shape ] = n;
+	return n;
+}
+
+unsigned int CompiledScene::_compile( const Shape *shape )
+{
+	auto iter = _nodeIndices.find( shape );
+	if( iter!=_nodeIndices.end() ) return iter->second;
+
+	std::vector< unsigned int > children;
+
+	// A file instance has the same bounding box as its file and intersects it directly, so it shares the file's node
+	if( const FileInstance *instance = dynamic_cast< const FileInstance * >( shape ) )
+	{
+		unsigned int n = _compile( &instance->_file->_shapeList );
+		_nodeIndices[ shape ] = n;
+		return n;
+	}
+	else if( const StaticAffineShape *affine = dynamic_cast< const StaticAffineShape * >( shape ) )
+	{
+		children.push_back( _compile( affine->_shape ) );
+		_Affine a;
+		a.matrix = affine->getMatrix() , a.inverseMatrix = affine->getInverseMatrix() , a.normalMatrix = affine->getNormalMatrix();
+		_affines.push_back( a );
+		return _addNode( shape , AFFINE , (unsigned int)_affines.size()-1 , children );
+	}
+	else if( const TriangleList *triangleList = dynamic_cast< const TriangleList * >( shape ) )
+	{
+		for( size_t i=0 ; i<triangleList->_shapeList.shapes.size() ; i++ ) children.push_back( _compile( triangleList->_shapeList.shapes[i] ) );
+		_materials.push_back( triangleList->_material );
+		return _addNode( shape , NEAREST , (unsigned int)_materials.size()-1 , children );
+	}
+	else if( const ShapeList *shapeList = dynamic_cast< const ShapeList * >( shape ) )
+	{
+		for( size_t i=0 ; i<shapeList->shapes.size() ; i++ ) children.push_back( _compile( shapeList->shapes[i] ) );
+		return _addNode( shape , LIST , 0 , children );
+	}
+	else if( const Triangle *triangle = dynamic_cast< const Triangle * >( shape ) )
+	{
+		_triangles.push_back( *triangle );
+		return _addNode( shape , TRIANGLE , (unsigned int)_triangles.size()-1 , children );
+	}
+	else if( const Sphere *sphere = dynamic_cast< const Sphere * >( shape ) )
+	{
+		_spheres.push_back( *sphere );
+		return _addNode( shape , SPHERE , (unsigned int)_spheres.size()-1 , children );
+	}
+	else if( const Box *box = dynamic_cast< const Box * >( shape ) )
+	{
+		_boxes.push_back( *box );
+		return _addNode( shape , BOX , (unsigned int)_boxes.size()-1 , children );
+	}
+	else if( const Cone *cone = dynamic_cast< const Cone * >( shape ) )
+	{
+		_cones.push_back( *cone );
+		return _addNode( shape , CONE , (unsigned int)_cones.size()-1 , children );
+	}
+	else if( const Cylinder *cylinder = dynamic_cast< const Cylinder * >( shape ) )
+	{
+		_cylinders.push_back( *cylinder );
+		return _addNode( shape , CYLINDER , (unsigned int)_cylinders.size()-1 , children );
+	}
+	else if( const Torus *torus = dynamic_cast< const Torus * >( shape ) )
+	{
+		_tori.push_back( *torus );
+		return _addNode( shape , TORUS , (unsigned int)_tori.size()-1 , children );
+	}
+	else
+	{
+		_shapes.push_back( shape );
+		return _addNode( shape , GENERIC , (unsigned int)_shapes.size()-1 , children );
+	}
+}
+
+double CompiledScene::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityFunction ) const
+{
+	if( _nodes.empty() ) THROW( "scene has not been compiled" );
+	return _intersect( _root , ray , iInfo , range , validityFunction );
+}
+
+double CompiledScene::_intersect( unsigned int n , Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityFunction ) const
+{
+	const _Node &node = _nodes[n];
+	switch( node.type )
+	{
+		case TRIANGLE: return _triangles[ node.index ].Triangle::intersect( ray , iInfo , range , validityFunction );
+		case SPHERE:   return _spheres  [ node.index ].Sphere  ::intersect( ray , iInfo , range , validityFunction );
+		case BOX:      return _boxes    [ node.index ].Box     ::intersect( ray , iInfo , range , validityFunction );
+		case CONE:     return _cones    [ node.index ].Cone    ::intersect( ray , iInfo , range , validityFunction );
+		case CYLINDER: return _cylinders[ node.index ].Cylinder::intersect( ray , iInfo , range , validityFunction );
+		case TORUS:    return _tori     [ node.index ].Torus   ::intersect( ray , iInfo , range , validityFunction );
+		case GENERIC:  return _shapes   [ node.index ]->intersect( ray , iInfo , range , validityFunction );
+		case AFFINE:
+		{
+			// As in AffineShape::intersect: trace the ray in the child's coordinate frame and transform the hit back
+			const _Affine &affine = _affines[ node.index ];
+			double t = _intersect( _children[ node.begin ] , affine.inverseMatrix * ray , iInfo , range , validityFunction );
+			if( t<Infinity )
+			{
+				iInfo.position = affine.matrix * iInfo.position;
+				iInfo.normal = ( affine.normalMatrix * iInfo.normal ).unit();
+			}
+			return t;
+		}
+		case NEAREST:
+		{
+			// As in TriangleList::intersect: return the closest hit over all the children
+			RayShapeIntersectionInfo _iInfo;
+			double t = Infinity;
+			for( unsigned int c=node.begin ; c<node.end ; c++ )
+			{
+				double _t = _intersect( _children[c] , ray , _iInfo , range , validityFunction );
+				if( _t<t ) t = _t , iInfo = _iInfo , iInfo.material = _materials[ node.index ];
+			}
+			return t;
+		}
+		case LIST:
+		{
+			// As in ShapeList::intersect: visit the children whose bounding boxes are hit, in the order of the hits, and return the first intersection
+			if( _bBoxes[n].intersect( ray ).isEmpty() ) return Infinity;
+
+			ScratchArena &arena = ScratchArena::ThreadArena();
+			ScratchArena::Mark mark = arena.mark();
+			_Hit *hits = arena.allocate< _Hit >( node.end - node.begin );
+			unsigned int hitNum = 0;
+			for( unsigned int c=node.begin ; c<node.end ; c++ )
+			{
+				const ShapeBoundingBox &bBox = _bBoxes[ _children[c] ];
+				if( bBox.isEmpty() ) continue;
+				BoundingBox1D _range = bBox.intersect( ray );
+				if( !_range.isEmpty() ) hits[hitNum].t = _range[0][0] , hits[hitNum++].node = _children[c];
+			}
+			std::sort( hits , hits+hitNum , _Hit::Compare );
+
+			double t = Infinity;
+			for( unsigned int i=0 ; i<hitNum && t==Infinity ; i++ ) t = _intersect( hits[i].node , ray , iInfo , range , validityFunction );
+			arena.release( mark );
+			return t;
+		}
+		default: THROW( "unrecognized node type: %d" , node.type );
+	}
+	return Infinity;
+}
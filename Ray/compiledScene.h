@@ -0,0 +1,138 @@
+#ifndef COMPILED_SCENE_INCLUDED
+#define COMPILED_SCENE_INCLUDED
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <Util/geometry.h>
+#include "shape.h"
+#include "triangle.h"
+#include "sphere.h"
+#include "box.h"
+#include "cone.h"
+#include "cylinder.h"
+#include "torus.h"
+
+namespace Ray
+{
+	/** This class stores a data-oriented copy of the scene-graph used for ray-tracing.
+	*** The Shape tree remains the authoring/IO representation, and is lowered at initialization into a contiguous array of
+	*** type-tagged nodes whose children are stored contiguously. Primitives are copied into per-type arrays, and the nodes are
+	*** traversed with a switch on the type so that no virtual calls are made on the hot path.
+	*** The traversal reproduces the semantics of the Shape classes it replaces (the bounding-box ordering of ShapeList,
+	*** the nearest-hit search of TriangleList, and the ray transformation of StaticAffineShape), so the intersections are identical.
+	*** Shapes without a compiled form (e.g. dynamic transformations and CSG nodes) are kept as generic nodes that call back into the Shape. */
+	class CompiledScene
+	{
+	public:
+		/** The types of nodes */
+		enum
+		{
+			LIST ,
+			NEAREST ,
+			AFFINE ,
+			TRIANGLE ,
+			SPHERE ,
+			BOX ,
+			CONE ,
+			CYLINDER ,
+			TORUS ,
+			GENERIC ,
+			COUNT
+		};
+
+		/** The names of the node types */
+		static std::string Names[];
+
+		/** This method lowers the scene-graph of the prescribed geometry, replacing any previously compiled representation. */
+		void compile( const class SceneGeometry &geometry );
+
+		/** This method returns true if no scene-graph has been compiled. */
+		bool empty( void ) const;
+
+		/** This method returns the number of nodes of the prescribed type. */
+		size_t nodeNum( int type ) const;
+
+		/** This method copies the bounding boxes from the Shapes that the nodes were compiled from.
+		*** It should be called whenever the bounding boxes of the scene-graph are updated. */
+		void updateBoundingBoxes( void );
+
+		/** This method ray-traces the compiled scene-graph. */
+		double intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+
+	protected:
+		/** A node in the compiled scene-graph */
+		struct _Node
+		{
+			/** The type of the node */
+			unsigned int type;
+
+			/** The index of the node's data within the array associated with its type */
+			unsigned int index;
+
+			/** The range of the node's children within the array of children */
+			unsigned int begin , end;
+		};
+
+		/** The transformation data associated with an AFFINE node */
+		struct _Affine
+		{
+			Util::Matrix4D matrix , inverseMatrix , normalMatrix;
+		};
+
+		/** A node whose bounding box is hit by the ray */
+		struct _Hit
+		{
+			double t;
+			unsigned int node;
+			static bool Compare( const _Hit &h1 , const _Hit &h2 ){ return h1.t<h2.t; }
+		};
+
+		/** The nodes, with children preceding their parents */
+		std::vector< _Node > _nodes;
+
+		/** The index of the root node */
+		unsigned int _root;
+
+		/** The bounding boxes of the nodes */
+		std::vector< ShapeBoundingBox > _bBoxes;
+
+		/** The Shapes the nodes were compiled from */
+		std::vector< const Shape * > _sources;
+
+		/** The indices of the children of the nodes */
+		std::vector< unsigned int > _children;
+
+		/** The materials of the NEAREST nodes */
+		std::vector< const Material * > _materials;
+
+		/** The transformations of the AFFINE nodes */
+		std::vector< _Affine > _affines;
+
+		/** The primitives */
+		std::vector< Triangle > _triangles;
+		std::vector< Sphere > _spheres;
+		std::vector< Box > _boxes;
+		std::vector< Cone > _cones;
+		std::vector< Cylinder > _cylinders;
+		std::vector< Torus > _tori;
+
+		/** The shapes of the GENERIC nodes */
+		std::vector< const Shape * > _shapes;
+
+		/** The number of nodes of each type */
+		size_t _nodeNum[ COUNT ];
+
+		/** The map from the Shapes to the nodes they were compiled into, so that shared sub-graphs are compiled once */
+		std::unordered_map< const Shape * , unsigned int > _nodeIndices;
+
+		/** This method compiles the Shape (and its descendants), returning the index of the node. */
+		unsigned int _compile( const Shape *shape );
+
+		/** This method adds a node compiled from the Shape, with the prescribed children, and returns its index. */
+		unsigned int _addNode( const Shape *shape , unsigned int type , unsigned int index , const std::vector< unsigned int > &children );
+
+		/** This method ray-traces the sub-graph rooted at the prescribed node. */
+		double _intersect( unsigned int node , Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range , ValidityFunction validityFunction ) const;
+	};
+}
+#endif // COMPILED_SCENE_INCLUDED
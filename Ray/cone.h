@@ -49,7 +49,7 @@ namespace Ray
 		void init( const class LocalSceneData &data );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
 		bool isInside( Util::Point3D p ) const;
 		void drawOpenGL( GLSLProgram *glslProgram ) const;
 		size_t primitiveNum( void ) const;
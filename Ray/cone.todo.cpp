@@ -67,7 +67,7 @@ void Cone::initOpenGL( void )
 	ASSERT_OPEN_GL_STATE();	
 }
 
-double Cone::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Cone::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
 
@@ -64,7 +64,7 @@ void Cylinder::initOpenGL( void )
 	ASSERT_OPEN_GL_STATE();	
 }
 
-double Cylinder::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Cylinder::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
 
@@ -23,3 +23,19 @@ void DirectionalLight::_write( std::ostream &stream ) const
 {
 	stream << "#" << Directive() << "  " << _ambient << "  " << _diffuse << "  " << _specular << "  " << _direction;
 }
+
+void DirectionalLight::setShadowCasters( const ShapeList &shapes )
+{
+	// The light reaches every point, so any shape can cast a shadow
+	_casters.set( shapes , []( const BoundingBox3D & ){ return true; } );
+}
+
+BoundingBox3D DirectionalLight::shadowVolume( const BoundingBox3D &bBox , const BoundingBox3D &region ) const
+{
+	// The shadow rays leave against the direction of the light, so the shadowed points are obtained by sweeping the box along it,
+	// and the sweep can stop once it has crossed the region
+	BoundingBox3D extent = bBox + region;
+	double T = ( extent[1] - extent[0] ).length() / _direction.length() + 1;
+	Point3D corners[] = { bBox[0] , bBox[1] , bBox[0] + _direction * T , bBox[1] + _direction * T };
+	return BoundingBox3D( corners , 4 ) ^ region;
+}
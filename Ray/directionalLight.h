@@ -1,6 +1,7 @@
 #ifndef DIRECTIONAL_LIGHT_INCLUDED
 #define DIRECTIONAL_LIGHT_INCLUDED
 #include "light.h"
+#include "shadowCasters.h"
 
 namespace Ray
 {
@@ -10,6 +11,9 @@ namespace Ray
 	{
 		/** The direction the outgoing light rays */
 		Util::Point3D _direction;
+
+		/** The scene-graph the shadow rays are traced through */
+		ShadowCasters _casters;
 	public:
 		/** This static method returns the directive describing the Light. */
 		static std::string Directive( void ){ return "light_dir"; }
@@ -22,6 +26,8 @@ namespace Ray
 		void _read( std::istream &stream );
 	public:
 		std::string name( void ) const { return "directional light"; }
+		void setShadowCasters( const class ShapeList &shapes );
+		Util::BoundingBox3D shadowVolume( const Util::BoundingBox3D &bBox , const Util::BoundingBox3D &region ) const;
 		Util::Point3D getAmbient ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
 		Util::Point3D getDiffuse ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
 		Util::Point3D getSpecular( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
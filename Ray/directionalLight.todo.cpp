@@ -77,7 +77,7 @@ bool DirectionalLight::isInShadow( const RayShapeIntersectionInfo& iInfo , const
     Ray3D ray(p0, v);
     BoundingBox1D range(Epsilon, Infinity);
     RayShapeIntersectionInfo info;
-    double t = shape->intersect(ray, info, range);
+    double t = _casters.built() ? _casters.intersect(ray, info, range) : shape->intersect(ray, info, range);
     
     if (t < Infinity) {
         return true; // Shadow if there's an intersection
@@ -96,11 +96,15 @@ Point3D DirectionalLight::transparency( const RayShapeIntersectionInfo &iInfo ,
     Point3D trans = Point3D(1.0, 1.0, 1.0);
     BoundingBox1D range(Epsilon, Infinity);
     RayShapeIntersectionInfo dummy;
-    double intersect = shape.intersect(ray, dummy, range);
+    // The last occluder is tested first
+    auto occluders = [&](Ray3D ray, RayShapeIntersectionInfo &info, BoundingBox1D range) {
+        return _casters.built() ? _casters.intersect(ray, info, range) : shape.intersect(ray, info, range);
+    };
+    double intersect = occluders(ray, dummy, range);
     while (intersect < Infinity && trans[0] > cLimit[0] && trans[1] > cLimit[1] && trans[2] > cLimit[2]) {
         trans *= dummy.material->transparent;
         Ray3D new_ray = Ray3D(dummy.position + L * 1e-5, L);
-        intersect = shape.intersect(new_ray, dummy, range);
+        intersect = occluders(new_ray, dummy, range);
     }
     return trans;
 }
@@ -33,10 +33,22 @@ void FileInstance::updateBoundingBox( void ){ _bBox = _file->boundingBox(); }
 
 void FileInstance::initOpenGL( void ){}
 
-double FileInstance::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const { return _file->intersect( ray , iInfo , range , validityLambda ); }
+double FileInstance::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const { return _file->intersect( ray , iInfo , range , validityLambda ); }
+
+void FileInstance::intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , BoundingBox1D range ) const { _file->intersectPacket( packet , mask , iInfo , t , range ); }
+
+unsigned int FileInstance::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const { return _file->spans( ray , range , spans ); }
+
+unsigned int FileInstance::maxSpanNum( void ) const { return _file->maxSpanNum(); }
 
 bool FileInstance::isInside( Point3D p ) const { return _file->isInside(p); }
 
 void FileInstance::drawOpenGL( GLSLProgram * glslProgram ) const { _file->drawOpenGL( glslProgram ); }
 
+void FileInstance::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const { _file->boundTextureFootprints( toWorld , eye , pixelAngle , footprints ); }
+
+void FileInstance::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const { _file->addAnimatedNodes( toWorld , nodes ); }
+
 size_t FileInstance::primitiveNum( void ) const { return _file->primitiveNum(); }
+
+size_t FileInstance::depth( void ) const { return _file->depth()+1; }
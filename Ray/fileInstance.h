@@ -9,6 +9,8 @@ namespace Ray
 	/** This subclass of RayShape stores a reference to a .ray file included in the scene-graph.*/
 	class FileInstance : public Shape
 	{
+		friend class CompiledScene;
+
 		/** The index of the file associated to the instance */
 		int _fileIndex;
 
@@ -32,10 +34,16 @@ namespace Ray
 		void init( const class LocalSceneData &data );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return t>0; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		void intersectPacket( const RayPacket &packet , unsigned int mask , class RayShapeIntersectionInfo iInfo[] , double t[] , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		bool isInside( Util::Point3D p ) const;
 		void drawOpenGL( GLSLProgram * glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
 	};
 }
 #endif // RAY_FILE_INSTANCE_INCLUDED
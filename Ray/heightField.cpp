@@ -0,0 +1,247 @@
+#include <cmath>
+#include <algorithm>
+#include <Util/exceptions.h>
+#include <Util/cmdLineParser.h>
+#include <Image/image.h>
+#include "heightField.h"
+#include "scene.h"
+
+using namespace Ray;
+using namespace Util;
+
+/////////////////
+// HeightField //
+/////////////////
+HeightField::HeightField( void ) : _materialIndex(-1) , _material(NULL) , _width(0) , _height(0) {}
+
+size_t HeightField::primitiveNum( void ) const { return 2 * (size_t)( _width-1 ) * ( _height-1 ); }
+
+// A ray crosses fewer than _width+_height cells, and crosses the surface at most twice within a cell, so it has at most one span per cell
+unsigned int HeightField::maxSpanNum( void ) const { return std::min< unsigned int >( _width + _height , LargestMaxSpanNum ); }
+
+void HeightField::_read( std::istream &stream )
+{
+	if( !( stream >> _materialIndex >> _fileName >> _min >> _max ) ) THROW( "failed to parse %s" , Directive().c_str() );
+	if( _min[0]>=_max[0] || _min[2]>=_max[2] || _min[1]>_max[1] ) THROW( "bad extents: %g %g %g -> %g %g %g" , _min[0] , _min[1] , _min[2] , _max[0] , _max[1] , _max[2] );
+	_readImage();
+	_buildPyramid();
+}
+
+void HeightField::_write( std::ostream &stream ) const
+{
+	Shape::WriteInset( stream );
+	stream << "#" << Directive() << "  " << _materialIndex << "  " << _fileName << "  " << _min << "  " << _max;
+}
+
+void HeightField::_readImage( void )
+{
+	Image::Image32 image;
+	image.read( GetFileName( Scene::BaseDir , _fileName ) );
+	if( image.width()<2 || image.height()<2 ) THROW( "height field image must be at least 2x2: %s" , _fileName.c_str() );
+	_width = image.width() , _height = image.height();
+	_samples.resize( (size_t)_width * _height );
+	for( unsigned int j=0 ; j<_height ; j++ ) for( unsigned int i=0 ; i<_width ; i++ )
+	{
+		const Image::Pixel32 &p = image( i , j );
+		_samples[ (size_t)j*_width+i ] = (unsigned char)( ( (unsigned int)p.r + p.g + p.b ) / 3 );
+	}
+}
+
+void HeightField::_buildPyramid( void )
+{
+	_levels.clear();
+	unsigned int width = _width-1 , height = _height-1;
+	while( width>1 || height>1 )
+	{
+		_Level level;
+		level.width = ( width+1 )/2 , level.height = ( height+1 )/2;
+		level.minSamples.resize( (size_t)level.width * level.height );
+		level.maxSamples.resize( (size_t)level.width * level.height );
+		unsigned int l = (unsigned int)_levels.size();
+		for( unsigned int j=0 ; j<level.height ; j++ ) for( unsigned int i=0 ; i<level.width ; i++ )
+		{
+			unsigned char minSample = 255 , maxSample = 0;
+			for( unsigned int jj=2*j ; jj<std::min< unsigned int >( 2*j+2 , height ) ; jj++ ) for( unsigned int ii=2*i ; ii<std::min< unsigned int >( 2*i+2 , width ) ; ii++ )
+			{
+				unsigned char _minSample , _maxSample;
+				_sampleRange( l , ii , jj , _minSample , _maxSample );
+				minSample = std::min( minSample , _minSample ) , maxSample = std::max( maxSample , _maxSample );
+			}
+			level.minSamples[ (size_t)j*level.width+i ] = minSample;
+			level.maxSamples[ (size_t)j*level.width+i ] = maxSample;
+		}
+		_levels.push_back( level );
+		width = level.width , height = level.height;
+	}
+}
+
+unsigned char HeightField::_sample( unsigned int i , unsigned int j ) const { return _samples[ (size_t)j*_width+i ]; }
+
+double HeightField::_elevation( unsigned char sample ) const { return _min[1] + ( _max[1] - _min[1] ) * sample / 255.; }
+
+Point3D HeightField::_position( unsigned int i , unsigned int j ) const
+{
+	return Point3D( _min[0] + ( _max[0] - _min[0] ) * i / ( _width-1 ) , _elevation( _sample( i , j ) ) , _min[2] + ( _max[2] - _min[2] ) * j / ( _height-1 ) );
+}
+
+Point2D HeightField::_texCoordinate( unsigned int i , unsigned int j ) const { return Point2D( (double)i / ( _width-1 ) , (double)j / ( _height-1 ) ); }
+
+void HeightField::_sampleRange( unsigned int level , unsigned int i , unsigned int j , unsigned char &minSample , unsigned char &maxSample ) const
+{
+	if( level )
+	{
+		const _Level &l = _levels[ level-1 ];
+		minSample = l.minSamples[ (size_t)j*l.width+i ] , maxSample = l.maxSamples[ (size_t)j*l.width+i ];
+	}
+	else
+	{
+		unsigned char s[] = { _sample( i , j ) , _sample( i+1 , j ) , _sample( i , j+1 ) , _sample( i+1 , j+1 ) };
+		minSample = *std::min_element( s , s+4 ) , maxSample = *std::max_element( s , s+4 );
+	}
+}
+
+void HeightField::init( const LocalSceneData &data )
+{
+	// Set the material pointer
+	if( _materialIndex<0 ) THROW( "negative material index: %d" , _materialIndex );
+	else if( (size_t)_materialIndex>=data.materials.size() ) THROW( "material index out of bounds: %d <= %d" , _materialIndex , (int)data.materials.size() );
+	else _material = &data.materials[ _materialIndex ];
+}
+
+void HeightField::updateBoundingBox( void )
+{
+	unsigned char minSample , maxSample;
+	_sampleRange( (unsigned int)_levels.size() , 0 , 0 , minSample , maxSample );
+	_bBox = BoundingBox3D( Point3D( _min[0] , _elevation( minSample ) , _min[2] ) , Point3D( _max[0] , _elevation( maxSample ) , _max[2] ) );
+}
+
+void HeightField::initOpenGL( void ){ WARN_ONCE( "method undefined" ); }
+
+void HeightField::drawOpenGL( GLSLProgram * ) const { WARN_ONCE( "method undefined" ); }
+
+void HeightField::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const
+{
+	if( !_material || !_material->tex ) return;
+
+	// The texture coordinates are linear in the horizontal coordinates, so the texel scale of a cell is largest when the cell is flat
+	double extent = fabs( _max[0] - _min[0] ) * fabs( _max[2] - _min[2] );
+	Texture::BoundFootprints( footprints , _material->tex , toWorld * BoundingBox3D( _min , _max ) , eye , pixelAngle , extent>0 ? sqrt( 1. / extent ) : 0 );
+}
+
+bool HeightField::_intersect( const Point3D v[3] , const Point2D tex[3] , Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda , double &t ) const
+{
+	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
+
+	Point3D e1 = v[1] - v[0] , e2 = v[2] - v[0];
+	Point3D normal = Point3D::CrossProduct( e1 , e2 ).unit();
+	double denominator = normal.dot( ray.direction );
+	if( fabs( denominator )<Epsilon ) return false;
+
+	double _t = ( normal.dot( v[0] ) - normal.dot( ray.position ) ) / denominator;
+	if( _t<range[0][0] || _t>range[1][0] || !validityLambda( _t ) ) return false;
+
+	Point3D p = ray.position + ray.direction * _t;
+	Point3D c1 = Point3D::CrossProduct( v[1] - v[0] , p - v[0] );
+	Point3D c2 = Point3D::CrossProduct( v[2] - v[1] , p - v[1] );
+	double area = normal.dot( Point3D::CrossProduct( e1 , e2 ) );
+	if( fabs( area )<Epsilon ) return false;
+
+	double beta = c1.dot( normal ) / area , gamma = c2.dot( normal ) / area , alpha = 1. - beta - gamma;
+	if( alpha<0 || beta<0 || gamma<0 ) return false;
+
+	iInfo.position = p;
+	iInfo.normal = normal;
+	iInfo.texture = alpha * tex[1] + beta * tex[2] + gamma * tex[0];
+	Point2D t1 = tex[1] - tex[0] , t2 = tex[2] - tex[0];
+	iInfo.texelScale = sqrt( fabs( t1[0] * t2[1] - t1[1] * t2[0] ) / fabs( area ) );
+	iInfo.material = _material;
+	t = _t;
+	return true;
+}
+
+bool HeightField::_intersect( unsigned int i , unsigned int j , Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda , double &t ) const
+{
+	// The cell is split along the diagonal from (i,j) to (i+1,j+1), with both triangles facing up
+	Point3D v[] = { _position( i , j ) , _position( i , j+1 ) , _position( i+1 , j+1 ) , _position( i+1 , j ) };
+	Point2D tex[] = { _texCoordinate( i , j ) , _texCoordinate( i , j+1 ) , _texCoordinate( i+1 , j+1 ) , _texCoordinate( i+1 , j ) };
+	Point3D v1[] = { v[0] , v[1] , v[2] } , v2[] = { v[0] , v[2] , v[3] };
+	Point2D tex1[] = { tex[0] , tex[1] , tex[2] } , tex2[] = { tex[0] , tex[2] , tex[3] };
+
+	// The second triangle only replaces the first if it is hit no further along the ray
+	bool hit = _intersect( v1 , tex1 , ray , iInfo , range , validityLambda , t );
+	if( hit ) range[1][0] = t;
+	return _intersect( v2 , tex2 , ray , iInfo , range , validityLambda , t ) || hit;
+}
+
+double HeightField::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
+{
+	// As with the sphere cloud, axes along which the ray does not move are tested for containment
+	bool moves[3];
+	Point3D inverseDirection;
+	for( int d=0 ; d<3 ; d++ ) moves[d] = ray.direction[d]!=0 , inverseDirection[d] = moves[d] ? 1./ray.direction[d] : 0;
+
+	// Returns true if the ray passes through the box within the range
+	auto Crosses = [&]( Point3D min , Point3D max )
+	{
+		RayTracingStats::IncrementRayBoundingBoxIntersectionNum();
+		double start = range[0][0] , end = range[1][0];
+		for( int d=0 ; d<3 ; d++ )
+		{
+			if( !moves[d] )
+			{
+				if( ray.position[d]<min[d] || ray.position[d]>max[d] ) return false;
+				continue;
+			}
+			double t0 = ( min[d] - ray.position[d] ) * inverseDirection[d];
+			double t1 = ( max[d] - ray.position[d] ) * inverseDirection[d];
+			if( inverseDirection[d]<0 ) std::swap( t0 , t1 );
+			start = std::max( start , t0 ) , end = std::min( end , t1 );
+		}
+		return start<=end;
+	};
+
+	// The order in which the ray crosses the quadrants of a node
+	unsigned int flipX = ray.direction[0]<0 ? 1 : 0 , flipZ = ray.direction[2]<0 ? 1 : 0;
+
+	struct Node{ unsigned int level , i , j; };
+	Node stack[128];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = { (unsigned int)_levels.size() , 0 , 0 };
+	while( stackSize )
+	{
+		Node node = stack[--stackSize];
+		unsigned int width = node.level ? _levels[node.level-1].width : _width-1 , height = node.level ? _levels[node.level-1].height : _height-1;
+		if( node.i>=width || node.j>=height ) continue;
+
+		// Get the bounding box of the node, padded vertically so that grazing hits on the triangles are not culled
+		unsigned char minSample , maxSample;
+		_sampleRange( node.level , node.i , node.j , minSample , maxSample );
+		unsigned int i0 = node.i<<node.level , j0 = node.j<<node.level;
+		unsigned int i1 = std::min< unsigned int >( ( node.i+1 )<<node.level , _width-1 ) , j1 = std::min< unsigned int >( ( node.j+1 )<<node.level , _height-1 );
+		Point3D min( _min[0] + ( _max[0] - _min[0] ) * i0 / ( _width-1 ) , _elevation( minSample ) - Epsilon , _min[2] + ( _max[2] - _min[2] ) * j0 / ( _height-1 ) );
+		Point3D max( _min[0] + ( _max[0] - _min[0] ) * i1 / ( _width-1 ) , _elevation( maxSample ) + Epsilon , _min[2] + ( _max[2] - _min[2] ) * j1 / ( _height-1 ) );
+		if( !Crosses( min , max ) ) continue;
+
+		// Since the nodes are visited in the order the ray crosses them, the first cell that is hit contains the nearest hit
+		if( !node.level )
+		{
+			double t;
+			if( _intersect( node.i , node.j , ray , iInfo , range , validityLambda , t ) ) return t;
+		}
+		else for( int k=3 ; k>=0 ; k-- ) stack[stackSize++] = { node.level-1 , 2*node.i + ( ( k>>1 ) ^ flipX ) , 2*node.j + ( ( k&1 ) ^ flipZ ) };
+	}
+	return Infinity;
+}
+
+bool HeightField::isInside( Point3D p ) const
+{
+	if( p[0]<_min[0] || p[0]>_max[0] || p[2]<_min[2] || p[2]>_max[2] || p[1]<_min[1] ) return false;
+
+	// Find the cell containing the point and interpolate the height over the triangle containing it
+	double x = ( p[0] - _min[0] ) / ( _max[0] - _min[0] ) * ( _width-1 ) , z = ( p[2] - _min[2] ) / ( _max[2] - _min[2] ) * ( _height-1 );
+	unsigned int i = std::min< unsigned int >( (unsigned int)x , _width-2 ) , j = std::min< unsigned int >( (unsigned int)z , _height-2 );
+	x -= i , z -= j;
+	double h00 = _elevation( _sample( i , j ) ) , h10 = _elevation( _sample( i+1 , j ) ) , h01 = _elevation( _sample( i , j+1 ) ) , h11 = _elevation( _sample( i+1 , j+1 ) );
+	double h = x<=z ? h00 + ( h11 - h01 ) * x + ( h01 - h00 ) * z : h00 + ( h10 - h00 ) * x + ( h11 - h10 ) * z;
+	return p[1]<h;
+}
@@ -0,0 +1,104 @@
+#ifndef HEIGHT_FIELD_INCLUDED
+#define HEIGHT_FIELD_INCLUDED
+#include <string>
+#include <vector>
+#include <Util/geometry.h>
+#include "shape.h"
+
+namespace Ray
+{
+	/** This class describes a terrain whose heights are given by the (gray-scale) samples of an image.
+	*** The samples are spread over a regular grid spanning the x- and z-extents of a bounding box, with the gray values [0,255]
+	*** mapped to its y-extent. Each grid cell is split into two triangles along its (min,min)-(max,max) diagonal, and the
+	*** intersections are computed exactly as for the equivalent Triangles, but only a single (8-bit) value is stored per sample.
+	*** Rays are traversed through a min/max pyramid over the cells, visiting the quadrants of each node in the order that the
+	*** ray crosses them (a hierarchical 2D DDA), so the first cell containing a hit contains the nearest one.
+	*** The shape is described by:
+	***		#shape_heightfield <material index> <image file> <min x> <min y> <min z> <max x> <max y> <max z> */
+	class HeightField : public Shape
+	{
+		/** A level of the min/max pyramid */
+		struct _Level
+		{
+			/** The dimensions of the level */
+			unsigned int width , height;
+
+			/** The minimum and maximum samples within each node of the level */
+			std::vector< unsigned char > minSamples , maxSamples;
+		};
+
+		/** The index of the material associated with the height field */
+		int _materialIndex;
+
+		/** The material associated with the height field */
+		const class Material *_material;
+
+		/** The name of the image the samples were read from */
+		std::string _fileName;
+
+		/** The box the height field spans */
+		Util::Point3D _min , _max;
+
+		/** The dimensions of the grid of samples */
+		unsigned int _width , _height;
+
+		/** The gray-scale samples, in row-major order */
+		std::vector< unsigned char > _samples;
+
+		/** The levels of the pyramid. The i-th level stores the ranges of blocks of 2^{i+1} x 2^{i+1} cells. */
+		std::vector< _Level > _levels;
+
+		/** This method reads the samples from the image. */
+		void _readImage( void );
+
+		/** This method builds the min/max pyramid. */
+		void _buildPyramid( void );
+
+		/** This method returns the sample at the prescribed grid position. */
+		unsigned char _sample( unsigned int i , unsigned int j ) const;
+
+		/** This method returns the height associated with a sample value. */
+		double _elevation( unsigned char sample ) const;
+
+		/** This method returns the position of the prescribed grid vertex. */
+		Util::Point3D _position( unsigned int i , unsigned int j ) const;
+
+		/** This method returns the texture coordinate of the prescribed grid vertex. */
+		Util::Point2D _texCoordinate( unsigned int i , unsigned int j ) const;
+
+		/** This method returns the range of samples over the prescribed node of the pyramid (with level zero denoting the cells). */
+		void _sampleRange( unsigned int level , unsigned int i , unsigned int j , unsigned char &minSample , unsigned char &maxSample ) const;
+
+		/** This method intersects the ray with the two triangles of the prescribed cell, returning true and setting the distance if there is a hit. */
+		bool _intersect( unsigned int i , unsigned int j , Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range , ValidityFunction validityLambda , double &t ) const;
+
+		/** This method intersects the ray with a single triangle, in the same way as Triangle::intersect, returning true and setting the distance if there is a hit. */
+		bool _intersect( const Util::Point3D v[3] , const Util::Point2D tex[3] , Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range , ValidityFunction validityLambda , double &t ) const;
+
+	public:
+		/** This static method returns the directive describing the shape. */
+		static std::string Directive( void ){ return "shape_heightfield"; }
+
+		/** The default constructor */
+		HeightField( void );
+
+		///////////////////
+		// Shape methods //
+		///////////////////
+	private:
+		void _write( std::ostream &stream ) const;
+		void _read( std::istream &stream );
+	public:
+		std::string name( void ) const { return "height field"; }
+		void init( const class LocalSceneData &data );
+		void initOpenGL( void );
+		void updateBoundingBox( void );
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		bool isInside( Util::Point3D p ) const;
+		void drawOpenGL( GLSLProgram * glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		size_t primitiveNum( void ) const;
+		unsigned int maxSpanNum( void ) const;
+	};
+}
+#endif // HEIGHT_FIELD_INCLUDED
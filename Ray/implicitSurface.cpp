@@ -0,0 +1,240 @@
+#include <cmath>
+#include <algorithm>
+#include <Util/exceptions.h>
+#include <Util/polynomial.h>
+#include "implicitSurface.h"
+#include "scene.h"
+
+using namespace Ray;
+using namespace Util;
+
+///////////////////
+// RootIsolation //
+///////////////////
+/** This class isolates the roots of a univariate polynomial within an interval.
+*** The roots of the derivative split the interval into pieces on which the polynomial is monotonic, so that each piece
+*** contains at most one root, which is bracketed by a sign change and refined with safe-guarded Newton iterations.
+*** The recursion on the degree is resolved at compile-time. */
+template< unsigned int Degree >
+struct RootIsolation
+{
+	/** The maximum number of roots returned */
+	static const unsigned int MaxRoots = Degree+1;
+
+	/** This method sets the roots within the interval [a,b] in increasing order, and returns the number of roots. */
+	static unsigned int Roots( const Polynomial1D< Degree > &p , double a , double b , double *roots )
+	{
+		Polynomial1D< Degree-1 > dp = p.d();
+		double criticalPoints[ RootIsolation< Degree-1 >::MaxRoots ];
+		unsigned int criticalPointNum = RootIsolation< Degree-1 >::Roots( dp , a , b , criticalPoints );
+
+		unsigned int rootNum = 0;
+		double x0 = a , v0 = p( a );
+		if( v0==0 ) roots[ rootNum++ ] = a;
+		for( unsigned int i=0 ; i<=criticalPointNum && rootNum<MaxRoots ; i++ )
+		{
+			double x1 = i<criticalPointNum ? criticalPoints[i] : b , v1 = p( x1 );
+			if( v1==0 ){ if( x1!=x0 || v0!=0 ) roots[ rootNum++ ] = x1; }
+			else if( v0!=0 && ( v0<0 )!=( v1<0 ) ) roots[ rootNum++ ] = _Refine( p , dp , x0 , x1 , v0 );
+			x0 = x1 , v0 = v1;
+		}
+		return rootNum;
+	}
+
+protected:
+	/** This method refines the root bracketed by [x0,x1], given the value at x0. */
+	static double _Refine( const Polynomial1D< Degree > &p , const Polynomial1D< Degree-1 > &dp , double x0 , double x1 , double v0 )
+	{
+		double x = ( x0 + x1 ) / 2;
+		for( int i=0 ; i<64 ; i++ )
+		{
+			double v = p( x ) , dv = dp( x );
+			if( v==0 ) return x;
+			if( ( v<0 )==( v0<0 ) ) x0 = x;
+			else x1 = x;
+
+			// Take the Newton step if it stays within the bracket, and bisect otherwise
+			double next = dv!=0 ? x - v / dv : x0;
+			if( !( next>x0 && next<x1 ) ) next = ( x0 + x1 ) / 2;
+			if( fabs( next - x )<=Epsilon * ( 1. + fabs( x ) ) ) return next;
+			x = next;
+		}
+		return x;
+	}
+};
+
+template<>
+struct RootIsolation< 1 >
+{
+	static const unsigned int MaxRoots = 2;
+
+	static unsigned int Roots( const Polynomial1D< 1 > &p , double a , double b , double *roots )
+	{
+		if( p.coefficient(1)==0 ) return 0;
+		double x = -p.coefficient(0) / p.coefficient(1);
+		if( x<a || x>b ) return 0;
+		roots[0] = x;
+		return 1;
+	}
+};
+
+/////////////////////
+// ImplicitSurface //
+/////////////////////
+const unsigned int ImplicitSurface::_MaxDegree;
+
+template< unsigned int Degree >
+struct ImplicitSurface::_PolynomialSurface : public ImplicitSurface::_Surface
+{
+	/** The polynomial */
+	Polynomial3D< Degree > polynomial;
+
+	/** The partial derivatives of the polynomial */
+	Polynomial3D< Degree-1 > derivatives[3];
+
+	void read( std::istream &stream )
+	{
+		for( unsigned int d=0 ; d<=Degree ; d++ ) for( int i=d ; i>=0 ; i-- ) for( int j=d-i ; j>=0 ; j-- )
+			if( !( stream >> polynomial.coefficient( (unsigned int)i , (unsigned int)j , (unsigned int)( d-i-j ) ) ) ) THROW( "failed to read coefficient" );
+		for( int d=0 ; d<3 ; d++ ) derivatives[d] = polynomial.d( d );
+	}
+
+	void write( std::ostream &stream ) const
+	{
+		for( unsigned int d=0 ; d<=Degree ; d++ ) for( int i=d ; i>=0 ; i-- ) for( int j=d-i ; j>=0 ; j-- )
+			stream << " " << polynomial.coefficient( (unsigned int)i , (unsigned int)j , (unsigned int)( d-i-j ) );
+	}
+
+	double value( Point3D p ) const { return polynomial( p ); }
+
+	Point3D gradient( Point3D p ) const { return Point3D( derivatives[0]( p ) , derivatives[1]( p ) , derivatives[2]( p ) ); }
+
+	bool intersect( Ray3D ray , BoundingBox1D range , ValidityFunction validityLambda , double &t ) const
+	{
+		double roots[ RootIsolation< Degree >::MaxRoots ];
+		unsigned int rootNum = RootIsolation< Degree >::Roots( polynomial( ray ) , range[0][0] , range[1][0] , roots );
+		for( unsigned int i=0 ; i<rootNum ; i++ ) if( validityLambda( roots[i] ) )
+		{
+			t = roots[i];
+			return true;
+		}
+		return false;
+	}
+
+	unsigned int roots( Ray3D ray , BoundingBox1D range , double *roots ) const { return RootIsolation< Degree >::Roots( polynomial( ray ) , range[0][0] , range[1][0] , roots ); }
+};
+
+ImplicitSurface::ImplicitSurface( void ) : _materialIndex(-1) , _material(NULL) , _degree(0) {}
+
+size_t ImplicitSurface::primitiveNum( void ) const { return 1; }
+
+unsigned int ImplicitSurface::maxSpanNum( void ) const { return ( _degree+3 ) / 2; }
+
+void ImplicitSurface::_read( std::istream &stream )
+{
+	if( !( stream >> _materialIndex >> _degree >> _min >> _max ) ) THROW( "failed to parse %s" , Directive().c_str() );
+	if( _min[0]>=_max[0] || _min[1]>=_max[1] || _min[2]>=_max[2] ) THROW( "bad extents: %g %g %g -> %g %g %g" , _min[0] , _min[1] , _min[2] , _max[0] , _max[1] , _max[2] );
+	switch( _degree )
+	{
+		case 1: _surface.reset( new _PolynomialSurface< 1 >() ) ; break;
+		case 2: _surface.reset( new _PolynomialSurface< 2 >() ) ; break;
+		case 3: _surface.reset( new _PolynomialSurface< 3 >() ) ; break;
+		case 4: _surface.reset( new _PolynomialSurface< 4 >() ) ; break;
+		case 5: _surface.reset( new _PolynomialSurface< 5 >() ) ; break;
+		case 6: _surface.reset( new _PolynomialSurface< 6 >() ) ; break;
+		default: THROW( "unsupported degree: %d not in [1,%d]" , _degree , _MaxDegree );
+	}
+	_surface->read( stream );
+}
+
+void ImplicitSurface::_write( std::ostream &stream ) const
+{
+	Shape::WriteInset( stream );
+	stream << "#" << Directive() << "  " << _materialIndex << "  " << _degree << "  " << _min << "  " << _max << " ";
+	_surface->write( stream );
+}
+
+void ImplicitSurface::init( const LocalSceneData &data )
+{
+	// Set the material pointer
+	if( _materialIndex<0 ) THROW( "negative material index: %d" , _materialIndex );
+	else if( (size_t)_materialIndex>=data.materials.size() ) THROW( "material index out of bounds: %d <= %d" , _materialIndex , (int)data.materials.size() );
+	else _material = &data.materials[ _materialIndex ];
+}
+
+void ImplicitSurface::updateBoundingBox( void ){ _bBox = BoundingBox3D( _min , _max ); }
+
+void ImplicitSurface::initOpenGL( void ){ WARN_ONCE( "method undefined" ); }
+
+void ImplicitSurface::drawOpenGL( GLSLProgram * ) const { WARN_ONCE( "method undefined" ); }
+
+bool ImplicitSurface::_clip( Ray3D ray , BoundingBox1D &range ) const
+{
+	// Clip the range to the box, testing axes along which the ray does not move for containment (as with the sphere cloud)
+	for( int d=0 ; d<3 ; d++ )
+	{
+		if( ray.direction[d]==0 )
+		{
+			if( ray.position[d]<_min[d] || ray.position[d]>_max[d] ) return false;
+			continue;
+		}
+		double t0 = ( _min[d] - ray.position[d] ) / ray.direction[d] , t1 = ( _max[d] - ray.position[d] ) / ray.direction[d];
+		if( t0>t1 ) std::swap( t0 , t1 );
+		range[0][0] = std::max( range[0][0] , t0 ) , range[1][0] = std::min( range[1][0] , t1 );
+	}
+	return range[0][0]<=range[1][0];
+}
+
+void ImplicitSurface::_setInfo( Ray3D ray , double t , RayShapeIntersectionInfo &iInfo ) const
+{
+	iInfo.material = _material;
+	iInfo.position = ray( t );
+	iInfo.normal = _surface->gradient( iInfo.position );
+	if( iInfo.normal.squareNorm()>0 ) iInfo.normal = iInfo.normal.unit();
+	else iInfo.normal = -ray.direction;
+}
+
+double ImplicitSurface::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
+{
+	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
+
+	double t;
+	if( !_clip( ray , range ) || !_surface->intersect( ray , range , validityLambda , t ) ) return Infinity;
+	_setInfo( ray , t , iInfo );
+	return t;
+}
+
+unsigned int ImplicitSurface::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
+
+	if( !_clip( ray , range ) ) return 0;
+
+	// The roots split the range into pieces over which the ray is either inside or outside, with the sign tested at the mid-point
+	// (as roots of even multiplicity do not change the sign)
+	double roots[ _MaxDegree+1 ];
+	unsigned int rootNum = _surface->roots( ray , range , roots );
+	unsigned int num = 0;
+	bool inside = false;
+	for( unsigned int i=0 ; i<=rootNum ; i++ )
+	{
+		double t0 = i==0 ? range[0][0] : roots[i-1] , t1 = i==rootNum ? range[1][0] : roots[i];
+		if( t0>=t1 ) continue;
+		bool _inside = _surface->value( ray( ( t0 + t1 ) / 2 ) )<0;
+		if( _inside==inside ) continue;
+		int e = _inside ? 0 : 1;
+		spans[num].t[e] = t0;
+		if( i==0 ) spans[num].iInfo[e].material = NULL;
+		else _setInfo( ray , t0 , spans[num].iInfo[e] );
+		if( !_inside ) num++;
+		inside = _inside;
+	}
+	if( inside ) spans[num].t[1] = range[1][0] , spans[num].iInfo[1].material = NULL , num++;
+	return num;
+}
+
+bool ImplicitSurface::isInside( Point3D p ) const
+{
+	for( int d=0 ; d<3 ; d++ ) if( p[d]<_min[d] || p[d]>_max[d] ) return false;
+	return _surface->value( p )<0;
+}
@@ -0,0 +1,99 @@
+#ifndef IMPLICIT_SURFACE_INCLUDED
+#define IMPLICIT_SURFACE_INCLUDED
+#include <memory>
+#include <Util/geometry.h>
+#include "shape.h"
+
+namespace Ray
+{
+	/** This class describes the zero level-set of a (low-degree) polynomial in three variables, clipped to a box, with the
+	*** interior given by the points at which the polynomial is negative.
+	*** To intersect, the polynomial is restricted to the ray over the interval in which the ray is inside the box, and the
+	*** roots are isolated by recursively finding the roots of the derivative, which split the interval into pieces on which
+	*** the polynomial is monotonic. The polynomial is stored in a class templated on the degree so that the evaluation is unrolled.
+	*** The shape is described by:
+	***		#shape_implicit <material index> <degree> <min x> <min y> <min z> <max x> <max y> <max z> <coefficients>
+	*** with the coefficients of the monomials x^i y^j z^k listed in order of increasing total degree, and within each degree in
+	*** order of decreasing powers of x and then y. (e.g. for degree two: 1 , x , y , z , x^2 , xy , xz , y^2 , yz , z^2) */
+	class ImplicitSurface : public Shape
+	{
+		/** The (degree-independent) interface to the polynomial */
+		struct _Surface
+		{
+			virtual ~_Surface( void ){}
+
+			/** This method reads in the coefficients. */
+			virtual void read( std::istream &stream ) = 0;
+
+			/** This method writes out the coefficients. */
+			virtual void write( std::ostream &stream ) const = 0;
+
+			/** This method returns the value of the polynomial at a point. */
+			virtual double value( Util::Point3D p ) const = 0;
+
+			/** This method returns the gradient of the polynomial at a point. */
+			virtual Util::Point3D gradient( Util::Point3D p ) const = 0;
+
+			/** This method finds the first root along the ray within the interval that satisfies the validity function.
+			*** It returns true and sets the distance along the ray if such a root exists. */
+			virtual bool intersect( Util::Ray3D ray , Util::BoundingBox1D range , ValidityFunction validityLambda , double &t ) const = 0;
+
+			/** This method sets the roots along the ray within the interval, in increasing order, and returns their number.
+			*** The array must have room for _MaxDegree+1 roots. */
+			virtual unsigned int roots( Util::Ray3D ray , Util::BoundingBox1D range , double *roots ) const = 0;
+		};
+
+		/** The polynomial of a prescribed degree */
+		template< unsigned int Degree > struct _PolynomialSurface;
+
+		/** The maximum supported degree */
+		static const unsigned int _MaxDegree = 6;
+
+		/** The index of the material associated with the surface */
+		int _materialIndex;
+
+		/** The material associated with the surface */
+		const class Material *_material;
+
+		/** The degree of the polynomial */
+		unsigned int _degree;
+
+		/** The box the surface is clipped to */
+		Util::Point3D _min , _max;
+
+		/** The polynomial */
+		std::unique_ptr< _Surface > _surface;
+
+		/** This method clips the range to the interval over which the ray is inside the box, returning false if the clipped range is empty. */
+		bool _clip( Util::Ray3D ray , Util::BoundingBox1D &range ) const;
+
+		/** This method sets the intersection information at the prescribed point of the surface. */
+		void _setInfo( Util::Ray3D ray , double t , class RayShapeIntersectionInfo &iInfo ) const;
+
+	public:
+		/** This static method returns the directive describing the shape. */
+		static std::string Directive( void ){ return "shape_implicit"; }
+
+		/** The default constructor */
+		ImplicitSurface( void );
+
+		///////////////////
+		// Shape methods //
+		///////////////////
+	private:
+		void _write( std::ostream &stream ) const;
+		void _read( std::istream &stream );
+	public:
+		std::string name( void ) const { return "implicit surface"; }
+		void init( const class LocalSceneData &data );
+		void initOpenGL( void );
+		void updateBoundingBox( void );
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
+		bool isInside( Util::Point3D p ) const;
+		void drawOpenGL( GLSLProgram * glslProgram ) const;
+		size_t primitiveNum( void ) const;
+	};
+}
+#endif // IMPLICIT_SURFACE_INCLUDED
@@ -40,6 +40,9 @@ namespace Ray
 		/** The current values for the different degrees of freedom */
 		std::vector< DataType > _currentValues;
 
+		/** A counter that is incremented every time the current values are updated */
+		unsigned int _epoch;
+
 		/** An object enabling the interpolation of key frame values */
 		KeyFrameEvaluator< DataType > *_keyFrameEvaluator;
 	public:
@@ -67,6 +70,10 @@ namespace Ray
 
 		/** This method updates the current value of all the parameters, using the interpolation/approximation method specified by curveType */
 		void setCurrentValues( double t , int curveType );
+
+		/** This method returns the number of times the current values have been updated.
+		*** Objects caching quantities derived from the current values can compare against it to determine if they are stale. */
+		unsigned int epoch( void ) const;
 	};
 
 	/** This operator writes the key-frame data out to a stream.*/
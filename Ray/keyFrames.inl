@@ -10,7 +10,7 @@ namespace Ray
 	// KeyFrameData //
 	//////////////////
 	template< typename DataType >
-	KeyFrameData< DataType >::KeyFrameData( void ) : _keyFrameEvaluator(NULL) {}
+	KeyFrameData< DataType >::KeyFrameData( void ) : _epoch(0) , _keyFrameEvaluator(NULL) {}
 
 	template< typename DataType >
 	KeyFrameData< DataType >::~KeyFrameData( void ) { if( _keyFrameEvaluator ) delete _keyFrameEvaluator; }
@@ -45,8 +45,12 @@ namespace Ray
 	{
 		if( !_keyFrameEvaluator ) THROW( "_keyFrameEvaluator has not been initialized" );
 		for( int dof=0 ; dof<_currentValues.size() ; dof++ ) _currentValues[ dof ] = _keyFrameEvaluator->evaluate( dof , t , curveType );
+		_epoch++;
 	}
 
+	template< typename DataType >
+	unsigned int KeyFrameData< DataType >::epoch( void ) const { return _epoch; }
+
 	template< typename DataType >
 	std::ostream &operator << ( std::ostream &stream , const KeyFrameData< DataType > &keyFrameData )
 	{
@@ -86,6 +90,9 @@ namespace Ray
 		for( int i=0 ; i<keyFrameData._data.size() ; i++ ) keyFrameData._data[i].resize( frames );
 
 		for( int j=0 ; j<frames ; j++ ) for( int i=0 ; i<dofs ; i++ ) if( !( stream >> keyFrameData._data[i][j] ) ) THROW( "Failed to read parameter" );
+
+		// Until a time is set, the current values are those of the first key-frame
+		for( int i=0 ; i<dofs ; i++ ) keyFrameData._currentValues[i] = keyFrameData._data[i][0];
 		return stream;
 	}
 
@@ -0,0 +1,43 @@
+#include <algorithm>
+#include <cmath>
+#include "light.h"
+
+using namespace Ray;
+using namespace Util;
+
+///////////
+// Light //
+///////////
+BoundingBox3D Light::_ShadowVolume( const BoundingBox3D &source , const BoundingBox3D &bBox , const BoundingBox3D &region )
+{
+	// If the source and the box overlap, every point can be shadowed
+	double gap2 = 0;
+	for( int d=0 ; d<3 ; d++ )
+	{
+		double gap = std::max< double >( 0 , std::max< double >( bBox[0][d] - source[1][d] , source[0][d] - bBox[1][d] ) );
+		gap2 += gap * gap;
+	}
+	if( gap2==0 ) return region;
+
+	// The shadowed points are of the form s + t * ( b - s ), with s on the source, b in the box, and t>=1. The points with t>T are
+	// farther from the source than any point in the region, and the remaining ones are contained in the box spanned by the values
+	// at the corners of the source, the corners of the box, and t = 1 or T.
+	double maxDistance2 = 0;
+	for( int i=0 ; i<8 ; i++ ) for( int j=0 ; j<8 ; j++ )
+	{
+		Point3D s , r;
+		for( int d=0 ; d<3 ; d++ ) s[d] = source[ (i>>d)&1 ][d] , r[d] = region[ (j>>d)&1 ][d];
+		maxDistance2 = std::max< double >( maxDistance2 , ( r - s ).squareNorm() );
+	}
+	double T = sqrt( maxDistance2 / gap2 ) + 1;
+
+	Point3D corners[ 8 * 8 * 2 ];
+	for( int i=0 ; i<8 ; i++ ) for( int j=0 ; j<8 ; j++ )
+	{
+		Point3D s , b;
+		for( int d=0 ; d<3 ; d++ ) s[d] = source[ (i>>d)&1 ][d] , b[d] = bBox[ (j>>d)&1 ][d];
+		corners[ 2*(8*i+j) ] = b;
+		corners[ 2*(8*i+j)+1 ] = s + ( b - s ) * T;
+	}
+	return BoundingBox3D( corners , 8 * 8 * 2 ) ^ region;
+}
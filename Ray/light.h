@@ -25,6 +25,10 @@ namespace Ray
 		/** The specular color of the light source */
 		Util::Point3D _specular;
 
+		/** This static method returns a box containing the points, within the region, whose segments to some point of the source pass through the box.
+		*** The source can be degenerate (e.g. a single point). */
+		static Util::BoundingBox3D _ShadowVolume( const Util::BoundingBox3D &source , const Util::BoundingBox3D &bBox , const Util::BoundingBox3D &region );
+
 	public:
 		/** The destructor */
 		virtual ~Light( void ){}
@@ -32,6 +36,28 @@ namespace Ray
 		/** This method returns the name of the shape */
 		virtual std::string name( void ) const = 0;
 
+		/** This method returns the ambient color of the light source. */
+		Util::Point3D ambient( void ) const { return _ambient; }
+
+		/** This method returns the diffuse color of the light source. */
+		Util::Point3D diffuse( void ) const { return _diffuse; }
+
+		/** This method returns the specular color of the light source. */
+		Util::Point3D specular( void ) const { return _specular; }
+
+		/** If the light source has a position and its contribution attenuates with the distance from it, this method sets the position and
+		*** the coefficients of the attenuation equation and returns true. Otherwise it returns false.
+		*** It is used to bound the contribution of the light source when building a LightTree. */
+		virtual bool getAttenuation( Util::Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const { return false; }
+
+		/** This method is called whenever the bounding boxes of the scene-graph are updated, so that the light source can set up the
+		*** structure its shadow rays are traced through (e.g. pruning the scene-graph to the shapes that can cast shadows). */
+		virtual void setShadowCasters( const class ShapeList &shapes ){}
+
+		/** This method returns a box containing the points, within the region, whose shadow rays towards the light can pass through the prescribed box.
+		*** It is used to find the points whose shadows can change when the shapes within the box move. The default implementation returns the region. */
+		virtual Util::BoundingBox3D shadowVolume( const Util::BoundingBox3D &bBox , const Util::BoundingBox3D &region ) const { return region; }
+
 		/** This method returns the ambient contribution of the light source to the specified hit location. */
 		virtual Util::Point3D getAmbient( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const=0;
 
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <Util/exceptions.h>
+#include "lightTree.h"
+#include "scene.h"
+
+using namespace Ray;
+using namespace Util;
+
+///////////////
+// LightTree //
+///////////////
+const unsigned int LightTree::_LeafSize;
+const unsigned int LightTree::_MaxDepth;
+
+void LightTree::set( const std::vector< Light * > &lights )
+{
+	_lightNum = (unsigned int)lights.size();
+	_nodes.clear() , _lights.clear() , _unbounded.clear();
+	for( unsigned int i=0 ; i<lights.size() ; i++ )
+	{
+		_Light light;
+		light.index = i;
+		if( lights[i]->getAttenuation( light.location , light.constAtten , light.linearAtten , light.quadAtten ) ) _lights.push_back( light );
+		else _unbounded.push_back( i );
+	}
+	if( !_lights.size() ) return;
+
+	_nodes.reserve( 2*_lights.size() );
+	_nodes.resize( 1 );
+	_set( 0 , 0 , (unsigned int)_lights.size() , lights , 0 );
+}
+
+void LightTree::_set( unsigned int n , unsigned int begin , unsigned int end , const std::vector< Light * > &lights , unsigned int depth )
+{
+	// Accumulate the bounds over the lights
+	{
+		_Node &node = _nodes[n];
+		node.begin = begin , node.end = end , node.children = 0;
+		node.min = node.max = _lights[begin].location;
+		node.ambient = node.diffuse = node.specular = Point3D();
+		node.constAtten = _lights[begin].constAtten , node.linearAtten = _lights[begin].linearAtten , node.quadAtten = _lights[begin].quadAtten;
+		for( unsigned int i=begin ; i<end ; i++ )
+		{
+			const _Light &light = _lights[i];
+			for( int d=0 ; d<3 ; d++ ) node.min[d] = std::min< double >( node.min[d] , light.location[d] ) , node.max[d] = std::max< double >( node.max[d] , light.location[d] );
+			node.ambient += lights[ light.index ]->ambient() , node.diffuse += lights[ light.index ]->diffuse() , node.specular += lights[ light.index ]->specular();
+			node.constAtten = std::min< double >( node.constAtten , light.constAtten );
+			node.linearAtten = std::min< double >( node.linearAtten , light.linearAtten );
+			node.quadAtten = std::min< double >( node.quadAtten , light.quadAtten );
+		}
+	}
+	if( end-begin<=_LeafSize || depth+1>=_MaxDepth ) return;
+
+	// Split at the median along the longest axis of the box
+	int axis = 0;
+	{
+		Point3D extent = _nodes[n].max - _nodes[n].min;
+		if( extent[1]>extent[axis] ) axis = 1;
+		if( extent[2]>extent[axis] ) axis = 2;
+	}
+	unsigned int mid = ( begin + end ) / 2;
+	std::nth_element( _lights.begin()+begin , _lights.begin()+mid , _lights.begin()+end , [&]( const _Light &l1 , const _Light &l2 ){ return l1.location[axis]<l2.location[axis]; } );
+
+	unsigned int children = (unsigned int)_nodes.size();
+	_nodes[n].children = children;
+	_nodes.resize( children+2 );
+	_set( children+0 , begin , mid , lights , depth+1 );
+	_set( children+1 , mid , end , lights , depth+1 );
+}
+
+bool LightTree::_bound( const _Node &node , Point3D p , const Material &material , Point3D &bound ) const
+{
+	// Get the distance from the point to the box
+	double distance2 = 0;
+	for( int d=0 ; d<3 ; d++ )
+	{
+		double delta = std::max< double >( 0 , std::max< double >( node.min[d] - p[d] , p[d] - node.max[d] ) );
+		distance2 += delta * delta;
+	}
+	double distance = sqrt( distance2 );
+	double atten = node.constAtten + node.linearAtten * distance + node.quadAtten * distance2;
+	if( !( atten>0 ) ) return false;
+	bound = ( material.ambient * node.ambient + material.diffuse * node.diffuse + material.specular * node.specular ) / atten;
+	return true;
+}
+
+Point3D LightTree::select( Point3D p , const Material &material , Point3D cLimit , bool *selected ) const
+{
+	unsigned int num = 0;
+	for( unsigned int i=0 ; i<_lightNum ; i++ ) selected[i] = false;
+	for( unsigned int i=0 ; i<_unbounded.size() ; i++ ) selected[ _unbounded[i] ] = true , num++;
+
+	// Traverse the hierarchy, culling the nodes whose bound is below the cut-off
+	Point3D error;
+	unsigned int stack[ _MaxDepth+1 ] , stackSize = 0;
+	if( _nodes.size() ) stack[ stackSize++ ] = 0;
+	while( stackSize )
+	{
+		const _Node &node = _nodes[ stack[ --stackSize ] ];
+		Point3D bound;
+		if( _bound( node , p , material , bound ) && bound[0]<=cLimit[0] && bound[1]<=cLimit[1] && bound[2]<=cLimit[2] ) error += bound;
+		else if( node.children ) stack[ stackSize++ ] = node.children , stack[ stackSize++ ] = node.children+1;
+		else for( unsigned int i=node.begin ; i<node.end ; i++ ) selected[ _lights[i].index ] = true , num++;
+	}
+	RayTracingStats::AddLightSelection( num , _lightNum-num , std::max< double >( error[0] , std::max< double >( error[1] , error[2] ) ) );
+	return error;
+}
@@ -0,0 +1,87 @@
+#ifndef LIGHT_TREE_INCLUDED
+#define LIGHT_TREE_INCLUDED
+#include <vector>
+#include <Util/geometry.h>
+#include "light.h"
+
+namespace Ray
+{
+	/** This class stores a bounding volume hierarchy over the positions of the lights in a scene, and is used to skip the lights whose
+	*** contribution at a shading point is guaranteed to be negligible.
+	*** Each node stores the bounding box of the positions of its lights, the sums of their ambient, diffuse, and specular colors, and the
+	*** smallest of their attenuation coefficients. Since the fall-off terms of the lighting model are at most one, the summed contribution of
+	*** the lights of a node is bounded by the summed colors, scaled by the material coefficients, over the attenuation at the distance to the box.
+	*** A node is culled if its bound is below the cut-off in every channel, so that the error in each channel of the (unclamped) direct lighting
+	*** is at most the sum of the bounds of the culled nodes, which is itself at most the cut-off times the number of culled nodes.
+	*** The sum is returned, and accumulated in RayTracingStats, so that the error can be measured.
+	*** Lights without a position (e.g. directional lights) are never culled. */
+	class LightTree
+	{
+		/** A node of the hierarchy */
+		struct _Node
+		{
+			/** The corners of the bounding box of the light positions */
+			Util::Point3D min , max;
+
+			/** The sums of the ambient, diffuse, and specular colors of the lights */
+			Util::Point3D ambient , diffuse , specular;
+
+			/** The smallest of the coefficients of the attenuation equations of the lights */
+			double constAtten , linearAtten , quadAtten;
+
+			/** The index of the first child (with the second child following it), or zero if the node is a leaf */
+			unsigned int children;
+
+			/** The range of indices (into _lights) of the lights in the node */
+			unsigned int begin , end;
+		};
+
+		/** A light with a position */
+		struct _Light
+		{
+			/** The index of the light in the scene */
+			unsigned int index;
+
+			/** The position of the light */
+			Util::Point3D location;
+
+			/** The coefficients of the attenuation equation */
+			double constAtten , linearAtten , quadAtten;
+		};
+
+		/** The maximum number of lights in a leaf */
+		static const unsigned int _LeafSize = 2;
+
+		/** The maximum depth of the hierarchy */
+		static const unsigned int _MaxDepth = 64;
+
+		/** The total number of lights */
+		unsigned int _lightNum = 0;
+
+		/** The nodes of the hierarchy, with the root first */
+		std::vector< _Node > _nodes;
+
+		/** The lights with a position, ordered so that the lights of each node are contiguous */
+		std::vector< _Light > _lights;
+
+		/** The indices of the lights without a position */
+		std::vector< unsigned int > _unbounded;
+
+		/** This method sets the node with the lights in the prescribed range, and recursively constructs its children. */
+		void _set( unsigned int n , unsigned int begin , unsigned int end , const std::vector< Light * > &lights , unsigned int depth );
+
+		/** This method returns true if the contribution of the lights in the node at the prescribed point can be bounded, and sets the bound. */
+		bool _bound( const _Node &node , Util::Point3D p , const class Material &material , Util::Point3D &bound ) const;
+	public:
+		/** This method builds the hierarchy over the lights. */
+		void set( const std::vector< Light * > &lights );
+
+		/** This method returns the number of lights the hierarchy was built over (or zero if it was not built). */
+		unsigned int size( void ) const { return _lightNum; }
+
+		/** This method sets, for each light, whether it should be evaluated at the prescribed point on a surface with the prescribed material,
+		*** given the (per-channel) cut-off. It returns the bound on the contribution of the lights that were culled. */
+		Util::Point3D select( Util::Point3D p , const class Material &material , Util::Point3D cLimit , bool *selected ) const;
+	};
+}
+#endif // LIGHT_TREE_INCLUDED
@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <cctype>
+#include <Util/exceptions.h>
+#include <Util/morton.h>
+#include "pixelOrder.h"
+
+using namespace Ray;
+using namespace Util;
+
+////////////////
+// PixelOrder //
+////////////////
+std::string PixelOrder::Names[] = { "scanline" , "morton" , "hilbert" };
+
+PixelOrder::PixelOrder( int type , int width , int height , int tileWidth )
+{
+	if( tileWidth<=0 ) THROW( "tile width must be positive: %d" , tileWidth );
+	unsigned int w = ( width + tileWidth - 1 ) / tileWidth , h = ( height + tileWidth - 1 ) / tileWidth;
+	unsigned int order = 0;
+	while( ( 1u<<order )<std::max< unsigned int >( w , h ) ) order++;
+	if( type!=SCANLINE && order>16 ) THROW( "image too large for space-filling order: %d x %d" , width , height );
+
+	// Sort the tiles by their position along the curve
+	std::vector< std::pair< unsigned long long , Tile > > tiles;
+	tiles.reserve( w*h );
+	for( unsigned int j=0 ; j<h ; j++ ) for( unsigned int i=0 ; i<w ; i++ )
+	{
+		unsigned long long key;
+		switch( type )
+		{
+			case SCANLINE: key = (unsigned long long)j*w + i ; break;
+			case MORTON:   key = MortonCode( i , j )        ; break;
+			case HILBERT:  key = _HilbertIndex( order , i , j ) ; break;
+			default: THROW( "unrecognized pixel order: %d" , type );
+		}
+		Tile tile;
+		tile.x = i*tileWidth , tile.y = j*tileWidth;
+		tiles.push_back( std::make_pair( key , tile ) );
+	}
+	std::sort( tiles.begin() , tiles.end() , []( const std::pair< unsigned long long , Tile > &t1 , const std::pair< unsigned long long , Tile > &t2 ){ return t1.first<t2.first; } );
+
+	_tiles.resize( tiles.size() );
+	for( size_t i=0 ; i<tiles.size() ; i++ ) _tiles[i] = tiles[i].second;
+}
+
+size_t PixelOrder::size( void ) const { return _tiles.size(); }
+
+const PixelOrder::Tile &PixelOrder::operator[]( size_t i ) const { return _tiles[i]; }
+
+int PixelOrder::Type( const std::string &name )
+{
+	std::string _name = name;
+	for( size_t i=0 ; i<_name.size() ; i++ ) _name[i] = (char)std::tolower( _name[i] );
+	for( int i=0 ; i<COUNT ; i++ ) if( Names[i]==_name ) return i;
+	THROW( "unrecognized pixel order: %s" , name.c_str() );
+	return SCANLINE;
+}
+
+unsigned long long PixelOrder::_HilbertIndex( unsigned int order , unsigned int x , unsigned int y )
+{
+	// Descend through the quadrants, rotating / reflecting the coordinates so that each sub-curve is in canonical position
+	unsigned long long d = 0;
+	for( unsigned int s=( 1u<<order )>>1 ; s>0 ; s>>=1 )
+	{
+		unsigned int rx = ( x & s )>0 , ry = ( y & s )>0;
+		d += (unsigned long long)s * s * ( ( 3 * rx ) ^ ry );
+		if( !ry )
+		{
+			if( rx ) x = s-1-x , y = s-1-y;
+			std::swap( x , y );
+		}
+	}
+	return d;
+}
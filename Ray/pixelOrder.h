@@ -0,0 +1,49 @@
+#ifndef PIXEL_ORDER_INCLUDED
+#define PIXEL_ORDER_INCLUDED
+#include <string>
+#include <vector>
+
+namespace Ray
+{
+	/** This class represents the order in which the tiles of an image are traversed by the renderers.
+	*** The image is partitioned into square tiles (of size one for individual pixels) and the tiles are visited in scanline order,
+	*** or along a Morton (Z-order) or Hilbert curve, so that consecutive rays are close on the image plane and tend to touch the same parts of the scene. */
+	class PixelOrder
+	{
+	public:
+		/** The types of traversal */
+		enum
+		{
+			SCANLINE ,
+			MORTON ,
+			HILBERT ,
+			COUNT
+		};
+
+		/** The names of the traversal types */
+		static std::string Names[];
+
+		/** This class represents a tile, indexed by the coordinates of its first pixel */
+		struct Tile { int x , y; };
+
+		/** The constructor generates the order in which the tiles of size tileWidth x tileWidth covering a width x height image are visited. */
+		PixelOrder( int type , int width , int height , int tileWidth=1 );
+
+		/** This method returns the number of tiles. */
+		size_t size( void ) const;
+
+		/** This method returns the i-th tile to be visited. */
+		const Tile &operator[]( size_t i ) const;
+
+		/** This static method returns the traversal type with the prescribed name (case insensitive), throwing an exception if there is none. */
+		static int Type( const std::string &name );
+
+	protected:
+		/** The tiles, in traversal order */
+		std::vector< Tile > _tiles;
+
+		/** This static method returns the distance along the Hilbert curve filling the 2^order x 2^order grid of the cell (x,y). */
+		static unsigned long long _HilbertIndex( unsigned int order , unsigned int x , unsigned int y );
+	};
+}
+#endif // PIXEL_ORDER_INCLUDED
@@ -22,3 +22,17 @@ void PointLight::_write( std::ostream &stream ) const
 {
 	stream << "#" << Directive() << "  " << _ambient << "  " << _diffuse << "  " << _specular << "  " << _location << "  " << _constAtten << " " << _linearAtten << " " << _quadAtten;
 }
+
+bool PointLight::getAttenuation( Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const
+{
+	location = _location , constAtten = _constAtten , linearAtten = _linearAtten , quadAtten = _quadAtten;
+	return true;
+}
+
+void PointLight::setShadowCasters( const ShapeList &shapes )
+{
+	// The light shines in all directions, so any shape can cast a shadow
+	_casters.set( shapes , []( const BoundingBox3D & ){ return true; } );
+}
+
+BoundingBox3D PointLight::shadowVolume( const BoundingBox3D &bBox , const BoundingBox3D &region ) const { return _ShadowVolume( BoundingBox3D( _location , _location ) , bBox , region ); }
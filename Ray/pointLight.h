@@ -1,6 +1,7 @@
 #ifndef POINT_LIGHT_INCLUDED
 #define POINT_LIGHT_INCLUDED
 #include "light.h"
+#include "shadowCasters.h"
 
 namespace Ray
 {
@@ -19,6 +20,9 @@ namespace Ray
 		/** The quadratic term of the attenuation equation */
 		double _quadAtten;
 
+		/** The scene-graph the shadow rays are traced through */
+		ShadowCasters _casters;
+
 	public:
 		/** This static method returns the directive describing the Light. */
 		static std::string Directive( void ){ return "light_point"; }
@@ -31,6 +35,9 @@ namespace Ray
 		void _read( std::istream &stream );
 	public:
 		std::string name( void ) const { return "point light"; }
+		bool getAttenuation( Util::Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const;
+		void setShadowCasters( const class ShapeList &shapes );
+		Util::BoundingBox3D shadowVolume( const Util::BoundingBox3D &bBox , const Util::BoundingBox3D &region ) const;
 		Util::Point3D getAmbient ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
 		Util::Point3D getDiffuse ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
 		Util::Point3D getSpecular( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
@@ -79,7 +79,7 @@ bool PointLight::isInShadow( const RayShapeIntersectionInfo& iInfo , const Shape
 	Ray3D ray(p0,v);
 	BoundingBox1D range( Epsilon , Infinity );
 	RayShapeIntersectionInfo info = RayShapeIntersectionInfo();
-	double t = shape->intersect(ray, info, range); 
+	double t = _casters.built() ? _casters.intersect(ray, info, range) : shape->intersect(ray, info, range);
 	if (t < Infinity){
 		return true;
 	}
@@ -99,11 +99,15 @@ Point3D PointLight::transparency( const RayShapeIntersectionInfo &iInfo , const
 	Ray3D ray(p0,v);
 	Point3D trans = Point3D(1., 1., 1.);
 	BoundingBox1D range( Epsilon , Infinity); 
-	double intersect = shape.intersect(ray, dummy, range);
+	// The last occluder is tested first
+	auto occluders = [&](Ray3D ray, RayShapeIntersectionInfo &info, BoundingBox1D range) {
+		return _casters.built() ? _casters.intersect(ray, info, range) : shape.intersect(ray, info, range);
+	};
+	double intersect = occluders(ray, dummy, range);
 	while(intersect < Infinity && trans[0] > cLimit[0] && trans[1] > cLimit[1] && trans[2] > cLimit[2]){
 		trans *= dummy.material->transparent;
 		Ray3D new_ray = Ray3D(dummy.position + ray.direction * 1e-5, ray.direction);
-		intersect = shape.intersect(new_ray, dummy);
+		intersect = occluders(new_ray, dummy, range);
 	}
 	return trans;
 }
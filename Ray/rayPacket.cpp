@@ -0,0 +1,64 @@
+#include "rayPacket.h"
+#include "shape.h"
+
+using namespace Ray;
+using namespace Util;
+
+///////////////
+// RayPacket //
+///////////////
+RayPacket::RayPacket( void ) : size(0) {}
+
+unsigned int RayPacket::mask( void ) const { return ( 1u<<size ) - 1; }
+
+void RayPacket::_set( unsigned int i )
+{
+	for( int d=0 ; d<3 ; d++ ) _position[d][i] = rays[i].position[d] , _inverseDirection[d][i] = 1./rays[i].direction[d];
+}
+
+void RayPacket::set( unsigned int i , const Ray3D &ray )
+{
+	rays[i] = ray;
+	_set( i );
+}
+
+RayPacket RayPacket::transform( const Matrix4D &m ) const
+{
+	RayPacket packet;
+	packet.size = size;
+	for( unsigned int i=0 ; i<size ; i++ ) packet.set( i , m * rays[i] );
+	return packet;
+}
+
+unsigned int RayPacket::intersect( const BoundingBox3D &bBox , unsigned int mask , double entry[] ) const
+{
+	double hit[MaxSize];
+
+	// Evaluate the slab test for all rays in the packet, using selects rather than branches so that the loop vectorizes
+	for( unsigned int i=0 ; i<size ; i++ )
+	{
+		double tMin[3] , tMax[3];
+		for( int d=0 ; d<3 ; d++ )
+		{
+			double t0 = ( bBox[0][d] - _position[d][i] ) * _inverseDirection[d][i];
+			double t1 = ( bBox[1][d] - _position[d][i] ) * _inverseDirection[d][i];
+			bool positive = _inverseDirection[d][i]>=0;
+			tMin[d] = positive ? t0 : t1;
+			tMax[d] = positive ? t1 : t0;
+		}
+		bool miss = false;
+		for( int d=0 ; d<3 ; d++ ) for( int dd=0 ; dd<3 ; dd++ ) miss |= tMin[d]>tMax[dd];
+		double start = tMin[0] , end = tMax[0];
+		for( int d=1 ; d<3 ; d++ ) start = tMin[d]>start ? tMin[d] : start , end = tMax[d]>end ? tMax[d] : end;
+		entry[i] = miss ? Infinity : start;
+		hit[i] = ( miss || start>=end ) ? 0 : 1;
+	}
+
+	unsigned int hitMask = 0;
+	for( unsigned int i=0 ; i<size ; i++ ) if( mask & ( 1u<<i ) )
+	{
+		RayTracingStats::IncrementRayBoundingBoxIntersectionNum();
+		if( hit[i] ) hitMask |= 1u<<i;
+	}
+	return hitMask;
+}
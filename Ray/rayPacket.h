@@ -0,0 +1,48 @@
+#ifndef RAY_PACKET_INCLUDED
+#define RAY_PACKET_INCLUDED
+#include <Util/geometry.h>
+
+namespace Ray
+{
+	/** This class represents a packet of (coherent) rays that are traversed through the scene-graph together.
+	*** In addition to the rays themselves, the packet stores the ray positions and reciprocal directions in
+	*** structure-of-arrays form so that a bounding box can be tested against all the rays with a single vectorizable loop.
+	*** Subsets of the rays in the packet are selected using bit-masks, with the i-th bit corresponding to the i-th ray. */
+	class RayPacket
+	{
+		/** The ray positions, stored by coordinate */
+		double _position[3][16];
+
+		/** The reciprocals of the ray directions, stored by coordinate */
+		double _inverseDirection[3][16];
+
+		/** This method sets the structure-of-arrays data for the i-th ray. */
+		void _set( unsigned int i );
+	public:
+		/** The maximum number of rays in a packet */
+		static const unsigned int MaxSize = 16;
+
+		/** The number of rays in the packet */
+		unsigned int size;
+
+		/** The rays in the packet */
+		Util::Ray3D rays[MaxSize];
+
+		/** The default constructor generates an empty packet */
+		RayPacket( void );
+
+		/** This method returns the mask with the bits of all rays in the packet set. */
+		unsigned int mask( void ) const;
+
+		/** This method sets the i-th ray of the packet. */
+		void set( unsigned int i , const Util::Ray3D &ray );
+
+		/** This method returns a packet whose rays have been transformed by the prescribed matrix. */
+		RayPacket transform( const Util::Matrix4D &m ) const;
+
+		/** This method intersects the masked rays with the bounding box, writing out the entry value for each ray and returning the mask of rays that hit the box.
+		*** The results are identical to those of Util::BoundingBox3D::intersect and the mask marks the rays for which the returned interval is not empty. */
+		unsigned int intersect( const Util::BoundingBox3D &bBox , unsigned int mask , double entry[] ) const;
+	};
+}
+#endif // RAY_PACKET_INCLUDED
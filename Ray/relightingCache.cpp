@@ -0,0 +1,263 @@
+#include <sstream>
+#include <cstring>
+#include <unordered_map>
+#include <Util/exceptions.h>
+#include <Util/timer.h>
+#include "relightingCache.h"
+#include "scratchArena.h"
+
+using namespace Ray;
+using namespace Util;
+using namespace Image;
+
+/** The tag identifying a cache file (and the version of its format) */
+static const char CacheTag[] = "RELIGHT1";
+
+/** This function returns the 64-bit FNV-1a hash of the string. */
+static unsigned long long Hash( const std::string &str )
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for( size_t i=0 ; i<str.size() ; i++ ) hash = ( hash ^ (unsigned char)str[i] ) * 0x100000001B3ULL;
+	return hash;
+}
+
+/////////////////////
+// RelightingCache //
+/////////////////////
+RelightingCache::RelightingCache( Scene &scene , const std::string &fileName ) : _scene(scene) , _fileName(fileName) , _key(0) , _reused(false) {}
+
+void RelightingCache::_addMaterials( const SceneGeometry &geometry )
+{
+	for( size_t i=0 ; i<geometry._localData.materials.size() ; i++ ) _materials.push_back( &geometry._localData.materials[i] );
+	for( size_t i=0 ; i<geometry._localData.files.size() ; i++ ) _addMaterials( geometry._localData.files[i] );
+}
+
+void RelightingCache::_WriteGeometry( std::ostream &stream , const SceneGeometry &geometry )
+{
+	// Included files are written out by name, so their geometry is written out after
+	stream << ( const Shape & )geometry << std::endl;
+	for( size_t i=0 ; i<geometry._localData.files.size() ; i++ ) _WriteGeometry( stream , geometry._localData.files[i] );
+}
+
+unsigned long long RelightingCache::_computeKey( int width , int height , int rLimit , double cLimit ) const
+{
+	// The lights are part of the global data, so they are not hashed
+	std::stringstream stream;
+	stream.precision( 17 );
+	stream << CacheTag << std::endl;
+	stream << width << " " << height << " " << rLimit << " " << cLimit << std::endl;
+	stream << _scene._globalData.camera << std::endl;
+	_WriteGeometry( stream , _scene );
+	return Hash( stream.str() );
+}
+
+int RelightingCache::_trace( std::vector< _Hit > &hits , Ray3D ray , int rDepth , Point3D cLimit ) const
+{
+	RayShapeIntersectionInfo iInfo = RayShapeIntersectionInfo();
+	if( _scene.intersect( ray , iInfo )<Infinity ) return _add( hits , ray , iInfo , rDepth , cLimit );
+	return -1;
+}
+
+int RelightingCache::_add( std::vector< _Hit > &hits , Ray3D ray , const RayShapeIntersectionInfo &iInfo , int rDepth , Point3D cLimit ) const
+{
+	int h = (int)hits.size();
+	hits.push_back( _Hit{ ray , iInfo , cLimit , -1 , -1 } );
+	rDepth--;
+
+	Point3D K_S = iInfo.material->specular;
+	if( rDepth>0 && Scene::Propagates( K_S , cLimit ) )
+	{
+		int reflected = _trace( hits , Scene::ReflectedRay( ray , iInfo ) , rDepth-1 , cLimit/K_S );
+		hits[h].reflected = reflected;
+	}
+
+	Ray3D refracted;
+	Point3D K_T = iInfo.material->transparent;
+	if( Scene::RefractedRay( ray , iInfo , refracted ) && rDepth>0 && Scene::Propagates( K_T , cLimit ) )
+	{
+		int _refracted = _trace( hits , refracted , rDepth-1 , cLimit/K_T );
+		hits[h].refracted = _refracted;
+	}
+	return h;
+}
+
+Point3D RelightingCache::_shade( const std::vector< _Hit > &hits , int h ) const
+{
+	// A ray that missed contributes nothing, so only the rays that hit are added
+	const _Hit &hit = hits[h];
+	Point3D color = _scene.directColor( hit.ray , hit.iInfo , hit.cLimit );
+	if( hit.reflected>=0 ) color += _shade( hits , hit.reflected ) * hit.iInfo.material->specular;
+	if( hit.refracted>=0 ) color += _shade( hits , hit.refracted ) * hit.iInfo.material->transparent;
+	return Scene::Clamp( color );
+}
+
+void RelightingCache::_traceHits( int width , int height , int rLimit , double cLimit , int threads )
+{
+	_hits.clear();
+	_hits.resize( (size_t)width * height );
+
+#pragma omp parallel num_threads( threads )
+	{
+		ScratchArena &arena = ScratchArena::ThreadArena();
+		arena.reserve( ScratchArena::DefaultBlockSize );
+
+#pragma omp for schedule( dynamic , 16 )
+		for( long long p=0 ; p<(long long)_hits.size() ; p++ )
+		{
+			int i = (int)( p % width ) , j = (int)( p / width );
+			arena.reset();
+			try
+			{
+				Ray3D ray = _scene._globalData.camera.getRay( i , height-j-1 , width , height );
+				RayShapeIntersectionInfo iInfo = {};
+				Timer timer;
+				double t = _scene.intersect( ray , iInfo );
+				RayTracingStats::AddPrimaryRays( 1 , timer.elapsed() );
+				if( t<Infinity ) _add( _hits[p] , ray , iInfo , rLimit , Point3D( cLimit , cLimit , cLimit ) );
+			}
+			catch( std::exception &e ){ ERROR_OUT( "failed to trace pixel ( %d , %d )\n%s" , i , j , e.what() ); }
+		}
+		RayTracingStats::Merge();
+	}
+}
+
+bool RelightingCache::_read( int width , int height )
+{
+	FILE *fp = fopen( _fileName.c_str() , "rb" );
+	if( !fp ) return false;
+
+	char tag[ sizeof(CacheTag) ];
+	unsigned long long key;
+	int w , h;
+	if( fread( tag , 1 , sizeof(tag) , fp )!=sizeof(tag) || memcmp( tag , CacheTag , sizeof(tag) ) || fread( &key , sizeof(key) , 1 , fp )!=1 || fread( &w , sizeof(w) , 1 , fp )!=1 || fread( &h , sizeof(h) , 1 , fp )!=1 || key!=_key || w!=width || h!=height )
+	{
+		fclose( fp );
+		return false;
+	}
+
+	_hits.clear();
+	_hits.resize( (size_t)width * height );
+	std::vector< _Record > records;
+	for( size_t p=0 ; p<_hits.size() ; p++ )
+	{
+		unsigned int hitNum;
+		if( fread( &hitNum , sizeof(hitNum) , 1 , fp )!=1 ) THROW( "failed to read hit count from cache: %s" , _fileName.c_str() );
+		records.resize( hitNum );
+		if( hitNum && fread( &records[0] , sizeof(_Record) , hitNum , fp )!=hitNum ) THROW( "failed to read hits from cache: %s" , _fileName.c_str() );
+		_hits[p].resize( hitNum );
+		for( unsigned int k=0 ; k<hitNum ; k++ )
+		{
+			const _Record &r = records[k];
+			_Hit &hit = _hits[p][k];
+			// The hits of the spawned rays follow the hit that spawned them
+			bool valid = r.material>=0 && r.material<(int)_materials.size();
+			valid &= r.reflected==-1 || ( r.reflected>(int)k && r.reflected<(int)hitNum );
+			valid &= r.refracted==-1 || ( r.refracted>(int)k && r.refracted<(int)hitNum );
+			if( !valid ) THROW( "bad hit in cache: %s" , _fileName.c_str() );
+			for( int d=0 ; d<3 ; d++ )
+			{
+				hit.ray.position[d] = r.ray[d] , hit.ray.direction[d] = r.ray[d+3];
+				hit.iInfo.position[d] = r.position[d] , hit.iInfo.normal[d] = r.normal[d] , hit.cLimit[d] = r.cLimit[d];
+			}
+			hit.iInfo.texture[0] = r.texture[0] , hit.iInfo.texture[1] = r.texture[1];
+			hit.iInfo.texelScale = r.texelScale;
+			hit.iInfo.material = _materials[ r.material ];
+			hit.reflected = r.reflected , hit.refracted = r.refracted;
+		}
+	}
+	fclose( fp );
+	return true;
+}
+
+void RelightingCache::_write( int width , int height ) const
+{
+	FILE *fp = fopen( _fileName.c_str() , "wb" );
+	if( !fp ) THROW( "failed to open cache for writing: %s" , _fileName.c_str() );
+
+	std::unordered_map< const Material * , int > materialIndices;
+	for( size_t i=0 ; i<_materials.size() ; i++ ) materialIndices[ _materials[i] ] = (int)i;
+
+	fwrite( CacheTag , 1 , sizeof(CacheTag) , fp );
+	fwrite( &_key , sizeof(_key) , 1 , fp );
+	fwrite( &width , sizeof(width) , 1 , fp );
+	fwrite( &height , sizeof(height) , 1 , fp );
+	std::vector< _Record > records;
+	for( size_t p=0 ; p<_hits.size() ; p++ )
+	{
+		unsigned int hitNum = (unsigned int)_hits[p].size();
+		records.resize( hitNum );
+		for( unsigned int k=0 ; k<hitNum ; k++ )
+		{
+			const _Hit &hit = _hits[p][k];
+			_Record &r = records[k];
+			auto iter = materialIndices.find( hit.iInfo.material );
+			if( iter==materialIndices.end() ) THROW( "hit material is not in the scene" );
+			for( int d=0 ; d<3 ; d++ )
+			{
+				r.ray[d] = hit.ray.position[d] , r.ray[d+3] = hit.ray.direction[d];
+				r.position[d] = hit.iInfo.position[d] , r.normal[d] = hit.iInfo.normal[d] , r.cLimit[d] = hit.cLimit[d];
+			}
+			r.texture[0] = hit.iInfo.texture[0] , r.texture[1] = hit.iInfo.texture[1];
+			r.texelScale = hit.iInfo.texelScale;
+			r.material = iter->second;
+			r.reflected = hit.reflected , r.refracted = hit.refracted;
+		}
+		fwrite( &hitNum , sizeof(hitNum) , 1 , fp );
+		if( hitNum ) fwrite( &records[0] , sizeof(_Record) , hitNum , fp );
+	}
+	if( ferror( fp ) ) WARN( "failed to write cache: %s" , _fileName.c_str() );
+	fclose( fp );
+}
+
+Image32 RelightingCache::render( int width , int height , int rLimit , double cLimit , int threads )
+{
+	if( threads<1 ) THROW( "number of threads must be positive: %d" , threads );
+	_scene.updateBoundingBox();
+	_scene._setPixelAngle( height );
+	_materials.clear();
+	_addMaterials( _scene );
+
+	// Use the hits in memory if they are still valid, and otherwise those in the cache file, tracing them only if neither is
+	unsigned long long key = _computeKey( width , height , rLimit , cLimit );
+	_reused = _hits.size()==(size_t)width*height && key==_key;
+	if( !_reused )
+	{
+		_key = key;
+		_reused = _read( width , height );
+		if( !_reused )
+		{
+			_traceHits( width , height , rLimit , cLimit , threads );
+			_write( width , height );
+		}
+	}
+
+	// Shade the hits
+	Image32 img;
+	img.setSize( width , height );
+#pragma omp parallel num_threads( threads )
+	{
+		ScratchArena &arena = ScratchArena::ThreadArena();
+		arena.reserve( ScratchArena::DefaultBlockSize );
+
+#pragma omp for schedule( dynamic , 16 )
+		for( long long p=0 ; p<(long long)_hits.size() ; p++ )
+		{
+			int i = (int)( p % width ) , j = (int)( p / width );
+			arena.reset();
+			try
+			{
+				Point3D c = _hits[p].size() ? _shade( _hits[p] , 0 ) : Point3D();
+				Pixel32 pixel;
+				pixel.r = (int)(c[0]*255);
+				pixel.g = (int)(c[1]*255);
+				pixel.b = (int)(c[2]*255);
+				img( i , j ) = pixel;
+			}
+			catch( std::exception &e ){ ERROR_OUT( "failed to shade pixel ( %d , %d )\n%s" , i , j , e.what() ); }
+		}
+
+		// Fold this thread's statistics into the totals
+		RayTracingStats::Merge();
+	}
+	return img;
+}
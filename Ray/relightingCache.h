@@ -0,0 +1,103 @@
+#ifndef RELIGHTING_CACHE_INCLUDED
+#define RELIGHTING_CACHE_INCLUDED
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <Util/geometry.h>
+#include <Image/image.h>
+#include "scene.h"
+
+namespace Ray
+{
+	/** This class ray-traces a scene through a cache of the hits of the paths traced from the pixels, so that a scene whose lights
+	*** change between renders, but whose geometry and camera do not, is rendered without tracing any but the shadow rays.
+	*** For each pixel the cache stores the tree of hits rooted at the hit of the primary ray, with the reflected and refracted
+	*** rays spawned at each hit as in Scene::shade. Since whether a ray is spawned depends only on the materials of the surfaces
+	*** (and not on the lights), rendering from the cache and recomputing the direct lighting at the hits, in the same order as
+	*** Scene::shade, gives the same image as Scene::rayTrace.
+	*** The cache is kept in a file, together with a key hashing the geometry of the scene, the camera, and the rendering parameters,
+	*** and is rebuilt whenever the key of the scene being rendered differs. */
+	class RelightingCache
+	{
+		/** A hit along a path, together with the indices (within the pixel's hits) of the hits of the reflected and refracted rays it spawned */
+		struct _Hit
+		{
+			/** The ray that hit the surface */
+			Util::Ray3D ray;
+
+			/** The intersection information */
+			RayShapeIntersectionInfo iInfo;
+
+			/** The cut-off value of the ray */
+			Util::Point3D cLimit;
+
+			/** The indices of the hits of the reflected and refracted rays (or -1 if the ray was not spawned or missed) */
+			int reflected , refracted;
+		};
+
+		/** The representation of a hit in the cache file, with the material given by its index */
+		struct _Record
+		{
+			double ray[6] , position[3] , normal[3] , texture[2] , texelScale , cLimit[3];
+			int material , reflected , refracted;
+		};
+
+		/** The scene being rendered */
+		Scene &_scene;
+
+		/** The name of the cache file */
+		std::string _fileName;
+
+		/** The key of the hits */
+		unsigned long long _key;
+
+		/** The hits of each pixel, starting with the hit of the primary ray (or empty if the primary ray missed) */
+		std::vector< std::vector< _Hit > > _hits;
+
+		/** The materials of the scene, indexed as in the cache file */
+		std::vector< const Material * > _materials;
+
+		/** Were the hits of the last render read from the cache */
+		bool _reused;
+
+		/** This method adds the materials of the geometry, and of the files it includes, to the list of materials. */
+		void _addMaterials( const SceneGeometry &geometry );
+
+		/** This method writes out the geometry, and the geometry of the files it includes, to the stream. */
+		static void _WriteGeometry( std::ostream &stream , const SceneGeometry &geometry );
+
+		/** This method returns the key of the hits of an image with the prescribed parameters. */
+		unsigned long long _computeKey( int width , int height , int rLimit , double cLimit ) const;
+
+		/** This method intersects the ray with the scene and, if it hits, adds the hit and returns its index. Otherwise it returns -1. */
+		int _trace( std::vector< _Hit > &hits , Util::Ray3D ray , int rDepth , Util::Point3D cLimit ) const;
+
+		/** This method adds the hit, and the hits of the rays it spawns, and returns its index.
+		*** It is the part of Scene::shade that determines the rays that are spawned. */
+		int _add( std::vector< _Hit > &hits , Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo , int rDepth , Util::Point3D cLimit ) const;
+
+		/** This method returns the color of the prescribed hit, as Scene::shade does. */
+		Util::Point3D _shade( const std::vector< _Hit > &hits , int h ) const;
+
+		/** This method traces the hits of the paths from the pixels. */
+		void _traceHits( int width , int height , int rLimit , double cLimit , int threads );
+
+		/** This method reads the hits from the cache file, returning false if the file does not exist or its key differs. */
+		bool _read( int width , int height );
+
+		/** This method writes the hits of an image with the prescribed dimensions to the cache file. */
+		void _write( int width , int height ) const;
+
+	public:
+		/** The constructor takes the scene to be rendered and the name of the cache file */
+		RelightingCache( Scene &scene , const std::string &fileName );
+
+		/** This method ray-traces the scene and returns the computed image, tracing (and caching) the hits only if the cached ones are not valid.
+		*** The pixels are distributed over the prescribed number of threads (when compiled with OpenMP). */
+		Image::Image32 render( int width , int height , int rLimit , double cLimit , int threads=1 );
+
+		/** This method returns true if the hits of the last render were read from the cache. */
+		bool reused( void ) const { return _reused; }
+	};
+}
+#endif // RELIGHTING_CACHE_INCLUDED
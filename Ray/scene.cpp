@@ -1,12 +1,21 @@
 #include <fstream>
 #include <cctype>
 #include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
 #include <Util/exceptions.h>
 #include <Util/cmdLineParser.h>
+#include <Util/timer.h>
+#include <Util/morton.h>
 #include <Image/bmp.h>
+#include <Image/jpeg.h>
 #include "scene.h"
 #include "fileInstance.h"
 #include "shapeList.h"
+#include "scratchArena.h"
+#include "rayPacket.h"
+#include "compiledScene.h"
 
 using namespace std;
 using namespace Ray;
@@ -92,11 +101,105 @@ namespace Ray
 	}
 }
 
+///////////////////
+// CompactVertex //
+///////////////////
+CompactVertex::CompactVertex( void )
+{
+	_position[0] = _position[1] = _position[2] = 0;
+	_normal[0] = _normal[1] = 0;
+	_texCoordinate[0] = _texCoordinate[1] = 0;
+}
+
+CompactVertex::CompactVertex( const Vertex &vertex )
+{
+	for( int d=0 ; d<3 ; d++ ) _position[d] = (float)vertex.position[d];
+
+	// Project the normal onto the octahedron and unfold the lower hemisphere onto the plane
+	Point3D n = vertex.normal;
+	double l1 = fabs( n[0] ) + fabs( n[1] ) + fabs( n[2] );
+	double x = l1 ? n[0]/l1 : 0 , y = l1 ? n[1]/l1 : 0;
+	if( n[2]<0 )
+	{
+		double _x = ( 1. - fabs( y ) ) * ( x<0 ? -1. : 1. );
+		double _y = ( 1. - fabs( x ) ) * ( y<0 ? -1. : 1. );
+		x = _x , y = _y;
+	}
+	_normal[0] = (short)floor( std::max( -1. , std::min( x , 1. ) ) * 32767. + 0.5 );
+	_normal[1] = (short)floor( std::max( -1. , std::min( y , 1. ) ) * 32767. + 0.5 );
+
+	for( int d=0 ; d<2 ; d++ ) _texCoordinate[d] = _EncodeHalf( (float)vertex.texCoordinate[d] );
+}
+
+Point3D CompactVertex::normal( void ) const
+{
+	double x = _normal[0]/32767. , y = _normal[1]/32767. , z = 1. - fabs( x ) - fabs( y );
+	if( z<0 )
+	{
+		double _x = ( 1. - fabs( y ) ) * ( x<0 ? -1. : 1. );
+		double _y = ( 1. - fabs( x ) ) * ( y<0 ? -1. : 1. );
+		x = _x , y = _y;
+	}
+	return Point3D( x , y , z ).unit();
+}
+
+Point2D CompactVertex::texCoordinate( void ) const { return Point2D( _DecodeHalf( _texCoordinate[0] ) , _DecodeHalf( _texCoordinate[1] ) ); }
+
+Vertex CompactVertex::vertex( void ) const
+{
+	Vertex v;
+	v.position = position();
+	v.normal = normal();
+	v.texCoordinate = texCoordinate();
+	return v;
+}
+
+unsigned short CompactVertex::_EncodeHalf( float value )
+{
+	unsigned int bits;
+	memcpy( &bits , &value , sizeof(bits) );
+	unsigned short sign = (unsigned short)( ( bits>>16 ) & 0x8000 );
+	int exponent = (int)( ( bits>>23 ) & 0xff ) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	// Values that are too small are flushed to zero and values that are too large are clamped to infinity
+	if( exponent<-10 ) return sign;
+	if( exponent>=31 ) return sign | 0x7c00;
+
+	// Values below the normal range are stored as sub-normals
+	if( exponent<=0 )
+	{
+		mantissa |= 0x800000;
+		unsigned int shift = 14 - exponent;
+		unsigned int half = mantissa>>shift;
+		if( ( mantissa>>( shift-1 ) ) & 1 ) half++;
+		return sign | (unsigned short)half;
+	}
+
+	// Rounding may carry into the exponent, which is the correctly rounded result
+	unsigned int half = ( exponent<<10 ) | ( mantissa>>13 );
+	if( mantissa & 0x1000 ) half++;
+	return sign | (unsigned short)half;
+}
+
+float CompactVertex::_DecodeHalf( unsigned short half )
+{
+	int exponent = ( half>>10 ) & 0x1f;
+	int mantissa = half & 0x3ff;
+	float value;
+	if( !exponent ) value = ldexpf( (float)mantissa , -24 );
+	else if( exponent==31 ) value = std::numeric_limits< float >::infinity();
+	else value = ldexpf( (float)( mantissa | 0x400 ) , exponent-25 );
+	return ( half & 0x8000 ) ? -value : value;
+}
+
 /////////////////////
 // GlobalSceneData //
 /////////////////////
 unordered_map< string , BaseFactory< Light > * > GlobalSceneData::LightFactories;
 
+bool GlobalSceneData::CullLights = false;
+
 GlobalSceneData::GlobalSceneData( void ) : shader(NULL) {}
 
 GlobalSceneData::~GlobalSceneData( void ){ if( shader ) delete shader; }
@@ -144,6 +247,7 @@ namespace Ray
 			else
 			{
 				UnreadDirective( stream , keyword );
+				if( GlobalSceneData::CullLights ) data.lightTree.set( data.lights );
 				return stream;
 			}
 		}
@@ -154,8 +258,56 @@ namespace Ray
 ////////////////////
 // LocalSceneData //
 ////////////////////
+bool LocalSceneData::CompactVertices = false;
+bool LocalSceneData::SpatialOrder = false;
+
 LocalSceneData::LocalSceneData( void ) : keyFrameFile(NULL) {}
 
+size_t LocalSceneData::vertexNum( void ) const { return vertices.size() + compactVertices.size(); }
+
+void LocalSceneData::reorderVertices( void )
+{
+	size_t vNum = vertexNum();
+	auto Position = [&]( size_t i ){ return vertices.size() ? vertices[i].position : compactVertices[i].position(); };
+
+	// Compute the Morton codes of the vertex positions, quantized to a 2^10 grid over the bounding box
+	Point3D min , max;
+	for( size_t i=0 ; i<vNum ; i++ )
+	{
+		Point3D p = Position(i);
+		for( int d=0 ; d<3 ; d++ )
+		{
+			if( !i || p[d]<min[d] ) min[d] = p[d];
+			if( !i || p[d]>max[d] ) max[d] = p[d];
+		}
+	}
+	std::vector< std::pair< unsigned int , unsigned int > > keys( vNum );
+	for( size_t i=0 ; i<vNum ; i++ )
+	{
+		Point3D p = Position(i);
+		unsigned int cell[3];
+		for( int d=0 ; d<3 ; d++ ) cell[d] = max[d]>min[d] ? (unsigned int)( ( p[d]-min[d] ) / ( max[d]-min[d] ) * 1023 ) : 0;
+		keys[i] = std::make_pair( (unsigned int)MortonCode( cell[0] , cell[1] , cell[2] ) , (unsigned int)i );
+	}
+	std::sort( keys.begin() , keys.end() );
+
+	// Permute the vertices and record where each one went
+	vertexMap.resize( vNum );
+	for( size_t i=0 ; i<vNum ; i++ ) vertexMap[ keys[i].second ] = (unsigned int)i;
+	if( vertices.size() )
+	{
+		std::vector< Vertex > _vertices( vNum );
+		for( size_t i=0 ; i<vNum ; i++ ) _vertices[i] = vertices[ keys[i].second ];
+		vertices.swap( _vertices );
+	}
+	else
+	{
+		std::vector< CompactVertex > _compactVertices( vNum );
+		for( size_t i=0 ; i<vNum ; i++ ) _compactVertices[i] = compactVertices[ keys[i].second ];
+		compactVertices.swap( _compactVertices );
+	}
+}
+
 LocalSceneData::~LocalSceneData( void ){ if( keyFrameFile ) delete keyFrameFile; }
 
 void LocalSceneData::setCurrentTime( double t , int curveFit )
@@ -176,6 +328,7 @@ namespace Ray
 		for( int i=0 ; i<data.materials.size() ; i++ ) stream << data.materials[i] << endl;
 		for( int i=0 ; i<data.files.size()     ; i++ ) stream << data.files[i]  << endl;
 		for( int i=0 ; i<data.vertices.size()  ; i++ ) stream << data.vertices[i]  << endl;
+		for( size_t i=0 ; i<data.compactVertices.size() ; i++ ) stream << data.compactVertices[i].vertex() << endl;
 		if( data.keyFrameFile ) stream << *data.keyFrameFile << endl;
 		return stream;
 	}
@@ -209,7 +362,8 @@ namespace Ray
 			{
 				Vertex vertex;
 				stream >> vertex;
-				data.vertices.push_back( vertex );
+				if( LocalSceneData::CompactVertices ) data.compactVertices.push_back( CompactVertex( vertex ) );
+				else data.vertices.push_back( vertex );
 			}
 
 			// Reading the included ray files
@@ -273,8 +427,9 @@ namespace Ray
 	istream &operator >> ( istream &stream , Texture &texture )
 	{
 		if( !( stream >> texture._filename ) ) THROW( "Failed to parse texture" );
-		std::string fileName = GetFileName( Scene::BaseDir , texture._filename );
-		texture._image.read( fileName );
+		texture._path = GetFileName( Scene::BaseDir , texture._filename );
+		texture._scale = 0;
+		if( !Texture::MipMap ) texture.load( 0 );
 		return stream;
 	}
 
@@ -284,6 +439,197 @@ namespace Ray
 	}
 }
 
+bool Texture::MipMap = false;
+
+void Texture::load( double footprint )
+{
+	unsigned int scale = 1;
+	string ext = ToLower( GetFileExtension( _path ) );
+	if( MipMap && footprint>0 && ( ext=="jpg" || ext=="jpeg" ) )
+	{
+		// Reduce the resolution by the number of levels that are never selected, with a margin for rounding
+		int width , height;
+		JPEGReadSize( _path , width , height );
+		double lod = log2( footprint * std::max< int >( width , height ) ) - 1e-6;
+		while( scale<8 && lod>=1 ) scale *= 2 , lod -= 1;
+	}
+	if( _scale && _scale<=scale ) return;
+
+	// Hand the decoded texels over to the texture cache, so that they are only kept while the budget allows
+	Image32 image;
+	_scale = scale;
+	_decode( image );
+	_setLevels( image.width() , image.height() );
+	_putTiles( image );
+}
+
+void Texture::_decode( Image32 &image ) const
+{
+	if( _scale>1 ) JPEGReadImage( _path , image , _scale );
+	else image.read( _path );
+}
+
+void Texture::_CutTile( const Image32 &image , unsigned int x , unsigned int y , TextureCache::Tile &tile )
+{
+	unsigned int x0 = x * TextureCache::TileRes , y0 = y * TextureCache::TileRes;
+	tile.width = std::min< unsigned int >( TextureCache::TileRes+1 , image.width()-x0 ) , tile.height = std::min< unsigned int >( TextureCache::TileRes+1 , image.height()-y0 );
+	tile.texels.resize( (size_t)tile.width * tile.height );
+	for( unsigned int j=0 ; j<tile.height ; j++ ) for( unsigned int i=0 ; i<tile.width ; i++ )
+	{
+		const Pixel32 &pixel = image( x0+i , y0+j );
+		TextureCache::Texel &texel = tile.texels[ (size_t)j*tile.width+i ];
+		texel.c[0] = pixel.r , texel.c[1] = pixel.g , texel.c[2] = pixel.b , texel.c[3] = pixel.a;
+	}
+}
+
+Image32 Texture::_Coarsen( const Image32 &fine )
+{
+	Image32 level;
+	level.setSize( std::max< int >( fine.width()/2 , 1 ) , std::max< int >( fine.height()/2 , 1 ) );
+	for( int y=0 ; y<level.height() ; y++ ) for( int x=0 ; x<level.width() ; x++ )
+	{
+		int x0 = 2*x , x1 = std::min< int >( 2*x+1 , fine.width()-1 ) , y0 = 2*y , y1 = std::min< int >( 2*y+1 , fine.height()-1 );
+		const Pixel32 &p00 = fine(x0,y0) , &p10 = fine(x1,y0) , &p01 = fine(x0,y1) , &p11 = fine(x1,y1);
+		Pixel32 &pixel = level(x,y);
+		pixel.r = (unsigned char)( ( p00.r + p10.r + p01.r + p11.r + 2 ) / 4 );
+		pixel.g = (unsigned char)( ( p00.g + p10.g + p01.g + p11.g + 2 ) / 4 );
+		pixel.b = (unsigned char)( ( p00.b + p10.b + p01.b + p11.b + 2 ) / 4 );
+		pixel.a = (unsigned char)( ( p00.a + p10.a + p01.a + p11.a + 2 ) / 4 );
+	}
+	return level;
+}
+
+void Texture::_putTiles( const Image32 &image ) const
+{
+	const Image32 *level = &image;
+	Image32 coarse;
+	for( unsigned int l=0 ; l<_levels.size() ; l++ )
+	{
+		if( l ) coarse = _Coarsen( *level ) , level = &coarse;
+		for( unsigned int y=0 ; y*TextureCache::TileRes<_levels[l].height ; y++ ) for( unsigned int x=0 ; x*TextureCache::TileRes<_levels[l].width ; x++ )
+		{
+			std::shared_ptr< TextureCache::Tile > tile = std::make_shared< TextureCache::Tile >();
+			_CutTile( *level , x , y , *tile );
+			TextureCache::Put( _cacheID , l , x , y , tile );
+		}
+	}
+}
+
+void Texture::BoundFootprints( std::unordered_map< const Texture * , double > &footprints , const Texture *texture , const BoundingBox3D &bBox , Point3D eye , double pixelAngle , double texelScale )
+{
+	double distance2 = 0;
+	for( int d=0 ; d<3 ; d++ )
+	{
+		double delta = std::max< double >( 0 , std::max< double >( bBox[0][d] - eye[d] , eye[d] - bBox[1][d] ) );
+		distance2 += delta * delta;
+	}
+	double footprint = pixelAngle * sqrt( distance2 ) * texelScale;
+	auto iter = footprints.find( texture );
+	if( iter==footprints.end() ) footprints[ texture ] = footprint;
+	else iter->second = std::min< double >( iter->second , footprint );
+}
+
+void Texture::_setLevels( unsigned int width , unsigned int height )
+{
+	_levels.clear();
+	_levels.push_back( _Level{ width , height } );
+	while( _levels.back().width>1 || _levels.back().height>1 ) _levels.push_back( _Level{ std::max< unsigned int >( _levels.back().width/2 , 1 ) , std::max< unsigned int >( _levels.back().height/2 , 1 ) } );
+	_cacheID = TextureCache::NewTexture();
+}
+
+void Texture::_setTile( unsigned int l , unsigned int x , unsigned int y , TextureCache::Tile &tile ) const
+{
+	if( !l )
+	{
+		// Decode the image again, and add the other tiles of the level that are nearest to the tile, as they are the most likely to be
+		// accessed next. So that they do not evict one another, only as many as fit in half the budget are added, farthest first.
+		Image32 image;
+		_decode( image );
+		std::vector< std::pair< unsigned long long , std::pair< unsigned int , unsigned int > > > tiles;
+		for( unsigned int _y=0 ; _y*TextureCache::TileRes<_levels[0].height ; _y++ ) for( unsigned int _x=0 ; _x*TextureCache::TileRes<_levels[0].width ; _x++ ) if( _x!=x || _y!=y )
+		{
+			long long dx = (long long)_x - x , dy = (long long)_y - y;
+			tiles.push_back( std::make_pair( (unsigned long long)( dx*dx + dy*dy ) , std::make_pair( _x , _y ) ) );
+		}
+		std::sort( tiles.begin() , tiles.end() );
+		size_t tileBytes = sizeof( TextureCache::Tile ) + sizeof( TextureCache::Texel ) * ( TextureCache::TileRes+1 ) * ( TextureCache::TileRes+1 );
+		size_t tileNum = std::min< size_t >( tiles.size() , TextureCache::Budget / 2 / tileBytes );
+		for( size_t i=tileNum ; i>0 ; i-- )
+		{
+			std::shared_ptr< TextureCache::Tile > _tile = std::make_shared< TextureCache::Tile >();
+			_CutTile( image , tiles[i-1].second.first , tiles[i-1].second.second , *_tile );
+			TextureCache::Put( _cacheID , 0 , tiles[i-1].second.first , tiles[i-1].second.second , _tile );
+		}
+		_CutTile( image , x , y , tile );
+		return;
+	}
+
+	unsigned int x0 = x * TextureCache::TileRes , y0 = y * TextureCache::TileRes;
+	tile.width = std::min< unsigned int >( TextureCache::TileRes+1 , _levels[l].width-x0 ) , tile.height = std::min< unsigned int >( TextureCache::TileRes+1 , _levels[l].height-y0 );
+	tile.texels.resize( (size_t)tile.width * tile.height );
+
+	// Get the (at most 3 x 3) tiles of the finer level covering the texels that are averaged
+	const _Level &fine = _levels[l-1];
+	unsigned int fx0 = 2*x0 / TextureCache::TileRes , fy0 = 2*y0 / TextureCache::TileRes;
+	unsigned int fx1 = std::min< unsigned int >( 2*(x0+tile.width-1)+1 , fine.width-1 ) / TextureCache::TileRes , fy1 = std::min< unsigned int >( 2*(y0+tile.height-1)+1 , fine.height-1 ) / TextureCache::TileRes;
+	std::shared_ptr< const TextureCache::Tile > fineTiles[3][3];
+	for( unsigned int j=fy0 ; j<=fy1 ; j++ ) for( unsigned int i=fx0 ; i<=fx1 ; i++ )
+		fineTiles[j-fy0][i-fx0] = TextureCache::Get( _cacheID , l-1 , i , j , [&]( TextureCache::Tile &t ){ _setTile( l-1 , i , j , t ); } );
+	auto Fine = [&]( unsigned int i , unsigned int j ) -> const TextureCache::Texel &
+	{
+		unsigned int tx = i / TextureCache::TileRes , ty = j / TextureCache::TileRes;
+		return (*fineTiles[ty-fy0][tx-fx0])( i - tx*TextureCache::TileRes , j - ty*TextureCache::TileRes );
+	};
+
+	for( unsigned int j=0 ; j<tile.height ; j++ ) for( unsigned int i=0 ; i<tile.width ; i++ )
+	{
+		unsigned int _x = x0+i , _y = y0+j;
+		unsigned int _x0 = 2*_x , _x1 = std::min< unsigned int >( 2*_x+1 , fine.width-1 ) , _y0 = 2*_y , _y1 = std::min< unsigned int >( 2*_y+1 , fine.height-1 );
+		const TextureCache::Texel &t00 = Fine(_x0,_y0) , &t10 = Fine(_x1,_y0) , &t01 = Fine(_x0,_y1) , &t11 = Fine(_x1,_y1);
+		TextureCache::Texel &texel = tile.texels[ (size_t)j*tile.width+i ];
+		for( int c=0 ; c<4 ; c++ ) texel.c[c] = (unsigned char)( ( t00.c[c] + t10.c[c] + t01.c[c] + t11.c[c] + 2 ) / 4 );
+	}
+}
+
+Point3D Texture::_bilinear( unsigned int l , Point2D p ) const
+{
+	const _Level &level = _levels[l];
+	double u = p[0] * ( level.width - 1 ) , v = p[1] * ( level.height - 1 );
+	int u1 = (int)floor( u ) , v1 = (int)floor( v );
+	double du = u - u1 , dv = v - v1;
+	auto Clamp = []( int i , unsigned int res ){ return (unsigned int)std::max< int >( 0 , std::min< int >( i , (int)res-1 ) ); };
+	unsigned int x1 = Clamp( u1 , level.width ) , x2 = Clamp( u1+1 , level.width ) , y1 = Clamp( v1 , level.height ) , y2 = Clamp( v1+1 , level.height );
+
+	// The four texels lie in the tile containing the first, as tiles include the texels that follow them
+	unsigned int x = x1 / TextureCache::TileRes , y = y1 / TextureCache::TileRes;
+	std::shared_ptr< const TextureCache::Tile > tile = TextureCache::Get( _cacheID , l , x , y , [&]( TextureCache::Tile &t ){ _setTile( l , x , y , t ); } );
+	x1 -= x * TextureCache::TileRes , x2 -= x * TextureCache::TileRes , y1 -= y * TextureCache::TileRes , y2 -= y * TextureCache::TileRes;
+
+	// The channels are scaled to [0,1)
+	auto Channel = []( const TextureCache::Texel &texel , int c ){ return texel.c[c] / 256.f; };
+
+	// No need for bilinear interpolation at the texel centers
+	if( du<1e-9 && dv<1e-9 ) return Point3D( Channel( (*tile)(x1,y1) , 0 ) , Channel( (*tile)(x1,y1) , 1 ) , Channel( (*tile)(x1,y1) , 2 ) );
+
+	const TextureCache::Texel &t11 = (*tile)(x1,y1) , &t21 = (*tile)(x2,y1) , &t12 = (*tile)(x1,y2) , &t22 = (*tile)(x2,y2);
+	double c[4];
+	for( int i=0 ; i<4 ; i++ ) c[i] = ( Channel( t11 , i ) * ( 1 - du ) + Channel( t21 , i ) * du ) * ( 1 - dv ) + ( Channel( t12 , i ) * ( 1 - du ) + Channel( t22 , i ) * du ) * dv;
+	return Point3D( c[0] , c[1] , c[2] );
+}
+
+Point3D Texture::sample( Point2D p , double footprint ) const
+{
+	if( !MipMap || !( footprint>0 ) ) return _bilinear( 0 , p );
+
+	// Choose the (fractional) level at which a texel spans the footprint, and interpolate between the levels on either side
+	double lod = log2( footprint * std::max< unsigned int >( _levels[0].width , _levels[0].height ) );
+	if( !( lod>0 ) ) return _bilinear( 0 , p );
+	unsigned int l = (unsigned int)floor( lod );
+	if( l+1>=_levels.size() ) return _bilinear( (unsigned int)_levels.size()-1 , p );
+	double s = lod - l;
+	return _bilinear( l , p ) * ( 1. - s ) + _bilinear( l+1 , p ) * s;
+}
+
 ////////////
 // Shader //
 ////////////
@@ -359,9 +705,19 @@ namespace Ray
 ///////////////////
 void SceneGeometry::drawOpenGL( GLSLProgram *glslProgram ) const { _shapeList.drawOpenGL( glslProgram ); }
 
+void SceneGeometry::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const { _shapeList.boundTextureFootprints( toWorld , eye , pixelAngle , footprints ); }
+
+void SceneGeometry::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const { _shapeList.addAnimatedNodes( toWorld , nodes ); }
+
 bool SceneGeometry::isInside( Point3D p ) const { return _shapeList.isInside( p ); }
 
-double SceneGeometry::intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const { return _shapeList.intersect( ray , iInfo , range , validityLambda ); }
+unsigned int SceneGeometry::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const { return _shapeList.spans( ray , range , spans ); }
+
+unsigned int SceneGeometry::maxSpanNum( void ) const { return _shapeList.maxSpanNum(); }
+
+double SceneGeometry::intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const { return _shapeList.intersect( ray , iInfo , range , validityLambda ); }
+
+void SceneGeometry::intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , BoundingBox1D range ) const { _shapeList.intersectPacket( packet , mask , iInfo , t , range ); }
 
 void SceneGeometry::init( void )
 {
@@ -375,7 +731,11 @@ void SceneGeometry::init( void )
 		else if( index>=_localData.textures.size() ) THROW( "material specifies a texture out of texture bounds: %d <= %d" , index , (int)_localData.textures.size() );
 		else _localData.materials[i].tex = &_localData.textures[ index ];
 	}
+
+	// Reorder the vertices, with the shapes remapping their vertex indices as they are initialized
+	if( LocalSceneData::SpatialOrder && _localData.vertexNum() ) _localData.reorderVertices();
 	init( _localData );
+	std::vector< unsigned int >().swap( _localData.vertexMap );
 }
 
 void SceneGeometry::init( const LocalSceneData &localData )
@@ -396,7 +756,7 @@ void SceneGeometry::initOpenGL( void )
 	for( int i=0 ; i<_localData.files.size() ; i++ ) _localData.files[i].initOpenGL();
 	_shapeList.initOpenGL();
 
-	for( int i=0 ; i<_localData.textures.size() ; i++ ) _localData.textures[i].initOpenGL();
+	for( int i=0 ; i<_localData.textures.size() ; i++ ) _localData.textures[i].load( 0 ) , _localData.textures[i].initOpenGL();
 
 	// Sanity check to make sure that OpenGL state is good
 	ASSERT_OPEN_GL_STATE();	
@@ -449,6 +809,33 @@ void SceneGeometry::_read( istream &stream )
 
 size_t SceneGeometry::primitiveNum( void ) const { return _shapeList.primitiveNum(); }
 
+size_t SceneGeometry::vertexNum( void ) const
+{
+	size_t vNum = _localData.vertexNum();
+	for( int i=0 ; i<_localData.files.size() ; i++ ) vNum += _localData.files[i].vertexNum();
+	return vNum;
+}
+
+void SceneGeometry::loadTextures( const std::unordered_map< const Texture * , double > &footprints )
+{
+	for( int i=0 ; i<_localData.files.size() ; i++ ) _localData.files[i].loadTextures( footprints );
+	for( int i=0 ; i<_localData.textures.size() ; i++ )
+	{
+		auto iter = footprints.find( &_localData.textures[i] );
+		_localData.textures[i].load( iter==footprints.end() ? 0 : iter->second );
+	}
+}
+
+size_t SceneGeometry::depth( void ) const { return _shapeList.depth(); }
+
+Shape *SceneGeometry::flatten( void )
+{
+	for( int i=0 ; i<_localData.files.size() ; i++ ) _localData.files[i].flatten();
+	// The root of the scene-graph is not replaced, only its children are simplified
+	_shapeList.flatten();
+	return this;
+}
+
 ///////////
 // Scene //
 ///////////
@@ -478,6 +865,10 @@ namespace Ray
 		stream >> ( SceneGeometry & )scene;
 
 		scene.init();
+
+		// Compose nested transformations and remove redundant nodes from the scene-graph
+		scene._unflattenedDepth = scene.depth();
+		scene.flatten();
 		return stream;
 	}
 }
@@ -497,37 +888,105 @@ void Scene::drawOpenGL( void ) const
 	ASSERT_OPEN_GL_STATE();	
 }
 
-Image32 Scene::rayTrace( int width , int height , int rLimit , double cLimit )
+void Scene::_setPixelAngle( int height )
 {
+	_pixelAngle = _globalData.camera.heightAngle / height;
+
+	// Bound the footprints of the rays on the textures, as seen from the camera
+	std::unordered_map< const Texture * , double > footprints;
+	if( Texture::MipMap ) boundTextureFootprints( Matrix4D::Identity() , _globalData.camera.position , _pixelAngle , footprints );
+	loadTextures( footprints );
+}
+
+Image32 Scene::rayTrace( int width , int height , int rLimit , double cLimit , unsigned int packetWidth , int pixelOrder , int threads )
+{
+	if( !packetWidth || packetWidth*packetWidth>RayPacket::MaxSize ) THROW( "packet width must be positive and cover at most %d pixels: %d" , RayPacket::MaxSize , packetWidth );
+	if( threads<1 ) THROW( "number of threads must be positive: %d" , threads );
 	updateBoundingBox();
+	_setPixelAngle( height );
 	Image32 img;
-
 	img.setSize( width , height );
-	for( int j=0 ; j<height ; j++ )
+
+	// The blocks of pixels, in the order in which they are traced
+	PixelOrder order( pixelOrder , width , height , packetWidth );
+
+#pragma omp parallel num_threads( threads )
 	{
-		for( int i=0 ; i<width ; i++ )
-		{   
-			
+		// Make sure the traversal scratch memory is in place before tracing begins
+		ScratchArena &arena = ScratchArena::ThreadArena();
+		arena.reserve( ScratchArena::DefaultBlockSize );
+
+#pragma omp for schedule( dynamic , 16 )
+		for( long long b=0 ; b<(long long)order.size() ; b++ )
+		{
+			int i = order[b].x , j = order[b].y;
+			arena.reset();
 			try
 			{
-				Ray3D ray = _globalData.camera.getRay( i , height-j-1 , width , height );
-				// std::cout<<"i"<<i<<std::endl;
-				// std::cout<<"j"<<j<<std::endl;
-				Point3D c = getColor( ray , rLimit , Point3D( cLimit , cLimit , cLimit ) );
-				Pixel32 p;
-				p.r = (int)(c[0]*255);
-				p.g = (int)(c[1]*255);
-				p.b = (int)(c[2]*255);
-				img(i,j) = p;
+				// Generate the primary rays for the block of pixels
+				RayPacket packet;
+				int pixels[ RayPacket::MaxSize ][2];
+				for( int jj=j ; jj<j+(int)packetWidth && jj<height ; jj++ ) for( int ii=i ; ii<i+(int)packetWidth && ii<width ; ii++ )
+				{
+					pixels[ packet.size ][0] = ii , pixels[ packet.size ][1] = jj;
+					packet.set( packet.size++ , _globalData.camera.getRay( ii , height-jj-1 , width , height ) );
+				}
+
+				// Intersect the primary rays
+				RayShapeIntersectionInfo iInfo[ RayPacket::MaxSize ] = {};
+				double t[ RayPacket::MaxSize ];
+				Timer timer;
+				if( packetWidth==1 ) t[0] = intersect( packet.rays[0] , iInfo[0] );
+				else intersectPacket( packet , packet.mask() , iInfo , t );
+				RayTracingStats::AddPrimaryRays( packet.size , timer.elapsed() );
+
+				// Shade the hits
+				for( unsigned int k=0 ; k<packet.size ; k++ )
+				{
+					Point3D c = t[k]<Infinity ? shade( packet.rays[k] , iInfo[k] , rLimit , Point3D( cLimit , cLimit , cLimit ) ) : Point3D();
+					Pixel32 p;
+					p.r = (int)(c[0]*255);
+					p.g = (int)(c[1]*255);
+					p.b = (int)(c[2]*255);
+					img( pixels[k][0] , pixels[k][1] ) = p;
+				}
 			}
-			catch( std::exception &e ){ ERROR_OUT( "failed to generate pixel ( %d , %d )\n%s" , i , j , e.what() ); }
+			catch( std::exception &e ){ ERROR_OUT( "failed to generate pixel block ( %d , %d )\n%s" , i , j , e.what() ); }
 		}
+
+		// Fold this thread's statistics into the totals
+		RayTracingStats::Merge();
 	}
 	return img;
 }
 
-double Scene::intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+Scene::~Scene( void ){ delete _compiledScene; }
+
+void Scene::compile( void )
+{
+	if( !_compiledScene ) _compiledScene = new CompiledScene();
+	SceneGeometry::updateBoundingBox();
+	_compiledScene->compile( *this );
+}
+
+void Scene::updateBoundingBox( void )
+{
+	SceneGeometry::updateBoundingBox();
+	if( _compiledScene ) _compiledScene->updateBoundingBoxes();
+	for( int i=0 ; i<_globalData.lights.size() ; i++ ) _globalData.lights[i]->setShadowCasters( _shapeList );
+}
+
+double Scene::intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	RayTracingStats::IncrementRayNum();
+	if( _compiledScene ) return _compiledScene->intersect( ray , iInfo , range , validityLambda );
 	return SceneGeometry::intersect( ray , iInfo , range , validityLambda );
 }
+
+void Scene::intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , BoundingBox1D range ) const
+{
+	for( unsigned int i=0 ; i<packet.size ; i++ ) if( mask & ( 1u<<i ) ) RayTracingStats::IncrementRayNum();
+	// The compiled representation has no packet traversal, so its rays are intersected one at a time
+	if( _compiledScene ){ for( unsigned int i=0 ; i<packet.size ; i++ ) if( mask & ( 1u<<i ) ) t[i] = _compiledScene->intersect( packet.rays[i] , iInfo[i] , range ); }
+	else SceneGeometry::intersectPacket( packet , mask , iInfo , t , range );
+}
@@ -6,9 +6,12 @@
 #include <Image/image.h>
 #include "shape.h"
 #include "light.h"
+#include "lightTree.h"
 #include "shapeList.h"
 #include "keyFrames.h"
 #include "camera.h"
+#include "pixelOrder.h"
+#include "textureCache.h"
 
 namespace Ray
 {
@@ -18,6 +21,7 @@ namespace Ray
 	class KeyFrameFile;
 	class Shader;
 	class Vertex;
+	class CompactVertex;
 
 	/** This function tries to read the next directive from a stream.*/
 	std::string ReadDirective( std::istream &stream );
@@ -38,6 +42,12 @@ namespace Ray
 		/** The list of lights in the scene */
 		std::vector< Light * > lights;
 
+		/** The hierarchy over the lights, used to cull lights at shading points (empty unless CullLights is set) */
+		LightTree lightTree;
+
+		/** Should lights whose contribution is bounded below the cut-off be culled at shading points */
+		static bool CullLights;
+
 		/** The shader */
 		Shader *shader;
 
@@ -64,6 +74,24 @@ namespace Ray
 		/** The vertex list */
 		std::vector< Vertex > vertices;
 
+		/** The compact vertex list, used instead of the vertex list when vertices are read in compact form */
+		std::vector< CompactVertex > compactVertices;
+
+		/** Should vertices be read in compact form */
+		static bool CompactVertices;
+
+		/** Should vertices and triangles be reordered along a space-filling curve at initialization */
+		static bool SpatialOrder;
+
+		/** The map from the indices of the vertices in the .ray file to their indices after reordering (empty if the vertices were not reordered) */
+		std::vector< unsigned int > vertexMap;
+
+		/** This method sorts the vertices by the Morton codes of their positions and sets the map from the old indices to the new ones */
+		void reorderVertices( void );
+
+		/** This method returns the number of vertices, in either form */
+		size_t vertexNum( void ) const;
+
 		/** The list of materials */
 		std::vector< Material > materials;
 
@@ -99,6 +127,11 @@ namespace Ray
 	/** This class stores all of the information describing the geometry in a scene */
 	class SceneGeometry : public Shape
 	{
+		friend class CompiledScene;
+		friend class Scene;
+		friend class RelightingCache;
+		friend class AnimationRenderer;
+
 		/** The local data */
 		LocalSceneData _localData;
 
@@ -116,6 +149,13 @@ namespace Ray
 		/** This method updates the current time, changing the parameter values as needed */
 		void setCurrentTime( double t , int curveFit );
 
+		/** This method returns the number of vertices in the scene geometry and the files it includes */
+		size_t vertexNum( void ) const;
+
+		/** This method decodes the textures of the scene geometry and the files it includes, given the bounds on their footprints
+		*** (with textures that have no bound decoded at full resolution). */
+		void loadTextures( const std::unordered_map< const Texture * , double > &footprints );
+
 		///////////////////
 		// Shape methods //
 		///////////////////
@@ -127,10 +167,17 @@ namespace Ray
 		void init( const LocalSceneData &sceneData );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		void intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		bool isInside( Util::Point3D p ) const;
 		void drawOpenGL( GLSLProgram *glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
+		Shape *flatten( void );
 	};
 
 	/** This class stores all of the information read out from a .ray file.*/
@@ -138,16 +185,43 @@ namespace Ray
 	{
 		friend class Window;
 		friend class FileInstance;
+		friend class WavefrontRenderer;
+		friend class RelightingCache;
+		friend class AnimationRenderer;
 		friend std::ostream &operator << ( std::ostream & , const Scene & );
 		friend std::istream &operator >> ( std::istream & ,       Scene & );
 
 		/** The global data */
 		GlobalSceneData _globalData;
 
+		/** The depth of the scene-graph, as read in and before it was flattened */
+		size_t _unflattenedDepth = 0;
+
+		/** The data-oriented representation of the scene-graph used for ray-tracing (or NULL if the scene has not been compiled) */
+		class CompiledScene *_compiledScene = NULL;
+
+		/** The angle subtended by a pixel of the image being ray-traced, used to estimate the footprints of the rays on textures */
+		double _pixelAngle = 0;
+
+		/** This method sets the pixel angle for an image of the prescribed height, and decodes the textures at the resolutions needed for it. */
+		void _setPixelAngle( int height );
+
 	public:
 		/** The base directory */
 		static std::string BaseDir;
 
+		/** The destructor */
+		~Scene( void );
+
+		/** This method returns the depth of the scene-graph before it was flattened. */
+		size_t unflattenedDepth( void ) const { return _unflattenedDepth; }
+
+		/** This method lowers the scene-graph into a CompiledScene, which is then used for all subsequent ray-tracing. */
+		void compile( void );
+
+		/** This method returns the compiled representation of the scene-graph (or NULL if the scene has not been compiled). */
+		const class CompiledScene *compiledScene( void ) const { return _compiledScene; }
+
 		/** This function reflects the vector v about the normal n. */
 		static Util::Point3D Reflect( Util::Point3D v , Util::Point3D n );
 
@@ -155,13 +229,40 @@ namespace Ray
 		*** The refracted vector is written into refract and a value of true is returned if the refraction succeeded (i.e. the necessary arcsin could be computed). */
 		static bool Refract( Util::Point3D v , Util::Point3D n , double ir , Util::Point3D& refract );
 
+		/** This function returns the ray reflected at the point of intersection. */
+		static Util::Ray3D ReflectedRay( Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo );
+
+		/** This function computes the ray refracted at the point of intersection, returning false if there is no refracted ray. */
+		static bool RefractedRay( Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo , Util::Ray3D &refracted );
+
+		/** This function returns true if a secondary ray attenuated by the coefficients k can still contribute above the cut-off. */
+		static bool Propagates( Util::Point3D k , Util::Point3D cLimit );
+
+		/** This function clamps the color channels to the range [0,1]. */
+		static Util::Point3D Clamp( Util::Point3D color );
+
 		/** This is the function responsible for the recursive ray-tracing returning the color obtained
 		*** by shooting a ray into the scene and recursing until either the recursion depth has been reached
 		*** or the contribution from subsequent bounces is guaranteed to be less than the cut-off. */
 		Util::Point3D getColor( Util::Ray3D ray , int rDepth , Util::Point3D cLimit);
 
-		/** This method ray-traces the scene and returns the computed image */
-		Image::Image32 rayTrace( int width , int height , int rLimit , double cLimit );
+		/** This method returns the color obtained at the (valid) intersection of the ray with the scene.
+		*** It is the part of getColor following the intersection, accumulating the lighting and recursing into reflected and refracted rays. */
+		Util::Point3D shade( Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo , int rDepth , Util::Point3D cLimit );
+
+		/** This method returns the (unclamped) emissive, ambient, diffuse, and specular color at the intersection of the ray with the scene,
+		*** given the transparency of the path to each of the lights.
+		*** If the selection is provided, only the lights that are selected contribute. */
+		Util::Point3D directColor( Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo , const Util::Point3D transparency[] , const bool selected[]=NULL ) const;
+
+		/** This method returns the (unclamped) direct color at the intersection of the ray with the scene, tracing the shadow rays to the lights that are not culled.
+		*** It is the part of shade that does not recurse. */
+		Util::Point3D directColor( Util::Ray3D ray , const RayShapeIntersectionInfo &iInfo , Util::Point3D cLimit ) const;
+
+		/** This method ray-traces the scene and returns the computed image.
+		*** Primary rays are generated, and intersected, in packets for blocks of packetWidth x packetWidth pixels.
+		*** The blocks are visited in the prescribed PixelOrder and are distributed over the prescribed number of threads (when compiled with OpenMP). */
+		Image::Image32 rayTrace( int width , int height , int rLimit , double cLimit , unsigned int packetWidth=1 , int pixelOrder=PixelOrder::SCANLINE , int threads=1 );
 
 		/** This method should be called (once) after an OpenGL context has been created */
 		void initOpenGL( void );
@@ -169,8 +270,14 @@ namespace Ray
 		/** This method calls the necessary OpenGL commands to render the primitive. */
 		void drawOpenGL( void ) const;
 
+		/** This method updates the bounding boxes of the scene-graph, and of its compiled representation */
+		void updateBoundingBox( void );
+
 		/** This method ray-traces the primitive */
-		double intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityLambda = [] ( double ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityLambda = ValidityFunction() ) const;
+
+		/** This method ray-traces the packet of rays, using the compiled representation if there is one */
+		void intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) ) const;
 	};
 
 	/** This operator writes a Scene object out to a stream. */
@@ -210,6 +317,46 @@ namespace Ray
 		Util::Point2D texCoordinate;
 	};
 
+	/** This class stores a vertex in compact form, using 20 bytes rather than the 64 bytes of a Vertex:
+	*** the position is stored in single precision, the normal is octahedrally encoded with 16 bits per coordinate,
+	*** and the texture coordinates are stored in half precision. The attributes are decoded on demand. */
+	class CompactVertex
+	{
+		/** The position of the vertex */
+		float _position[3];
+
+		/** The octahedral encoding of the normal */
+		short _normal[2];
+
+		/** The half-precision texture coordinates */
+		unsigned short _texCoordinate[2];
+
+		/** This static method returns the half-precision representation of a value */
+		static unsigned short _EncodeHalf( float value );
+
+		/** This static method returns the value represented in half-precision */
+		static float _DecodeHalf( unsigned short half );
+
+	public:
+		/** The default constructor */
+		CompactVertex( void );
+
+		/** The constructor encoding a vertex */
+		CompactVertex( const Vertex &vertex );
+
+		/** This method returns the decoded position of the vertex */
+		Util::Point3D position( void ) const { return Util::Point3D( _position[0] , _position[1] , _position[2] ); }
+
+		/** This method returns the decoded normal at the vertex */
+		Util::Point3D normal( void ) const;
+
+		/** This method returns the decoded texture coordinates at the vertex */
+		Util::Point2D texCoordinate( void ) const;
+
+		/** This method returns the decoded vertex */
+		Vertex vertex( void ) const;
+	};
+
 	/** This operator writes a Vertex object out to a stream. */
 	std::ostream &operator << ( std::ostream &stream , const Vertex &vertex );
 
@@ -231,6 +378,21 @@ namespace Ray
 
 		/** The texture coordinates of the the shape at the point of intersection */
 		Util::Point2D texture;
+
+		/** The rate at which the texture coordinates change with distance along the surface, in the coordinates of the shape (or zero if the shape is not textured) */
+		double texelScale = 0;
+	};
+
+	/** This class represents an interval along a ray over which the ray is inside a shape, together with the intersection information at its end-points.
+	*** An end-point that results from clipping the interval to the queried range, rather than from crossing the surface, has a NULL material. */
+	class RaySpan
+	{
+	public:
+		/** The values along the ray at which the interval starts and ends */
+		double t[2];
+
+		/** The intersection information at the start and end of the interval */
+		RayShapeIntersectionInfo iInfo[2];
 	};
 
 	/** This class stores surface material properties. */
@@ -297,12 +459,70 @@ namespace Ray
 		/** The name of the texture file */
 		std::string _filename;
 
-		/** The image used as a texture */
-		Image::Image32 _image;
+		/** The path to the texture file */
+		std::string _path;
+
+		/** The factor by which the resolution of the image was reduced when it was decoded (or zero if it has not been decoded) */
+		unsigned int _scale = 0;
 
 		/** The texture handle for OpenGL rendering */
 		GLuint _openGLHandle;
+
+		/** The dimensions of a level of the mip-map pyramid */
+		struct _Level{ unsigned int width , height; };
+
+		/** The dimensions of the levels of the mip-map pyramid, from the finest (the decoded image) to the coarsest (a single texel).
+		*** The texels themselves are only held by the texture cache. */
+		std::vector< _Level > _levels;
+
+		/** The identifier of the texture in the texture cache */
+		unsigned int _cacheID;
+
+		/** This method decodes the image at the current scale. */
+		void _decode( Image::Image32 &image ) const;
+
+		/** This static method sets the tile of the image at the prescribed tile coordinates. */
+		static void _CutTile( const Image::Image32 &image , unsigned int x , unsigned int y , TextureCache::Tile &tile );
+
+		/** This static method returns the next coarser level of the mip-map pyramid, box-filtering the finer one. */
+		static Image::Image32 _Coarsen( const Image::Image32 &fine );
+
+		/** This method adds the tiles of the levels of the mip-map pyramid, starting from the decoded image, to the texture cache.
+		*** The finest level is added first, so that the least recently used (finest) tiles are the first to be evicted. */
+		void _putTiles( const Image::Image32 &image ) const;
+
+		/** This method sets the dimensions of the levels of the mip-map pyramid, halving the resolution from one level to the next, and
+		*** registers the texture with the texture cache. */
+		void _setLevels( unsigned int width , unsigned int height );
+
+		/** This method sets the tile of the prescribed level and tile coordinates, after it was evicted from the texture cache.
+		*** The tiles of the finest level are cut from the image decoded again (adding the other tiles of the level to the cache as well),
+		*** and those of the coarser levels are box-filtered from the tiles of the finer level, as in _Coarsen. */
+		void _setTile( unsigned int l , unsigned int x , unsigned int y , TextureCache::Tile &tile ) const;
+
+		/** This method returns the bilinearly interpolated color of the prescribed level at the texture coordinates. */
+		Util::Point3D _bilinear( unsigned int l , Util::Point2D p ) const;
 	public:
+		/** Should textures be filtered over the footprints of the rays, by interpolating between the levels of the mip-map pyramid */
+		static bool MipMap;
+
+		/** This method returns the color of the texture at the texture coordinates, filtered over a footprint of the prescribed width (in texture coordinates).
+		*** Without mip-mapping, or if the footprint is smaller than a texel, the finest level is interpolated bilinearly. */
+		Util::Point3D sample( Util::Point2D p , double footprint ) const;
+
+		/** This method decodes the image, unless it has already been decoded at a sufficient resolution, given a lower bound on the footprints
+		*** of the rays sampling it (or zero if there is no bound). If mip-mapping never selects the finer levels of the pyramid, a JPEG image is
+		*** decoded at 1/2, 1/4, or 1/8 of its resolution, as only the coarser levels are needed.
+		*** Without mip-mapping, the image is decoded at full resolution when the texture is read. */
+		void load( double footprint );
+
+		/** This method returns the factor by which the resolution of the image was reduced when it was decoded (or zero if it has not been decoded). */
+		unsigned int scale( void ) const { return _scale; }
+
+		/** This static method lowers the bound on the footprints of the rays hitting a surface with the texture, given a box (in world coordinates)
+		*** containing the surface and an upper bound on its texel scale (see RayShapeIntersectionInfo::texelScale). */
+		static void BoundFootprints( std::unordered_map< const Texture * , double > &footprints , const Texture *texture , const Util::BoundingBox3D &bBox , Util::Point3D eye , double pixelAngle , double texelScale );
+
 		/** This method sets up the OpenGL texture */
 		void initOpenGL( void );
 	};
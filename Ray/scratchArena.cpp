@@ -0,0 +1,58 @@
+#include <algorithm>
+#include "scratchArena.h"
+#include "shape.h"
+
+using namespace Ray;
+
+//////////////////
+// ScratchArena //
+//////////////////
+const size_t ScratchArena::DefaultBlockSize;
+
+ScratchArena::ScratchArena( void ) : _block(0) , _offset(0) {}
+
+ScratchArena::~ScratchArena( void ){ for( size_t i=0 ; i<_blocks.size() ; i++ ) delete[] _blocks[i].data; }
+
+void ScratchArena::_addBlock( size_t size )
+{
+	RayTracingStats::IncrementScratchAllocationNum();
+	_Block block;
+	block.size = std::max< size_t >( size , DefaultBlockSize );
+	block.data = new char[ block.size ];
+	if( !_blocks.size() ) _blocks.push_back( block ) , _block = 0;
+	else _blocks.insert( _blocks.begin() + (++_block) , block );
+}
+
+ScratchArena::Mark ScratchArena::mark( void ) const
+{
+	Mark m;
+	m._block = _block , m._offset = _offset;
+	return m;
+}
+
+void ScratchArena::release( Mark mark ){ _block = mark._block , _offset = mark._offset; }
+
+void ScratchArena::reset( void ){ _block = _offset = 0; }
+
+void ScratchArena::reserve( size_t size )
+{
+	if( capacity()>=size ) return;
+	RayTracingStats::IncrementScratchAllocationNum();
+	_Block block;
+	block.size = std::max< size_t >( size - capacity() , DefaultBlockSize );
+	block.data = new char[ block.size ];
+	_blocks.push_back( block );
+}
+
+size_t ScratchArena::capacity( void ) const
+{
+	size_t size = 0;
+	for( size_t i=0 ; i<_blocks.size() ; i++ ) size += _blocks[i].size;
+	return size;
+}
+
+ScratchArena &ScratchArena::ThreadArena( void )
+{
+	static thread_local ScratchArena arena;
+	return arena;
+}
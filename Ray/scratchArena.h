@@ -0,0 +1,94 @@
+#ifndef SCRATCH_ARENA_INCLUDED
+#define SCRATCH_ARENA_INCLUDED
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+namespace Ray
+{
+	/** This class represents a bump allocator for the transient data used during traversal (e.g. bounding-box hit lists).
+	*** Memory is obtained in blocks that are retained when the arena is reset, so that once the arena has grown to the size of the
+	*** working set, tracing performs no further heap allocations. Every block the arena allocates (including those obtained through
+	*** reserve) is counted in RayTracingStats::ScratchAllocationNum. Allocations are released in LIFO order using mark/release. */
+	class ScratchArena
+	{
+		/** A contiguous block of memory */
+		struct _Block
+		{
+			char *data;
+			size_t size;
+		};
+
+		/** The blocks of memory owned by the arena */
+		std::vector< _Block > _blocks;
+
+		/** The index of the block currently being allocated from */
+		size_t _block;
+
+		/** The offset of the first free byte in the current block */
+		size_t _offset;
+
+		/** This method inserts a new block after the current one, of size at least the prescribed number of bytes. */
+		void _addBlock( size_t size );
+	public:
+		/** The default size (in bytes) of a block */
+		static const size_t DefaultBlockSize = 1<<16;
+
+		/** This class records the state of the arena so that subsequent allocations can be released. */
+		class Mark
+		{
+			friend class ScratchArena;
+			size_t _block , _offset;
+		};
+
+		/** The default constructor */
+		ScratchArena( void );
+
+		/** The destructor */
+		~ScratchArena( void );
+
+		/** This templated method returns uninitialized storage for the prescribed number of elements. */
+		template< typename T >
+		T *allocate( size_t count );
+
+		/** This method returns the current state of the arena. */
+		Mark mark( void ) const;
+
+		/** This method releases all allocations performed after the mark was obtained. */
+		void release( Mark mark );
+
+		/** This method releases all allocations, retaining the memory. */
+		void reset( void );
+
+		/** This method ensures that at least the prescribed number of bytes are available without allocating. */
+		void reserve( size_t size );
+
+		/** This method returns the total number of bytes owned by the arena. */
+		size_t capacity( void ) const;
+
+		/** This static method returns the arena associated with the calling thread. */
+		static ScratchArena &ThreadArena( void );
+	};
+
+	template< typename T >
+	T *ScratchArena::allocate( size_t count )
+	{
+		static_assert( std::is_trivially_destructible< T >::value , "[ERROR] Scratch arena only supports trivially destructible types" );
+		size_t size = sizeof(T) * count;
+		if( _blocks.size() )
+		{
+			size_t offset = ( _offset + alignof(T) - 1 ) & ~( alignof(T) - 1 );
+			if( offset + size<=_blocks[_block].size )
+			{
+				_offset = offset + size;
+				return ( T* )( _blocks[_block].data + offset );
+			}
+		}
+		// Move on to the next block, adding one if it does not exist or is too small
+		if( _blocks.size() && _block+1<_blocks.size() && _blocks[_block+1].size>=size ) _block++;
+		else _addBlock( size );
+		_offset = size;
+		return ( T* )_blocks[_block].data;
+	}
+}
+#endif // SCRATCH_ARENA_INCLUDED
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <Util/exceptions.h>
+#include "shadowCasters.h"
+#include "shapeList.h"
+#include "scene.h"
+#include "scratchArena.h"
+
+using namespace Ray;
+using namespace Util;
+
+///////////////////
+// ShadowCasters //
+///////////////////
+std::atomic< size_t > ShadowCasters::_Count( 0 );
+thread_local std::vector< ShadowCasters::_CacheEntry > ShadowCasters::_Cache;
+
+ShadowCasters::ShadowCasters( void ) : _root(-1) , _built(false) , _index( _Count++ ) , _generation(0) {}
+
+void ShadowCasters::set( const ShapeList &shapes , const std::function< bool ( const BoundingBox3D & ) > &overlaps )
+{
+	_nodes.clear() , _children.clear();
+	_root = _prune( &shapes , overlaps );
+	_generation = ++_Count;
+	_built = true;
+}
+
+unsigned int ShadowCasters::_addNode( unsigned int type , const Shape *shape , const Material *material , const BoundingBox3D &bBox , const std::vector< unsigned int > &children )
+{
+	_Node node;
+	node.type = type , node.shape = shape , node.material = material , node.bBox = bBox;
+	node.begin = (unsigned int)_children.size();
+	_children.insert( _children.end() , children.begin() , children.end() );
+	node.end = (unsigned int)_children.size();
+	_nodes.push_back( node );
+	return (unsigned int)_nodes.size()-1;
+}
+
+int ShadowCasters::_prune( const Shape *shape , const std::function< bool ( const BoundingBox3D & ) > &overlaps )
+{
+	if( shape->boundingBox().isEmpty() || !overlaps( shape->boundingBox() ) ) return -1;
+
+	std::vector< unsigned int > children;
+	BoundingBox3D bBox;
+	if( const TriangleList *triangleList = dynamic_cast< const TriangleList * >( shape ) )
+	{
+		// The triangles are intersected directly, taking their material from the list
+		for( size_t i=0 ; i<triangleList->_shapeList.shapes.size() ; i++ )
+		{
+			const Shape *triangle = triangleList->_shapeList.shapes[i];
+			if( triangle->boundingBox().isEmpty() || !overlaps( triangle->boundingBox() ) ) continue;
+			bBox = children.size() ? bBox + triangle->boundingBox() : triangle->boundingBox();
+			children.push_back( _addNode( _SHAPE , triangle , triangleList->_material , triangle->boundingBox() , std::vector< unsigned int >() ) );
+		}
+		return children.size() ? (int)_addNode( _NEAREST , shape , NULL , bBox , children ) : -1;
+	}
+	else if( const ShapeList *shapeList = dynamic_cast< const ShapeList * >( shape ) )
+	{
+		for( size_t i=0 ; i<shapeList->shapes.size() ; i++ )
+		{
+			int child = _prune( shapeList->shapes[i] , overlaps );
+			if( child<0 ) continue;
+			bBox = children.size() ? bBox + _nodes[child].bBox : _nodes[child].bBox;
+			children.push_back( (unsigned int)child );
+		}
+		return children.size() ? (int)_addNode( _LIST , shape , NULL , bBox , children ) : -1;
+	}
+	else return (int)_addNode( _SHAPE , shape , NULL , shape->boundingBox() , children );
+}
+
+double ShadowCasters::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range ) const
+{
+	RayTracingStats::IncrementRayNum();
+	if( _root<0 ) return Infinity;
+
+	// Test the last opaque occluder first, accepting the hit only if it is opaque, since a node that is not a primitive can mix
+	// materials and a transparent hit would let the caller skip nearer occluders
+	if( _index<_Cache.size() && _Cache[_index].generation==_generation )
+	{
+		const _Node &node = _nodes[ _Cache[_index].node ];
+		RayShapeIntersectionInfo _iInfo;
+		double t = node.shape->intersect( ray , _iInfo , range );
+		if( t<Infinity && node.material ) _iInfo.material = node.material;
+		bool opaque = t<Infinity && _Opaque( *_iInfo.material );
+		RayTracingStats::AddOccluderCacheTest( opaque );
+		if( opaque )
+		{
+			iInfo = _iInfo;
+			return t;
+		}
+	}
+
+	unsigned int hit;
+	double t = _intersect( (unsigned int)_root , ray , iInfo , range , hit );
+	if( t<Infinity && _Opaque( *iInfo.material ) )
+	{
+		if( _index>=_Cache.size() ) _Cache.resize( _index+1 , _CacheEntry{ 0 , 0 } );
+		_Cache[_index].generation = _generation , _Cache[_index].node = hit;
+	}
+	return t;
+}
+
+bool ShadowCasters::_Opaque( const Material &material )
+{
+	const Point3D &transparent = material.transparent;
+	return transparent[0]<=0 && transparent[1]<=0 && transparent[2]<=0;
+}
+
+double ShadowCasters::_intersect( unsigned int n , Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , unsigned int &hit ) const
+{
+	const _Node &node = _nodes[n];
+	switch( node.type )
+	{
+		case _SHAPE:
+		{
+			double t = node.shape->intersect( ray , iInfo , range );
+			if( t<Infinity )
+			{
+				if( node.material ) iInfo.material = node.material;
+				hit = n;
+			}
+			return t;
+		}
+		case _NEAREST:
+		{
+			// As in TriangleList::intersect: return the closest hit over all the children
+			RayShapeIntersectionInfo _iInfo;
+			double t = Infinity;
+			for( unsigned int i=node.begin ; i<node.end ; i++ )
+			{
+				double _t = _nodes[ _children[i] ].shape->intersect( ray , _iInfo , range );
+				if( _t<t ) t = _t , iInfo = _iInfo , iInfo.material = _nodes[ _children[i] ].material , hit = _children[i];
+			}
+			return t;
+		}
+		case _LIST:
+		{
+			// As in ShapeList::intersect: visit the children in the order in which their bounding boxes are hit, and return the first hit
+			if( node.bBox.intersect( ray ).isEmpty() ) return Infinity;
+
+			ScratchArena &arena = ScratchArena::ThreadArena();
+			ScratchArena::Mark mark = arena.mark();
+			_Hit *hits = arena.allocate< _Hit >( node.end - node.begin );
+			unsigned int hitNum = 0;
+			for( unsigned int i=node.begin ; i<node.end ; i++ )
+			{
+				BoundingBox1D _range = _nodes[ _children[i] ].bBox.intersect( ray );
+				if( !_range.isEmpty() ) hits[hitNum].t = _range[0][0] , hits[hitNum].node = _children[i] , hitNum++;
+			}
+			std::sort( hits , hits+hitNum , _Hit::Compare );
+			for( unsigned int i=0 ; i<hitNum ; i++ )
+			{
+				double t = _intersect( hits[i].node , ray , iInfo , range , hit );
+				if( t<Infinity )
+				{
+					arena.release( mark );
+					return t;
+				}
+			}
+			arena.release( mark );
+			return Infinity;
+		}
+		default: THROW( "unrecognized node type: %d" , node.type );
+	}
+	return Infinity;
+}
@@ -0,0 +1,120 @@
+#ifndef SHADOW_CASTERS_INCLUDED
+#define SHADOW_CASTERS_INCLUDED
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <Util/geometry.h>
+#include "shape.h"
+
+namespace Ray
+{
+	/** This class stores the part of the scene-graph that can cast shadows for a light source, and is built whenever the bounding boxes
+	*** of the scene-graph are updated.
+	*** The scene-graph is pruned against a region containing all the segments from the light to the points it can illuminate, and is
+	*** lowered into an array of nodes, in the manner of CompiledScene: shape lists are traversed in the order of their bounding-box hits
+	*** (as in ShapeList::intersect), triangle lists return the closest hit over their triangles (as in TriangleList::intersect), and all
+	*** other shapes are intersected directly. Since a pruned shape cannot be hit along such a segment, the intersections along the
+	*** segments are the same as with the full scene-graph.
+	*** As the traversal ends at a shape intersected in world coordinates, the shape that blocked a shadow ray is known.
+	*** Each thread remembers the last opaque occluder of each light, and tests it before traversing the nodes, so that neighboring
+	*** shadow rays that are blocked by the same shape are resolved with a single intersection. The hit of the remembered occluder is
+	*** only used if it is opaque (a node that is not a primitive can mix materials), and otherwise the nodes are traversed. */
+	class ShadowCasters
+	{
+		/** The types of nodes */
+		enum
+		{
+			_LIST ,
+			_NEAREST ,
+			_SHAPE
+		};
+
+		/** A node in the pruned scene-graph */
+		struct _Node
+		{
+			/** The type of the node */
+			unsigned int type;
+
+			/** The shape that is intersected (for _SHAPE nodes) */
+			const Shape *shape;
+
+			/** The material overriding the one set by the shape (for the triangles of a triangle list), or NULL */
+			const class Material *material;
+
+			/** The bounding box of the (remaining) shapes of the node */
+			ShapeBoundingBox bBox;
+
+			/** The range of the node's children within the array of children */
+			unsigned int begin , end;
+		};
+
+		/** A node whose bounding box is hit by the ray */
+		struct _Hit
+		{
+			double t;
+			unsigned int node;
+			static bool Compare( const _Hit &h1 , const _Hit &h2 ){ return h1.t<h2.t; }
+		};
+
+		/** The last opaque occluder of a light, as recorded by a thread */
+		struct _CacheEntry
+		{
+			/** The generation of the nodes when the occluder was recorded */
+			size_t generation;
+
+			/** The index of the occluding node */
+			unsigned int node;
+		};
+
+		/** The nodes, with children preceding their parents */
+		std::vector< _Node > _nodes;
+
+		/** The indices of the children of the nodes */
+		std::vector< unsigned int > _children;
+
+		/** The index of the root node (or -1 if no shape overlaps the region) */
+		int _root;
+
+		/** Has the scene-graph been pruned */
+		bool _built;
+
+		/** The index of the object, used to look up the last occluder */
+		size_t _index;
+
+		/** The generation of the nodes, which changes whenever the nodes are rebuilt */
+		size_t _generation;
+
+		/** The counter used to assign indices and generations */
+		static std::atomic< size_t > _Count;
+
+		/** The last occluders recorded by the calling thread, indexed by the object index */
+		static thread_local std::vector< _CacheEntry > _Cache;
+
+		/** This method adds the nodes for the pruned copy of the shape and returns the index of its node, or -1 if it does not overlap the region. */
+		int _prune( const Shape *shape , const std::function< bool ( const Util::BoundingBox3D & ) > &overlaps );
+
+		/** This method adds a node and returns its index. */
+		unsigned int _addNode( unsigned int type , const Shape *shape , const class Material *material , const Util::BoundingBox3D &bBox , const std::vector< unsigned int > &children );
+
+		/** This static method returns true if the material blocks all light. */
+		static bool _Opaque( const class Material &material );
+
+		/** This method ray-traces the sub-graph rooted at the prescribed node, setting the index of the _SHAPE node that was hit. */
+		double _intersect( unsigned int node , Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range , unsigned int &hit ) const;
+	public:
+		/** The default constructor */
+		ShadowCasters( void );
+
+		/** This method prunes the scene-graph, keeping the shapes whose bounding boxes overlap the region.
+		*** It should be called whenever the bounding boxes of the scene-graph are updated. */
+		void set( const class ShapeList &shapes , const std::function< bool ( const Util::BoundingBox3D & ) > &overlaps );
+
+		/** This method returns true if the scene-graph has been pruned. */
+		bool built( void ) const { return _built; }
+
+		/** This method ray-traces the pruned scene-graph along a shadow ray (with unit direction), testing the last opaque occluder first.
+		*** The ray is counted, as with Scene::intersect. */
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range ) const;
+	};
+}
+#endif // SHADOW_CASTERS_INCLUDED
@@ -1,4 +1,6 @@
 #include "shape.h"
+#include "rayPacket.h"
+#include "scene.h"
 
 using namespace Ray;
 using namespace Util;
@@ -12,6 +14,24 @@ BoundingBox1D ShapeBoundingBox::intersect( const Ray3D &ray ) const
 	return Util::BoundingBox3D::intersect( ray );
 }
 
+bool ShapeBoundingBox::overlaps( const Ray3D &ray , BoundingBox1D range ) const
+{
+	RayTracingStats::IncrementRayBoundingBoxIntersectionNum();
+	if( isEmpty() ) return false;
+	for( int d=0 ; d<3 ; d++ )
+	{
+		if( ray.direction[d]==0 )
+		{
+			if( ray.position[d]<(*this)[0][d] || ray.position[d]>(*this)[1][d] ) return false;
+			continue;
+		}
+		double t0 = ( (*this)[0][d] - ray.position[d] ) / ray.direction[d] , t1 = ( (*this)[1][d] - ray.position[d] ) / ray.direction[d];
+		if( t0>t1 ) std::swap( t0 , t1 );
+		range[0][0] = std::max( range[0][0] , t0 ) , range[1][0] = std::min( range[1][0] , t1 );
+	}
+	return range[0][0]<=range[1][0];
+}
+
 ///////////
 // Shape //
 ///////////
@@ -23,17 +43,108 @@ void Shape::WriteInset( std::ostream &stream ){ for( unsigned int i=0 ; i<WriteI
 
 ShapeBoundingBox Shape::boundingBox( void ) const { return _bBox; }
 
+void Shape::intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , BoundingBox1D range ) const
+{
+	for( unsigned int i=0 ; i<packet.size ; i++ ) if( mask & ( 1u<<i ) ) t[i] = intersect( packet.rays[i] , iInfo[i] , range );
+}
+
+const unsigned int Shape::DefaultMaxSpanNum;
+const unsigned int Shape::LargestMaxSpanNum;
+
+unsigned int Shape::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	unsigned int num = 0 , maxNum = maxSpanNum();
+	double t = range[0][0];
+	bool inside = isInside( ray( t ) );
+	if( inside ) spans[0].t[0] = t , spans[0].iInfo[0].material = NULL;
+
+	while( true )
+	{
+		// Cast a new ray from the last crossing, as shapes need only report the first intersection in front of the ray's origin
+		RayShapeIntersectionInfo iInfo;
+		double s = intersect( Ray3D( ray( t ) , ray.direction ) , iInfo , BoundingBox1D( Epsilon , range[1][0]-t ) );
+		if( !( s<Infinity ) ) break;
+		t += s;
+		if( inside ) spans[num].t[1] = t , spans[num].iInfo[1] = iInfo , num++;
+		else if( num<maxNum ) spans[num].t[0] = t , spans[num].iInfo[0] = iInfo;
+		else THROW( "%s has more than %u spans along the ray" , name().c_str() , maxNum );
+		inside = !inside;
+	}
+	if( inside ) spans[num].t[1] = range[1][0] , spans[num].iInfo[1].material = NULL , num++;
+	return num;
+}
+
 //////////////////////////
 // RayIntersectionStats //
 //////////////////////////
-size_t RayTracingStats::_RayNum = 0;
-size_t RayTracingStats::_RayPrimitiveIntersectionNum = 0;
-size_t RayTracingStats::_RayBoundingBoxIntersectionNum = 0;
-
-void RayTracingStats::Reset( void ){ _RayNum = _RayPrimitiveIntersectionNum = _RayBoundingBoxIntersectionNum = 0; }
-void RayTracingStats::IncrementRayNum( void ){ _RayNum++; }
-void RayTracingStats::IncrementRayPrimitiveIntersectionNum( void ){ _RayPrimitiveIntersectionNum++; }
-void RayTracingStats::IncrementRayBoundingBoxIntersectionNum( void ){ _RayBoundingBoxIntersectionNum++; }
-size_t RayTracingStats::RayNum( void ){ return _RayNum; }
-size_t RayTracingStats::RayPrimitiveIntersectionNum( void ){ return _RayPrimitiveIntersectionNum; }
-size_t RayTracingStats::RayBoundingBoxIntersectionNum( void ){ return _RayBoundingBoxIntersectionNum; }
+thread_local RayTracingStats::_Counts RayTracingStats::_Local = {};
+RayTracingStats::_Counts RayTracingStats::_Total = {};
+std::mutex RayTracingStats::_TotalMutex;
+
+RayTracingStats::_Counts &RayTracingStats::_Counts::operator += ( const _Counts &counts )
+{
+	rayNum += counts.rayNum;
+	rayPrimitiveIntersectionNum += counts.rayPrimitiveIntersectionNum;
+	rayBoundingBoxIntersectionNum += counts.rayBoundingBoxIntersectionNum;
+	scratchAllocationNum += counts.scratchAllocationNum;
+	primaryRayNum += counts.primaryRayNum;
+	secondaryRayNum += counts.secondaryRayNum;
+	lightSelectionNum += counts.lightSelectionNum;
+	selectedLightNum += counts.selectedLightNum;
+	culledLightNum += counts.culledLightNum;
+	culledLightError += counts.culledLightError;
+	occluderCacheTestNum += counts.occluderCacheTestNum;
+	occluderCacheHitNum += counts.occluderCacheHitNum;
+	areaLightShadingNum += counts.areaLightShadingNum;
+	areaLightSampleNum += counts.areaLightSampleNum;
+	areaLightPenumbraNum += counts.areaLightPenumbraNum;
+	textureTileHitNum += counts.textureTileHitNum;
+	textureTileMissNum += counts.textureTileMissNum;
+	textureTileEvictionNum += counts.textureTileEvictionNum;
+	primaryRayTime += counts.primaryRayTime;
+	secondaryRayTime += counts.secondaryRayTime;
+	return *this;
+}
+
+void RayTracingStats::Reset( void )
+{
+	std::lock_guard< std::mutex > lock( _TotalMutex );
+	_Total = _Local = _Counts();
+}
+void RayTracingStats::Merge( void )
+{
+	std::lock_guard< std::mutex > lock( _TotalMutex );
+	_Total += _Local;
+	_Local = _Counts();
+}
+void RayTracingStats::IncrementRayNum( void ){ _Local.rayNum++; }
+void RayTracingStats::IncrementRayPrimitiveIntersectionNum( void ){ _Local.rayPrimitiveIntersectionNum++; }
+void RayTracingStats::IncrementRayBoundingBoxIntersectionNum( void ){ _Local.rayBoundingBoxIntersectionNum++; }
+void RayTracingStats::IncrementScratchAllocationNum( void ){ _Local.scratchAllocationNum++; }
+void RayTracingStats::AddPrimaryRays( size_t rayNum , double time ){ _Local.primaryRayNum += rayNum , _Local.primaryRayTime += time; }
+void RayTracingStats::AddSecondaryRays( size_t rayNum , double time ){ _Local.secondaryRayNum += rayNum , _Local.secondaryRayTime += time; }
+void RayTracingStats::AddLightSelection( size_t selectedLightNum , size_t culledLightNum , double culledLightError ){ _Local.lightSelectionNum++ , _Local.selectedLightNum += selectedLightNum , _Local.culledLightNum += culledLightNum , _Local.culledLightError += culledLightError; }
+void RayTracingStats::AddOccluderCacheTest( bool hit ){ _Local.occluderCacheTestNum++ , _Local.occluderCacheHitNum += hit ? 1 : 0; }
+void RayTracingStats::AddAreaLightSamples( size_t sampleNum , bool penumbra ){ _Local.areaLightShadingNum++ , _Local.areaLightSampleNum += sampleNum , _Local.areaLightPenumbraNum += penumbra ? 1 : 0; }
+void RayTracingStats::AddTextureTileLookup( bool hit ){ if( hit ) _Local.textureTileHitNum++; else _Local.textureTileMissNum++; }
+void RayTracingStats::AddTextureTileEvictions( size_t evictionNum ){ _Local.textureTileEvictionNum += evictionNum; }
+size_t RayTracingStats::RayNum( void ){ return _Total.rayNum + _Local.rayNum; }
+size_t RayTracingStats::RayPrimitiveIntersectionNum( void ){ return _Total.rayPrimitiveIntersectionNum + _Local.rayPrimitiveIntersectionNum; }
+size_t RayTracingStats::RayBoundingBoxIntersectionNum( void ){ return _Total.rayBoundingBoxIntersectionNum + _Local.rayBoundingBoxIntersectionNum; }
+size_t RayTracingStats::ScratchAllocationNum( void ){ return _Total.scratchAllocationNum + _Local.scratchAllocationNum; }
+size_t RayTracingStats::PrimaryRayNum( void ){ return _Total.primaryRayNum + _Local.primaryRayNum; }
+double RayTracingStats::PrimaryRayTime( void ){ return _Total.primaryRayTime + _Local.primaryRayTime; }
+size_t RayTracingStats::SecondaryRayNum( void ){ return _Total.secondaryRayNum + _Local.secondaryRayNum; }
+double RayTracingStats::SecondaryRayTime( void ){ return _Total.secondaryRayTime + _Local.secondaryRayTime; }
+size_t RayTracingStats::LightSelectionNum( void ){ return _Total.lightSelectionNum + _Local.lightSelectionNum; }
+size_t RayTracingStats::SelectedLightNum( void ){ return _Total.selectedLightNum + _Local.selectedLightNum; }
+size_t RayTracingStats::CulledLightNum( void ){ return _Total.culledLightNum + _Local.culledLightNum; }
+double RayTracingStats::CulledLightError( void ){ return _Total.culledLightError + _Local.culledLightError; }
+size_t RayTracingStats::OccluderCacheTestNum( void ){ return _Total.occluderCacheTestNum + _Local.occluderCacheTestNum; }
+size_t RayTracingStats::OccluderCacheHitNum( void ){ return _Total.occluderCacheHitNum + _Local.occluderCacheHitNum; }
+size_t RayTracingStats::AreaLightShadingNum( void ){ return _Total.areaLightShadingNum + _Local.areaLightShadingNum; }
+size_t RayTracingStats::AreaLightSampleNum( void ){ return _Total.areaLightSampleNum + _Local.areaLightSampleNum; }
+size_t RayTracingStats::AreaLightPenumbraNum( void ){ return _Total.areaLightPenumbraNum + _Local.areaLightPenumbraNum; }
+size_t RayTracingStats::TextureTileHitNum( void ){ return _Total.textureTileHitNum + _Local.textureTileHitNum; }
+size_t RayTracingStats::TextureTileMissNum( void ){ return _Total.textureTileMissNum + _Local.textureTileMissNum; }
+size_t RayTracingStats::TextureTileEvictionNum( void ){ return _Total.textureTileEvictionNum + _Local.textureTileEvictionNum; }
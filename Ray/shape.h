@@ -1,9 +1,11 @@
 #ifndef SHAPE_INCLUDED
 #define SHAPE_INCLUDED
 #include <vector>
+#include <unordered_map>
 #include <stdexcept>
 #include <string>
-#include <functional>
+#include <type_traits>
+#include <mutex>
 #include <Util/geometry.h>
 #include <Util/factory.h>
 #include <GL/glew.h>
@@ -51,21 +53,92 @@ inline void AssertOpenGLState( const char *functionName )
 
 namespace Ray
 {
-	/** This class stores information about the number of rays cast and the number of ray-primitive intersections performed. */
+	class RayPacket;
+
+	/** This class stores information about the number of rays cast and the number of ray-primitive intersections performed.
+	*** It also records the number of primary (and batched secondary) rays and the time spent intersecting them, from which the ray throughput is obtained,
+	*** and the numbers of lights that were evaluated and culled at shading points, together with the bound on the error due to culling.
+	*** It also records the number of times the last occluder of a light was tested before tracing a shadow ray, and how often it blocked the ray,
+	*** as well as the number of shadow rays traced to area lights, and how often the shading points were found to be in the penumbra,
+	*** and the number of texture tiles found in, added to, and evicted from the texture cache.
+	*** The counts are accumulated per thread, so that tracing threads do not contend for them, and are merged into the totals when a thread calls Merge.
+	*** The reported values are the totals plus the counts of the calling thread. */
 	struct RayTracingStats
 	{
-		static size_t _RayNum;
-		static size_t _RayPrimitiveIntersectionNum;
-		static size_t _RayBoundingBoxIntersectionNum;
+		struct _Counts
+		{
+			size_t rayNum , rayPrimitiveIntersectionNum , rayBoundingBoxIntersectionNum , scratchAllocationNum , primaryRayNum , secondaryRayNum , lightSelectionNum , selectedLightNum , culledLightNum , occluderCacheTestNum , occluderCacheHitNum , areaLightShadingNum , areaLightSampleNum , areaLightPenumbraNum , textureTileHitNum , textureTileMissNum , textureTileEvictionNum;
+			double primaryRayTime , secondaryRayTime , culledLightError;
+			_Counts &operator += ( const _Counts &counts );
+		};
+		static thread_local _Counts _Local;
+		static _Counts _Total;
+		static std::mutex _TotalMutex;
 	public:
 
 		static void Reset( void );
+		static void Merge( void );
 		static void IncrementRayNum( void );
 		static void IncrementRayPrimitiveIntersectionNum( void );
 		static void IncrementRayBoundingBoxIntersectionNum( void );
+		static void IncrementScratchAllocationNum( void );
+		static void AddPrimaryRays( size_t rayNum , double time );
+		static void AddSecondaryRays( size_t rayNum , double time );
+		static void AddLightSelection( size_t selectedLightNum , size_t culledLightNum , double culledLightError );
+		static void AddOccluderCacheTest( bool hit );
+		static void AddAreaLightSamples( size_t sampleNum , bool penumbra );
+		static void AddTextureTileLookup( bool hit );
+		static void AddTextureTileEvictions( size_t evictionNum );
 		static size_t RayNum( void );
 		static size_t RayPrimitiveIntersectionNum( void );
 		static size_t RayBoundingBoxIntersectionNum( void );
+		static size_t ScratchAllocationNum( void );
+		static size_t PrimaryRayNum( void );
+		static double PrimaryRayTime( void );
+		static size_t SecondaryRayNum( void );
+		static double SecondaryRayTime( void );
+		static size_t LightSelectionNum( void );
+		static size_t SelectedLightNum( void );
+		static size_t CulledLightNum( void );
+		static double CulledLightError( void );
+		static size_t OccluderCacheTestNum( void );
+		static size_t OccluderCacheHitNum( void );
+		static size_t AreaLightShadingNum( void );
+		static size_t AreaLightSampleNum( void );
+		static size_t AreaLightPenumbraNum( void );
+		static size_t TextureTileHitNum( void );
+		static size_t TextureTileMissNum( void );
+		static size_t TextureTileEvictionNum( void );
+	};
+
+	/** This class represents a light-weight, non-owning reference to a predicate on the ray parameter, used to reject intersections.
+	*** It stores a pointer to the predicate and a pointer to a function invoking it, so it can be passed by value without allocation.
+	*** The referenced predicate must outlive the object, which is the case when a lambda is passed directly as an argument to Shape::intersect.
+	*** A default-constructed object represents the trivial predicate that accepts all values and is evaluated without an indirect call. */
+	class ValidityFunction
+	{
+		/** The predicate being referenced */
+		const void *_predicate;
+
+		/** The function invoking the predicate (or NULL if the predicate is trivial) */
+		bool (*_evaluate)( const void * , double );
+
+		/** This static method casts the predicate back to its type and invokes it. */
+		template< typename Predicate >
+		static bool _Evaluate( const void *predicate , double t ){ return ( *( const Predicate * )predicate )( t ); }
+	public:
+		/** The default constructor generates the trivial predicate */
+		ValidityFunction( void ) : _predicate(NULL) , _evaluate(NULL) {}
+
+		/** This constructor references the prescribed predicate, which must be callable as bool( double ). */
+		template< typename Predicate , typename = typename std::enable_if< !std::is_same< typename std::decay< Predicate >::type , ValidityFunction >::value >::type >
+		ValidityFunction( const Predicate &predicate ) : _predicate( &predicate ) , _evaluate( _Evaluate< Predicate > ) {}
+
+		/** This method returns true if the predicate accepts all values. */
+		bool trivial( void ) const { return _evaluate==NULL; }
+
+		/** This method evaluates the predicate. */
+		bool operator()( double t ) const { return !_evaluate || _evaluate( _predicate , t ); }
 	};
 
 	/** This class serves as a wrapper for Util::BoundingBox3D, calling RayTracingStats::IncrementRayBoundingBoxIntersectionNum before performing the intersection. */
@@ -77,6 +150,24 @@ namespace Ray
 		ShapeBoundingBox &operator = ( const ShapeBoundingBox &bBox ){ Util::BoundingBox3D::operator = ( bBox ) ; return *this; }
 		ShapeBoundingBox &operator = ( const Util::BoundingBox3D &bBox ){ Util::BoundingBox3D::operator = ( bBox ) ; return *this; }
 		Util::BoundingBox1D intersect( const Util::Ray3D &ray ) const;
+
+		/** This method returns true if the ray passes through the box within the prescribed range.
+		*** Axes along which the ray does not move are tested for containment, so that no infinite values are generated. */
+		bool overlaps( const Util::Ray3D &ray , Util::BoundingBox1D range ) const;
+	};
+
+	/** This class describes a node of the scene-graph whose placement can change with the key-frame values */
+	class AnimatedNode
+	{
+	public:
+		/** The bounding box of the node, in world coordinates */
+		Util::BoundingBox3D bBox;
+
+		/** The transformation taking the node's shape to world coordinates */
+		Util::Matrix4D toWorld;
+
+		/** Is the node transformed by the key-frame values (rather than containing such a node) */
+		bool keyFramed;
 	};
 
 	/** This is the abstract class that all ray-traceable objects must implement. */
@@ -126,8 +217,28 @@ namespace Ray
 		*** It should return the first value, t, within the prescribed range for which the validity lambda is true.
 		*** If a valid intersection is found, it is returned and the intersection information is set.
 		*** Otherwise a value of Infinity is returned.
-		*** By default, the range is assumed to be (Epsilon,Infinity) and the validity function is a trivial function that returns true. */
-		virtual double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityLambda = [] ( double t ){ return true; } ) const = 0;
+		*** By default, the range is assumed to be (Epsilon,Infinity) and the validity function is the trivial function that returns true. */
+		virtual double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityLambda = ValidityFunction() ) const = 0;
+
+		/** This method computes the intersections of the shape with the rays of the packet whose bits are set in the mask.
+		*** For each such ray, the value that intersect would return is written into t[] and, if it is finite, the intersection information is written into iInfo[].
+		*** The default implementation falls back to intersecting the rays one at a time. */
+		virtual void intersectPacket( const RayPacket &packet , unsigned int mask , class RayShapeIntersectionInfo iInfo[] , double t[] , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) ) const;
+
+		/** This method computes the intervals, within the prescribed range, over which the ray is inside the shape.
+		*** The spans are written into the array, which must have room for maxSpanNum() entries, in increasing order and without overlap, and their number is returned.
+		*** The default implementation walks along the ray from the start of the range, toggling between inside and outside at each intersection,
+		*** with the initial state given by isInside. It requires one intersection per crossing and throws if there are more than maxSpanNum() spans. */
+		virtual unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+
+		/** This method returns an upper bound on the number of spans that a ray can have with the shape. */
+		virtual unsigned int maxSpanNum( void ) const { return DefaultMaxSpanNum; }
+
+		/** The default bound on the number of spans, for shapes that do not provide a tighter (or larger) one */
+		static const unsigned int DefaultMaxSpanNum = 8;
+
+		/** The largest bound on the number of spans, for shapes whose bound grows with their size (as every CSG query reserves room for that many spans) */
+		static const unsigned int LargestMaxSpanNum = 64;
 
 		/** This method determines if a point is inside a shape.
 		*** It is assumed that if the shape is not water-tight, the method returns false. */
@@ -139,8 +250,26 @@ namespace Ray
 		/** This method adds a triangle to the list of triangles (if the object is of type RayTriangle). */
 		virtual void addTrianglesOpenGL( std::vector< class TriangleIndex > &triangles ) {}
 
+		/** This method lowers, for each texture on the shape, the bound on the footprints (in texture coordinates) of the rays hitting it,
+		*** with the footprints growing by the pixel angle per unit of distance from the eye, and with the matrix taking the shape to world coordinates.
+		*** A bound of zero indicates that the footprints cannot be bounded. Shapes without texture coordinates need not implement the method. */
+		virtual void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const {}
+
+		/** This method appends the nodes of the scene-graph rooted at the Shape that are transformed by the key-frame values, together with the
+		*** nodes containing them, in the order in which the scene-graph is traversed, with the matrix taking the shape to world coordinates.
+		*** Since the key-frame values can only move shapes through such nodes, comparing the appended nodes across frames determines the
+		*** parts of the scene that have moved. Shapes without children need not implement the method. */
+		virtual void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const {}
+
 		/** This method returns the count of basic shapes contained within the Shape. */
 		virtual size_t primitiveNum( void ) const = 0;
+
+		/** This method returns the depth of the scene-graph rooted at the Shape. */
+		virtual size_t depth( void ) const { return 1; }
+
+		/** This method simplifies the scene-graph rooted at the Shape and returns the shape that should replace it in its parent.
+		*** It should be called (once) after the scene-graph has been initialized. */
+		virtual Shape *flatten( void ){ return this; }
 	};
 
 	/** This operator writes the shape out to a stream. */
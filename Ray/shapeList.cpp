@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <Util/exceptions.h>
+#include <Util/morton.h>
 #include "triangle.h"
 #include "shapeList.h"
 #include "scene.h"
+#include "rayPacket.h"
+#include "scratchArena.h"
 
 using namespace std;
 using namespace Ray;
@@ -16,6 +20,39 @@ void AffineShape::initOpenGL( void ){ _shape->initOpenGL(); }
 
 size_t AffineShape::primitiveNum( void ) const { return _shape->primitiveNum(); }
 
+unsigned int AffineShape::maxSpanNum( void ) const { return _shape->maxSpanNum(); }
+
+size_t AffineShape::depth( void ) const { return _shape->depth()+1; }
+
+void AffineShape::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const{ _shape->boundTextureFootprints( toWorld * getMatrix() , eye , pixelAngle , footprints ); }
+
+void AffineShape::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const
+{
+	size_t nodeNum = nodes.size();
+	_shape->addAnimatedNodes( toWorld * getMatrix() , nodes );
+	if( nodes.size()>nodeNum ) nodes.push_back( AnimatedNode{ toWorld * boundingBox() , toWorld , false } );
+}
+
+void AffineShape::intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , BoundingBox1D range ) const
+{
+	Matrix4D Mi = getInverseMatrix();
+	Matrix4D M = getMatrix();
+	Matrix4D Mn = getNormalMatrix();
+
+	_shape->intersectPacket( packet.transform( Mi ) , mask , iInfo , t , range );
+	for( unsigned int i=0 ; i<packet.size ; i++ ) if( ( mask & ( 1u<<i ) ) && t[i]<Infinity )
+	{
+		iInfo[i].position = M * iInfo[i].position;
+		iInfo[i].normal = ( Mn * iInfo[i].normal ).unit();
+	}
+}
+
+Shape *AffineShape::flatten( void )
+{
+	_shape = _shape->flatten();
+	return this;
+}
+
 
 ///////////////////////
 // StaticAffineShape //
@@ -36,7 +73,6 @@ void StaticAffineShape::_write( std::ostream &stream ) const
 void StaticAffineShape::_read( std::istream &stream )
 {
 	if( !( stream >> _localTransform ) ) THROW( "Failed to parse %s" , Directive().c_str() );
-	if( _shape ) delete _shape;
 	_shape = ReadShape( stream , ShapeList::ShapeFactories );
 }
 
@@ -49,6 +85,24 @@ void StaticAffineShape::init( const LocalSceneData &data )
 
 void StaticAffineShape::initOpenGL( void ){ _shape->initOpenGL(); }
 
+Shape *StaticAffineShape::flatten( void )
+{
+	_shape = _shape->flatten();
+
+	// Compose with a directly nested static transformation (whose own chain has already been composed)
+	if( StaticAffineShape *child = dynamic_cast< StaticAffineShape * >( _shape ) )
+	{
+		_localTransform = _localTransform * child->_localTransform;
+		_shape = child->_shape;
+		_inverseTransform = _localTransform.inverse();
+		_normalTransform = _localTransform.inverse().transpose();
+	}
+
+	// Drop the node if it does not transform its child
+	if( Matrix4D::SquareDistance( _localTransform , Matrix4D::Identity() )==0 ) return _shape;
+	else return this;
+}
+
 Matrix4D StaticAffineShape::getMatrix( void ) const { return _localTransform; }
 
 Matrix4D StaticAffineShape::getInverseMatrix( void ) const { return _inverseTransform; }
@@ -58,7 +112,7 @@ Matrix3D StaticAffineShape::getNormalMatrix( void ) const{ return _normalTransfo
 ////////////////////////
 // DynamicAffineShape //
 ////////////////////////
-DynamicAffineShape::DynamicAffineShape( void ) : AffineShape() , _matrix(NULL) {}
+DynamicAffineShape::DynamicAffineShape( void ) : AffineShape() , _matrix(NULL) , _keyFrameMatrices(NULL) , _epoch(0) {}
 
 void DynamicAffineShape::_write( std::ostream &stream ) const
 {
@@ -72,22 +126,46 @@ void DynamicAffineShape::_write( std::ostream &stream ) const
 void DynamicAffineShape::_read( std::istream &stream )
 {
 	if( !( stream >> _paramName ) ) THROW( "Failed to parse %s" , Directive().c_str() );
-	if( _shape ) delete _shape;
 	_shape = ReadShape( stream , ShapeList::ShapeFactories );
 }
 
 void DynamicAffineShape::init( const LocalSceneData &data )
 {
 	if( !data.keyFrameFile ) THROW( "no key-frame file" );
-	_matrix = &data.keyFrameFile->keyFrameMatrices.current( _paramName );
+	_keyFrameMatrices = &data.keyFrameFile->keyFrameMatrices;
+	_matrix = &_keyFrameMatrices->current( _paramName );
+	_epoch = _keyFrameMatrices->epoch()-1;
+	_updateTransforms();
 	_shape->init( data );
 }
 
+void DynamicAffineShape::_updateTransforms( void ) const
+{
+	if( _epoch==_keyFrameMatrices->epoch() ) return;
+	_inverseTransform = _matrix->inverse();
+	_normalTransform = _inverseTransform.transpose();
+	_epoch = _keyFrameMatrices->epoch();
+}
+
+void DynamicAffineShape::updateBoundingBox( void )
+{
+	// Refresh the cached transformations once per frame, before any rays are traced
+	_updateTransforms();
+	AffineShape::updateBoundingBox();
+}
+
+void DynamicAffineShape::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const
+{
+	// The node moves even if its bounding box does not change, so its transformation is recorded as well
+	_shape->addAnimatedNodes( toWorld * getMatrix() , nodes );
+	nodes.push_back( AnimatedNode{ toWorld * boundingBox() , toWorld * getMatrix() , true } );
+}
+
 Matrix4D DynamicAffineShape::getMatrix( void ) const { return *_matrix; }
 
-Matrix4D DynamicAffineShape::getInverseMatrix( void ) const { return getMatrix().inverse(); }
+Matrix4D DynamicAffineShape::getInverseMatrix( void ) const { _updateTransforms() ; return _inverseTransform; }
 
-Matrix3D DynamicAffineShape::getNormalMatrix( void ) const { return getMatrix().inverse().transpose(); }
+Matrix3D DynamicAffineShape::getNormalMatrix( void ) const { _updateTransforms() ; return _normalTransform; }
 
 ////////////////
 // Difference //
@@ -142,6 +220,31 @@ void Difference::drawOpenGL( GLSLProgram *glslProgram ) const
 
 size_t Difference::primitiveNum( void ) const { return _shape0->primitiveNum() + _shape1->primitiveNum(); }
 
+unsigned int Difference::maxSpanNum( void ) const { return _shape0->maxSpanNum() + _shape1->maxSpanNum(); }
+
+size_t Difference::depth( void ) const { return std::max< size_t >( _shape0->depth() , _shape1->depth() ) + 1; }
+
+void Difference::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const
+{
+	_shape0->boundTextureFootprints( toWorld , eye , pixelAngle , footprints );
+	_shape1->boundTextureFootprints( toWorld , eye , pixelAngle , footprints );
+}
+
+void Difference::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const
+{
+	size_t nodeNum = nodes.size();
+	_shape0->addAnimatedNodes( toWorld , nodes );
+	_shape1->addAnimatedNodes( toWorld , nodes );
+	if( nodes.size()>nodeNum ) nodes.push_back( AnimatedNode{ toWorld * boundingBox() , toWorld , false } );
+}
+
+Shape *Difference::flatten( void )
+{
+	_shape0 = _shape0->flatten();
+	_shape1 = _shape1->flatten();
+	return this;
+}
+
 
 /////////////////////////
 // ShapeBoundingBoxHit //
@@ -191,6 +294,18 @@ void ShapeList::addTrianglesOpenGL( std::vector< TriangleIndex >& triangles )
 	for( int i=0 ; i<shapes.size() ; i++ ) shapes[i]->addTrianglesOpenGL( triangles );
 }
 
+void ShapeList::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const
+{
+	for( int i=0 ; i<shapes.size() ; i++ ) shapes[i]->boundTextureFootprints( toWorld , eye , pixelAngle , footprints );
+}
+
+void ShapeList::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const
+{
+	size_t nodeNum = nodes.size();
+	for( int i=0 ; i<shapes.size() ; i++ ) shapes[i]->addAnimatedNodes( toWorld , nodes );
+	if( nodes.size()>nodeNum ) nodes.push_back( AnimatedNode{ toWorld * boundingBox() , toWorld , false } );
+}
+
 size_t ShapeList::primitiveNum( void ) const
 {
 	size_t pNum = 0;
@@ -198,6 +313,128 @@ size_t ShapeList::primitiveNum( void ) const
 	return pNum;
 }
 
+void ShapeList::_setMaxSpanNum( void )
+{
+	_maxSpanNum = 0;
+	for( int i=0 ; i<shapes.size() ; i++ ) _maxSpanNum += shapes[i]->maxSpanNum();
+}
+
+unsigned int ShapeList::maxSpanNum( void ) const { return _maxSpanNum; }
+
+void ShapeList::intersectPacket( const RayPacket &packet , unsigned int mask , RayShapeIntersectionInfo iInfo[] , double t[] , BoundingBox1D range ) const
+{
+	for( unsigned int i=0 ; i<packet.size ; i++ ) if( mask & ( 1u<<i ) ) t[i] = Infinity;
+
+	// As with single rays, the directions are not normalized, so that the distances are those along the caller's rays
+	double entry[ RayPacket::MaxSize ];
+	mask = packet.intersect( _bBox , mask , entry );
+	if( !mask ) return;
+
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	ScratchArena::Mark mark = arena.mark();
+	unsigned int *childMasks = arena.allocate< unsigned int >( shapes.size() );
+	double *childEntries = arena.allocate< double >( shapes.size() * RayPacket::MaxSize );
+	double *keys = arena.allocate< double >( shapes.size() );
+	size_t *order = arena.allocate< size_t >( shapes.size() );
+	size_t hitNum = 0;
+
+	// Intersect the packet with the children's bounding boxes and order the children by the average entry value
+	for( size_t c=0 ; c<shapes.size() ; c++ )
+	{
+		ShapeBoundingBox bBox = shapes[c]->boundingBox();
+		childMasks[c] = bBox.isEmpty() ? 0 : packet.intersect( bBox , mask , childEntries + c*RayPacket::MaxSize );
+		if( !childMasks[c] ) continue;
+		double sum = 0;
+		int count = 0;
+		for( unsigned int i=0 ; i<packet.size ; i++ ) if( childMasks[c] & ( 1u<<i ) ) sum += childEntries[ c*RayPacket::MaxSize+i ] , count++;
+		keys[c] = sum / count;
+		order[ hitNum++ ] = c;
+	}
+	std::sort( order , order+hitNum , [&]( size_t c1 , size_t c2 ){ return keys[c1]<keys[c2]; } );
+
+	// The packet can only be traversed together if every ray encounters the children it hits in this (strict) order.
+	// Otherwise coherence has broken down and the rays are traced one at a time.
+	bool coherent = true;
+	for( unsigned int i=0 ; i<packet.size && coherent ; i++ ) if( mask & ( 1u<<i ) )
+	{
+		double last = -Infinity;
+		for( size_t k=0 ; k<hitNum && coherent ; k++ ) if( childMasks[ order[k] ] & ( 1u<<i ) )
+		{
+			double e = childEntries[ order[k]*RayPacket::MaxSize+i ];
+			if( !( e>last ) ) coherent = false;
+			last = e;
+		}
+	}
+
+	if( coherent )
+	{
+		// Each ray stops at the first child it hits
+		unsigned int pending = mask;
+		for( size_t k=0 ; k<hitNum && pending ; k++ )
+		{
+			unsigned int m = childMasks[ order[k] ] & pending;
+			if( !m ) continue;
+			shapes[ order[k] ]->intersectPacket( packet , m , iInfo , t , range );
+			for( unsigned int i=0 ; i<packet.size ; i++ ) if( ( m & ( 1u<<i ) ) && t[i]<Infinity ) pending &= ~( 1u<<i );
+		}
+	}
+	else for( unsigned int i=0 ; i<packet.size ; i++ ) if( mask & ( 1u<<i ) ) t[i] = intersect( packet.rays[i] , iInfo[i] , range );
+
+	arena.release( mark );
+}
+
+void ShapeList::spatiallyOrder( void )
+{
+	std::vector< Triangle * > triangles( shapes.size() );
+	for( size_t i=0 ; i<shapes.size() ; i++ ) if( !( triangles[i] = dynamic_cast< Triangle * >( shapes[i] ) ) ) return;
+	if( triangles.size()<2 ) return;
+
+	// Compute the Morton codes of the centroids, quantized to a 2^10 grid over their bounding box
+	std::vector< Point3D > centers( triangles.size() );
+	Point3D min , max;
+	for( size_t i=0 ; i<triangles.size() ; i++ )
+	{
+		centers[i] = triangles[i]->center();
+		for( int d=0 ; d<3 ; d++ )
+		{
+			if( !i || centers[i][d]<min[d] ) min[d] = centers[i][d];
+			if( !i || centers[i][d]>max[d] ) max[d] = centers[i][d];
+		}
+	}
+	std::vector< std::pair< unsigned int , size_t > > keys( triangles.size() );
+	for( size_t i=0 ; i<triangles.size() ; i++ )
+	{
+		unsigned int cell[3];
+		for( int d=0 ; d<3 ; d++ ) cell[d] = max[d]>min[d] ? (unsigned int)( ( centers[i][d]-min[d] ) / ( max[d]-min[d] ) * 1023 ) : 0;
+		keys[i] = std::make_pair( (unsigned int)MortonCode( cell[0] , cell[1] , cell[2] ) , i );
+	}
+	std::sort( keys.begin() , keys.end() );
+
+	// Assign the Triangles, in Morton order, to the (factory-owned) objects in address order
+	std::vector< Triangle > sorted;
+	sorted.reserve( triangles.size() );
+	for( size_t i=0 ; i<keys.size() ; i++ ) sorted.push_back( *triangles[ keys[i].second ] );
+	std::sort( triangles.begin() , triangles.end() );
+	for( size_t i=0 ; i<triangles.size() ; i++ ) *triangles[i] = sorted[i] , shapes[i] = triangles[i];
+}
+
+size_t ShapeList::depth( void ) const
+{
+	size_t d = 0;
+	for( int i=0 ; i<shapes.size() ; i++ ) d = std::max< size_t >( d , shapes[i]->depth() );
+	return d+1;
+}
+
+Shape *ShapeList::flatten( void )
+{
+	for( int i=0 ; i<shapes.size() ; i++ ) shapes[i] = shapes[i]->flatten();
+	_setMaxSpanNum();
+
+	// A list with a single child can be replaced by the child
+	if( shapes.size()==1 ) return shapes[0];
+	else return this;
+}
+
 
 //////////////////
 // TriangleList //
@@ -233,6 +470,21 @@ void TriangleList::addTrianglesOpenGL( std::vector< TriangleIndex > &triangles )
 
 size_t TriangleList::primitiveNum( void ) const { return _shapeList.primitiveNum(); }
 
+// Every crossing is a hit with a different triangle, and a span needs two crossings (except for those containing the ends of the range)
+unsigned int TriangleList::maxSpanNum( void ) const { return (unsigned int)std::min< size_t >( primitiveNum()/2 + 1 , LargestMaxSpanNum ); }
+
+size_t TriangleList::depth( void ) const { return _shapeList.depth()+1; }
+
+void TriangleList::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const
+{
+	if( !_material || !_material->tex ) return;
+
+	// The triangles take their material from the list, and the footprints on other children are left unbounded
+	for( size_t i=0 ; i<_shapeList.shapes.size() ; i++ )
+		if( const Triangle *triangle = dynamic_cast< const Triangle * >( _shapeList.shapes[i] ) ) triangle->boundTextureFootprint( _material->tex , toWorld , eye , pixelAngle , footprints );
+		else Texture::BoundFootprints( footprints , _material->tex , BoundingBox3D() , eye , pixelAngle , 0 );
+}
+
 ///////////
 // Union //
 ///////////
@@ -264,6 +516,21 @@ void Union::initOpenGL( void )
 
 size_t Union::primitiveNum( void ) const { return _shapeList.primitiveNum(); }
 
+unsigned int Union::maxSpanNum( void ) const { return _shapeList.maxSpanNum(); }
+
+size_t Union::depth( void ) const { return _shapeList.depth()+1; }
+
+void Union::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const{ _shapeList.boundTextureFootprints( toWorld , eye , pixelAngle , footprints ); }
+
+void Union::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const{ _shapeList.addAnimatedNodes( toWorld , nodes ); }
+
+Shape *Union::flatten( void )
+{
+	// Simplify the children but keep the list itself
+	_shapeList.flatten();
+	return this;
+}
+
 
 //////////////////
 // Intersection //
@@ -295,3 +562,18 @@ void Intersection::initOpenGL( void )
 }
 
 size_t Intersection::primitiveNum( void ) const { return _shapeList.primitiveNum(); }
+
+unsigned int Intersection::maxSpanNum( void ) const { return _shapeList.maxSpanNum(); }
+
+size_t Intersection::depth( void ) const { return _shapeList.depth()+1; }
+
+void Intersection::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const{ _shapeList.boundTextureFootprints( toWorld , eye , pixelAngle , footprints ); }
+
+void Intersection::addAnimatedNodes( const Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const{ _shapeList.addAnimatedNodes( toWorld , nodes ); }
+
+Shape *Intersection::flatten( void )
+{
+	// Simplify the children but keep the list itself
+	_shapeList.flatten();
+	return this;
+}
@@ -4,12 +4,14 @@
 #include <unordered_map>
 #include <Util/geometry.h>
 #include "shape.h"
+#include "keyFrames.h"
 
 namespace Ray
 {
 	/** This abstract class represents a Shape with an affine transformation associated to it */
 	class AffineShape : public Shape
 	{
+		friend class CompiledScene;
 	protected:
 		/** The shape to be transformed */
 		Shape *_shape;
@@ -32,10 +34,17 @@ namespace Ray
 	public:
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		void intersectPacket( const RayPacket &packet , unsigned int mask , class RayShapeIntersectionInfo iInfo[] , double t[] , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		virtual bool isInside( Util::Point3D p ) const;
 		virtual void drawOpenGL( GLSLProgram *glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
+		Shape *flatten( void );
 	};
 
 
@@ -70,6 +79,7 @@ namespace Ray
 		std::string name( void ) const { return "static affine"; }
 		void init( const class LocalSceneData &data );
 		void initOpenGL( void );
+		Shape *flatten( void );
 
 		/////////////////////////
 		// AffineShape methods //
@@ -88,6 +98,21 @@ namespace Ray
 
 		/** A pointer to the matrix storing the current transformation  */
 		const Util::Matrix4D *_matrix;
+
+		/** A pointer to the key-frame data storing the current transformation */
+		const KeyFrameMatrices *_keyFrameMatrices;
+
+		/** The epoch of the key-frame data at which the cached transformations were computed */
+		mutable unsigned int _epoch;
+
+		/** The cached inverse of the current transformation */
+		mutable Util::Matrix4D _inverseTransform;
+
+		/** The cached normal transformation associated to the current transformation */
+		mutable Util::Matrix3D _normalTransform;
+
+		/** This method recomputes the cached transformations if the key-frame values have changed since they were last computed. */
+		void _updateTransforms( void ) const;
 	public:
 
 		/** The default constructor */
@@ -105,6 +130,8 @@ namespace Ray
 	public:
 		std::string name( void ) const { return "dynamic affine"; }
 		void init( const class LocalSceneData &data );
+		void updateBoundingBox( void );
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 
 		/////////////////////////
 		// AffineShape methods //
@@ -115,7 +142,8 @@ namespace Ray
 		Util::Matrix3D getNormalMatrix( void ) const;
 	};
 
-	/** This class represents the difference of two shapes. */
+	/** This class represents the difference of two shapes.
+	*** The ray is intersected by subtracting the spans of the second shape from those of the first. */
 	class Difference : public Shape
 	{
 		/** The shapes whose differences we are representing */
@@ -139,10 +167,16 @@ namespace Ray
 		void init( const class LocalSceneData& data );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		bool isInside( Util::Point3D p ) const;
 		void drawOpenGL( GLSLProgram *glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
+		Shape *flatten( void );
 	};
 
 	/** This class can be used for sorting shapes based on the intersections of their bounding volumes with a given ray.*/
@@ -169,6 +203,12 @@ namespace Ray
 
 		/** This static method returns the directive header describing the shape. */
 		static std::string _DirectiveHeader( void ){ return "shape_list"; }
+
+		/** The sum of the maximum numbers of spans of the children */
+		unsigned int _maxSpanNum = 0;
+
+		/** This method sets the maximum number of spans from the children. */
+		void _setMaxSpanNum( void );
 	public:
 
 		/** The set of shape factoendDirectiveries */
@@ -180,6 +220,10 @@ namespace Ray
 		/** The shapes that are associated to the node */
 		std::vector< Shape* > shapes;
 
+		/** If all the children are Triangles, this method sorts them by the Morton codes of their centroids.
+		*** The Triangles are permuted in memory, as well as in the list, so that triangles that are close in space are also close in memory. */
+		void spatiallyOrder( void );
+
 		///////////////////
 		// Shape methods //
 		///////////////////
@@ -191,17 +235,26 @@ namespace Ray
 		void init( const class LocalSceneData &data );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		void intersectPacket( const RayPacket &packet , unsigned int mask , class RayShapeIntersectionInfo iInfo[] , double t[] , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		bool isInside( Util::Point3D p ) const;
 		void drawOpenGL( GLSLProgram * glslProgram ) const;
 		void addTrianglesOpenGL( std::vector< class TriangleIndex >& triangles );
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
+		Shape *flatten( void );
 	};
 
 	/** This class represents a node which stores a triangle list. It's children can only be Triangles or TrivialShapeLists.*/
 	class TriangleList : public Shape
 	{
 		friend class Scene;
+		friend class CompiledScene;
+		friend class ShadowCasters;
 
 		/** The OpenGL vertex buffer identifier */
 		GLuint _vertexBufferID = 0;
@@ -245,13 +298,17 @@ namespace Ray
 		void initOpenGL( void );
 		void updateBoundingBox( void );
 		bool isInside( Util::Point3D p ) const;
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
 		void drawOpenGL( GLSLProgram * glslProgram ) const;
 		void addTrianglesOpenGL( std::vector< TriangleIndex > &triangles );
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
 		size_t primitiveNum( void ) const;
+		unsigned int maxSpanNum( void ) const;
+		size_t depth( void ) const;
 	};
 
-	/** This class represents a node which stores the union of a set of shapes*/
+	/** This class represents a node which stores the union of a set of shapes.
+	*** The ray is intersected by merging the spans of the children, skipping those whose bounding boxes it misses. */
 	class Union : public Shape
 	{
 		/** The list of shapes */
@@ -272,13 +329,21 @@ namespace Ray
 		void initOpenGL( void );
 		void updateBoundingBox( void );
 		bool isInside( Util::Point3D p ) const;
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		void drawOpenGL( GLSLProgram * glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
+		Shape *flatten( void );
 	};
 
 
-	/** This class represents a node which stores the intersection of a set of shapes*/
+	/** This class represents a node which stores the intersection of a set of shapes.
+	*** The ray is intersected by intersecting the spans of the children, and its bounding box is the intersection of theirs,
+	*** so that the ray can be rejected as soon as it misses the bounding box of a child or has no spans with it. */
 	class Intersection : public Shape
 	{
 		/** The list of shapes */
@@ -300,9 +365,15 @@ namespace Ray
 		void initOpenGL( void );
 		void updateBoundingBox( void );
 		bool isInside( Util::Point3D p ) const;
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		unsigned int spans( Util::Ray3D ray , Util::BoundingBox1D range , class RaySpan *spans ) const;
+		unsigned int maxSpanNum( void ) const;
 		void drawOpenGL( GLSLProgram * glslProgram ) const;
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+		void addAnimatedNodes( const Util::Matrix4D &toWorld , std::vector< AnimatedNode > &nodes ) const;
 		size_t primitiveNum( void ) const;
+		size_t depth( void ) const;
+		Shape *flatten( void );
 	};
 }
 #endif // GROUP_INCLUDED
@@ -1,10 +1,80 @@
 #include <Util/exceptions.h>
 #include "shapeList.h"
 #include "triangle.h"
+#include "scene.h"
+#include "scratchArena.h"
 
 using namespace Ray;
 using namespace Util;
 
+///////////
+// Spans //
+///////////
+/** This function merges two lists of spans into the list of spans over which the Boolean operation, applied to the states of being inside the two lists, is true.
+*** The end-points are swept in increasing order, with coincident end-points processed together, and a span is opened or closed whenever the value of the operation changes.
+*** If flip is set, the normals of end-points taken from the second list are negated (as when the second list describes a shape that is subtracted). */
+template< typename BooleanOperation >
+static unsigned int MergeSpans( const RaySpan *spans0 , unsigned int num0 , const RaySpan *spans1 , unsigned int num1 , BooleanOperation op , bool flip , RaySpan *spans )
+{
+	unsigned int e0 = 0 , e1 = 0 , num = 0;
+	bool inside0 = false , inside1 = false , inside = false;
+	while( e0<2*num0 || e1<2*num1 )
+	{
+		// Get the next end-point (with the e-th end-point of a list being end-point e&1 of span e>>1)
+		double t;
+		if     ( e0==2*num0 ) t = spans1[e1>>1].t[e1&1];
+		else if( e1==2*num1 ) t = spans0[e0>>1].t[e0&1];
+		else t = std::min( spans0[e0>>1].t[e0&1] , spans1[e1>>1].t[e1&1] );
+
+		// Toggle the states of all end-points at that value, preferring the intersection information of an end-point that lies on a surface
+		const RayShapeIntersectionInfo *iInfo = NULL;
+		bool flipped = false;
+		for( ; e0<2*num0 && spans0[e0>>1].t[e0&1]==t ; e0++ )
+		{
+			const RayShapeIntersectionInfo &_iInfo = spans0[e0>>1].iInfo[e0&1];
+			if( !iInfo || ( !iInfo->material && _iInfo.material ) ) iInfo = &_iInfo , flipped = false;
+			inside0 = !inside0;
+		}
+		for( ; e1<2*num1 && spans1[e1>>1].t[e1&1]==t ; e1++ )
+		{
+			const RayShapeIntersectionInfo &_iInfo = spans1[e1>>1].iInfo[e1&1];
+			if( !iInfo || ( !iInfo->material && _iInfo.material ) ) iInfo = &_iInfo , flipped = flip;
+			inside1 = !inside1;
+		}
+
+		bool _inside = op( inside0 , inside1 );
+		if( _inside==inside ) continue;
+		int e = _inside ? 0 : 1;
+		spans[num].t[e] = t;
+		spans[num].iInfo[e] = *iInfo;
+		if( flipped ) spans[num].iInfo[e].normal = -iInfo->normal;
+		if( !_inside ) num++;
+		inside = _inside;
+	}
+	return num;
+}
+
+/** This function returns the first end-point of the shape's spans that lies on a surface and satisfies the validity function, and sets the intersection information.
+*** If there is no such end-point, Infinity is returned. */
+static double FirstSpanIntersection( const Shape &shape , Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda )
+{
+	if( !shape.boundingBox().overlaps( ray , range ) ) return Infinity;
+
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	ScratchArena::Mark mark = arena.mark();
+	RaySpan *spans = arena.allocate< RaySpan >( shape.maxSpanNum() );
+	unsigned int num = shape.spans( ray , range , spans );
+	for( unsigned int i=0 ; i<num ; i++ ) for( int e=0 ; e<2 ; e++ ) if( spans[i].iInfo[e].material && validityLambda( spans[i].t[e] ) )
+	{
+		iInfo = spans[i].iInfo[e];
+		double t = spans[i].t[e];
+		arena.release( mark );
+		return t;
+	}
+	arena.release( mark );
+	return Infinity;
+}
+
 ////////////////
 // Difference //
 ////////////////
@@ -13,16 +83,36 @@ void Difference::updateBoundingBox( void )
 	///////////////////////////////
 	// Set the _bBox object here //
 	///////////////////////////////
-	THROW( "method undefined" );
+	// The difference is contained in the first shape
+	_shape0->updateBoundingBox();
+	_shape1->updateBoundingBox();
+	_bBox = _shape0->boundingBox();
 }
 
-double Difference::intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Difference::intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	//////////////////////////////////////////////////////////////////
 	// Compute the intersection of the difference with the ray here //
 	//////////////////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return Infinity;
+	return FirstSpanIntersection( *this , ray , iInfo , range , validityLambda );
+}
+
+unsigned int Difference::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	unsigned int num = _shape0->spans( ray , range , spans );
+	if( !num || !_shape1->boundingBox().overlaps( ray , range ) ) return num;
+
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	ScratchArena::Mark mark = arena.mark();
+	RaySpan *spans1 = arena.allocate< RaySpan >( _shape1->maxSpanNum() ) , *merged = arena.allocate< RaySpan >( maxSpanNum() );
+	unsigned int num1 = _shape1->spans( ray , range , spans1 );
+	if( num1 )
+	{
+		num = MergeSpans( spans , num , spans1 , num1 , []( bool inside0 , bool inside1 ){ return inside0 && !inside1; } , true , merged );
+		std::copy( merged , merged+num , spans );
+	}
+	arena.release( mark );
+	return num;
 }
 
 bool Difference::isInside( Util::Point3D p ) const
@@ -30,14 +120,13 @@ bool Difference::isInside( Util::Point3D p ) const
 	//////////////////////////////////////////////////////////
 	// Determine if the point is inside the difference here //
 	//////////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return false;
+	return _shape0->isInside( p ) && !_shape1->isInside( p );
 }
 
 ///////////////
 // ShapeList //
 ///////////////
-double ShapeList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double ShapeList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	//////////////////////////////////////////////////////////////////
 	// Compute the intersection of the shape list with the ray here //
@@ -60,10 +149,9 @@ double ShapeList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , Bound
 	///////////////////////////////////////////////////////////////////////////////////////////////
 
 	////////////////////////////// version after acceleration //////////////////////////////////////
-	std::vector< ShapeBoundingBoxHit > all_hits;
+	// The ray is not normalized, so that the distances (and the range) are measured in the units of the caller's ray, whether or not
+	// the list was flattened away
 	double t, bbox_t, inter;
-	double ray_length = ray.direction.length();
-	ray.direction = ray.direction.unit();
 	int hit_counter = 0;
 	inter = Infinity;
 
@@ -71,6 +159,11 @@ double ShapeList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , Bound
 		return Infinity;
 	}
 
+	// the hit list lives in the per-thread scratch arena and is released before returning
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	ScratchArena::Mark mark = arena.mark();
+	ShapeBoundingBoxHit *all_hits = arena.allocate< ShapeBoundingBoxHit >( shapes.size() );
+
 	// hit all the bounding boxes and  store the hits
 	for(int i = 0; i < shapes.size();i++){
 		if(shapes[i]->boundingBox().isEmpty()){
@@ -82,26 +175,28 @@ double ShapeList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , Bound
 			ShapeBoundingBoxHit hit;
 			hit.t = bbox_t;
 			hit.shape = shapes[i];	
-			all_hits.push_back(hit);
-			hit_counter++;		
+			all_hits[hit_counter++] = hit;
 		}
 	}
 
 
 	if(hit_counter == 0){
+		arena.release(mark);
 		return Infinity;
 	}
 
 	// sort hits of bboxes
-	std::sort(all_hits.begin(),all_hits.end(),ShapeBoundingBoxHit::Compare);
+	std::sort(all_hits,all_hits+hit_counter,ShapeBoundingBoxHit::Compare);
 
 	// hit the shapes
 	for(int i = 0; i < hit_counter; i++){
 		double inter = all_hits[i].shape->intersect(ray,iInfo,range,validityLambda);
 		if(inter < Infinity){
+			arena.release(mark);
 			return inter;
 		}
 	}
+	arena.release(mark);
 	return Infinity;
 	///////////////////////////////////////////////////////////////////////////////////////////////
 }
@@ -111,14 +206,34 @@ bool ShapeList::isInside( Point3D p ) const
 	//////////////////////////////////////////////////////////
 	// Determine if the point is inside the shape list here //
 	//////////////////////////////////////////////////////////
-	THROW( "method undefined" );
+	for( int i=0 ; i<shapes.size() ; i++ ) if( shapes[i]->isInside( p ) ) return true;
 	return false;
 }
 
+unsigned int ShapeList::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	// The spans of the list are the union of the spans of its children
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	ScratchArena::Mark mark = arena.mark();
+	RaySpan *childSpans = arena.allocate< RaySpan >( _maxSpanNum ) , *merged = arena.allocate< RaySpan >( _maxSpanNum );
+	unsigned int num = 0;
+	for( int i=0 ; i<shapes.size() ; i++ ) if( shapes[i]->boundingBox().overlaps( ray , range ) )
+	{
+		unsigned int childNum = shapes[i]->spans( ray , range , childSpans );
+		if( !childNum ) continue;
+		num = MergeSpans( spans , num , childSpans , childNum , []( bool inside0 , bool inside1 ){ return inside0 || inside1; } , false , merged );
+		std::copy( merged , merged+num , spans );
+	}
+	arena.release( mark );
+	return num;
+}
+
 void ShapeList::init( const LocalSceneData &data )
 {
 	// Initialize the children
 	for( int i=0 ; i<shapes.size() ; i++ ) shapes[i]->init( data );
+	if( LocalSceneData::SpatialOrder ) spatiallyOrder();
+	_setMaxSpanNum();
 
 	///////////////////////////////////
 	// Do any additional set-up here //
@@ -169,7 +284,7 @@ void ShapeList::drawOpenGL( GLSLProgram * glslProgram ) const
 /////////////////
 // AffineShape //
 /////////////////
-double AffineShape::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double AffineShape::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	//////////////////////////////////////////////////////////////////////////////////////
 	// Compute the intersection of the difference with the affinely deformed shape here //
@@ -203,8 +318,22 @@ bool AffineShape::isInside( Point3D p ) const
 	///////////////////////////////////////////////////////////////////////
 	// Determine if the point is inside the affinely deformed shape here //
 	///////////////////////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return _shape->isInside( p );
+	return _shape->isInside( getInverseMatrix() * p );
+}
+
+unsigned int AffineShape::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	// The values along the ray are preserved by the transformation, so only the positions and normals need to be mapped back
+	unsigned int num = _shape->spans( getInverseMatrix() * ray , range , spans );
+	if( !num ) return 0;
+	Matrix4D M = getMatrix();
+	Matrix3D Mn = getNormalMatrix();
+	for( unsigned int i=0 ; i<num ; i++ ) for( int e=0 ; e<2 ; e++ ) if( spans[i].iInfo[e].material )
+	{
+		spans[i].iInfo[e].position = M * spans[i].iInfo[e].position;
+		spans[i].iInfo[e].normal = ( Mn * spans[i].iInfo[e].normal ).unit();
+	}
+	return num;
 }
 
 void AffineShape::updateBoundingBox( void )
@@ -234,7 +363,7 @@ void AffineShape::drawOpenGL( GLSLProgram * glslProgram ) const
 //////////////////
 // TriangleList //
 //////////////////
-double TriangleList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double TriangleList::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	////////////////////////////////////////////////////////////////////////////
 	// Compute the intersection of the difference with the triangle list here //
@@ -268,8 +397,8 @@ void TriangleList::drawOpenGL( GLSLProgram * glslProgram ) const
 void TriangleList::init( const LocalSceneData &data )
 {
 	// Set the vertex and material pointers
-	_vertices = &data.vertices[0];
-	_vNum = (unsigned int)data.vertices.size();
+	_vertices = data.vertices.size() ? &data.vertices[0] : NULL;
+	_vNum = (unsigned int)data.vertexNum();
 	if( _materialIndex>=data.materials.size() ) THROW( "shape specifies a material that is out of bounds: %d <= %d" , _materialIndex , (int)data.materials.size() );
 	else if( _materialIndex<0 ) THROW( "negative material index: %d" , _materialIndex );
 	else _material = &data.materials[ _materialIndex ];
@@ -298,15 +427,16 @@ void TriangleList::initOpenGL( void )
 ///////////
 // Union //
 ///////////
-double Union::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Union::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	/////////////////////////////////////////////////////////////
 	// Compute the intersection of the union with the ray here //
 	/////////////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return Infinity;
+	return FirstSpanIntersection( *this , ray , iInfo , range , validityLambda );
 }
 
+unsigned int Union::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const { return _shapeList.spans( ray , range , spans ); }
+
 void Union::init( const LocalSceneData &data )
 {
 	_shapeList.init( data );
@@ -322,7 +452,8 @@ void Union::updateBoundingBox( void )
 	///////////////////////////////
 	// Set the _bBox object here //
 	///////////////////////////////
-	THROW( "method undefined" );
+	_shapeList.updateBoundingBox();
+	_bBox = _shapeList.boundingBox();
 }
 
 bool Union::isInside( Point3D p ) const
@@ -330,19 +461,40 @@ bool Union::isInside( Point3D p ) const
 	/////////////////////////////////////////////////////
 	// Determine if the point is inside the union here //
 	/////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return false;
+	return _shapeList.isInside( p );
 }
 
 //////////////////
 // Intersection //
 //////////////////
-double Intersection::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Intersection::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Compute the intersection of the difference with the intersection of shapes here //
 	/////////////////////////////////////////////////////////////////////////////////////
-	THROW( "method undefined" );
+	return FirstSpanIntersection( *this , ray , iInfo , range , validityLambda );
+}
+
+unsigned int Intersection::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	const std::vector< Shape * > &shapes = _shapeList.shapes;
+	if( !shapes.size() ) return 0;
+
+	// The ray has no spans with the intersection as soon as it misses the bounding box of a child, or has no spans with it
+	for( int i=0 ; i<shapes.size() ; i++ ) if( !shapes[i]->boundingBox().overlaps( ray , range ) ) return 0;
+
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	ScratchArena::Mark mark = arena.mark();
+	RaySpan *childSpans = arena.allocate< RaySpan >( maxSpanNum() ) , *merged = arena.allocate< RaySpan >( maxSpanNum() );
+	unsigned int num = shapes[0]->spans( ray , range , spans );
+	for( int i=1 ; i<shapes.size() && num ; i++ )
+	{
+		unsigned int childNum = shapes[i]->spans( ray , range , childSpans );
+		num = MergeSpans( spans , num , childSpans , childNum , []( bool inside0 , bool inside1 ){ return inside0 && inside1; } , false , merged );
+		std::copy( merged , merged+num , spans );
+	}
+	arena.release( mark );
+	return num;
 }
 
 void Intersection::init( const LocalSceneData &data )
@@ -360,7 +512,11 @@ void Intersection::updateBoundingBox( void )
 	///////////////////////////////
 	// Set the _bBox object here //
 	///////////////////////////////
-	THROW( "method undefined" );
+	// The intersection is contained in the bounding box of every child
+	const std::vector< Shape * > &shapes = _shapeList.shapes;
+	_shapeList.updateBoundingBox();
+	_bBox = shapes.size() ? shapes[0]->boundingBox() : BoundingBox3D();
+	for( int i=1 ; i<shapes.size() ; i++ ) _bBox ^= shapes[i]->boundingBox();
 }
 
 bool Intersection::isInside( Point3D p ) const
@@ -368,6 +524,6 @@ bool Intersection::isInside( Point3D p ) const
 	///////////////////////////////////////////////////////////////////////
 	// Determine if the point is inside the instersection of shapes here //
 	///////////////////////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return false;
+	for( int i=0 ; i<_shapeList.shapes.size() ; i++ ) if( !_shapeList.shapes[i]->isInside( p ) ) return false;
+	return _shapeList.shapes.size()>0;
 }
\ No newline at end of file
@@ -23,3 +23,5 @@ void Sphere::_write( std::ostream &stream ) const
 }
 
 size_t Sphere::primitiveNum( void ) const { return 1; }
+
+unsigned int Sphere::maxSpanNum( void ) const { return 1; }
@@ -47,7 +47,7 @@ void Sphere::initOpenGL( void )
 	ASSERT_OPEN_GL_STATE();	
 }
 
-double Sphere::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Sphere::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
 
@@ -101,13 +101,41 @@ double Sphere::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , Bounding
 
 }
 
+unsigned int Sphere::spans( Ray3D ray , BoundingBox1D range , RaySpan *spans ) const
+{
+	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
+
+	// The ray is inside the sphere between the two roots of the quadratic
+	Point3D p = ray.position - center;
+	double a = ray.direction.squareNorm() , b = ray.direction.dot( p ) * 2 , c = p.squareNorm() - radius * radius;
+	double delta = b * b - 4 * a * c;
+	if( delta<=0 ) return 0;
+	double t[] = { ( -b - sqrt( delta ) ) / ( 2 * a ) , ( -b + sqrt( delta ) ) / ( 2 * a ) };
+	if( t[1]<range[0][0] || t[0]>range[1][0] ) return 0;
+
+	// Clip the end-points that fall outside of the range
+	bool inRange[] = { t[0]>=range[0][0] , t[1]<=range[1][0] };
+	for( int i=0 ; i<2 ; i++ )
+	{
+		RayShapeIntersectionInfo &iInfo = spans[0].iInfo[i];
+		if( inRange[i] )
+		{
+			spans[0].t[i] = t[i];
+			iInfo.material = _material;
+			iInfo.position = ray( t[i] );
+			iInfo.normal = ( iInfo.position - center ).unit();
+		}
+		else spans[0].t[i] = range[i][0] , iInfo.material = NULL;
+	}
+	return 1;
+}
+
 bool Sphere::isInside( Point3D p ) const
 {
 	//////////////////////////////////////////////////////
 	// Determine if the point is inside the sphere here //
 	//////////////////////////////////////////////////////
-	THROW( "method undefined" );
-	return false;
+	return ( p - center ).squareNorm()<radius * radius;
 }
 
 void Sphere::drawOpenGL( GLSLProgram * glslProgram ) const
@@ -0,0 +1,281 @@
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <Util/exceptions.h>
+#include <Util/cmdLineParser.h>
+#include "sphereCloud.h"
+#include "scene.h"
+
+using namespace Ray;
+using namespace Util;
+
+/////////////////
+// SphereCloud //
+/////////////////
+const unsigned int SphereCloud::LeafSize;
+
+SphereCloud::SphereCloud( void ) : _materialIndex(-1) , _material(NULL) {}
+
+size_t SphereCloud::size( void ) const { return _radii.size(); }
+
+size_t SphereCloud::primitiveNum( void ) const { return size(); }
+
+// Each span of the union contains the interval of at least one sphere
+unsigned int SphereCloud::maxSpanNum( void ) const { return (unsigned int)std::min< size_t >( std::max< size_t >( size() , 1 ) , LargestMaxSpanNum ); }
+
+void SphereCloud::_add( float x , float y , float z , float r )
+{
+	if( r<=0 ) THROW( "non-positive sphere radius: %g" , r );
+	_centers[0].push_back( x ) , _centers[1].push_back( y ) , _centers[2].push_back( z );
+	_radii.push_back( r );
+}
+
+void SphereCloud::_read( std::istream &stream )
+{
+	std::string token;
+	if( !( stream >> _materialIndex >> token ) ) THROW( "failed to parse %s" , Directive().c_str() );
+
+	// If the token is a number, the spheres are listed inline. Otherwise, it names the binary file
+	if( token.find_first_not_of( "0123456789" )==std::string::npos )
+	{
+		size_t count = std::stoul( token );
+		for( size_t i=0 ; i<count ; i++ )
+		{
+			float x , y , z , r;
+			if( !( stream >> x >> y >> z >> r ) ) THROW( "failed to parse sphere %d of %d" , (int)i , (int)count );
+			_add( x , y , z , r );
+		}
+	}
+	else
+	{
+		_fileName = token;
+		_readFile();
+	}
+	if( !size() ) THROW( "empty %s" , Directive().c_str() );
+	_build();
+}
+
+void SphereCloud::_readFile( void )
+{
+	std::string fileName = GetFileName( Scene::BaseDir , _fileName );
+	std::ifstream stream( fileName , std::ios::binary | std::ios::ate );
+	if( !stream ) THROW( "failed to open file for reading: %s" , fileName.c_str() );
+	std::streamsize fileSize = stream.tellg();
+	if( fileSize%( 4*sizeof(float) ) ) THROW( "file size is not a multiple of the sphere size: %s" , fileName.c_str() );
+	stream.seekg( 0 );
+
+	size_t count = (size_t)fileSize / ( 4*sizeof(float) );
+	std::vector< float > values( 4*count );
+	if( !stream.read( (char *)&values[0] , fileSize ) ) THROW( "failed to read spheres: %s" , fileName.c_str() );
+	for( int d=0 ; d<3 ; d++ ) _centers[d].reserve( count );
+	_radii.reserve( count );
+	for( size_t i=0 ; i<count ; i++ ) _add( values[4*i+0] , values[4*i+1] , values[4*i+2] , values[4*i+3] );
+}
+
+void SphereCloud::_write( std::ostream &stream ) const
+{
+	Shape::WriteInset( stream );
+	stream << "#" << Directive() << "  " << _materialIndex << "  ";
+	if( _fileName.size() ) stream << _fileName;
+	else
+	{
+		stream << size();
+		for( size_t i=0 ; i<size() ; i++ ) stream << "  " << _centers[0][i] << " " << _centers[1][i] << " " << _centers[2][i] << " " << _radii[i];
+	}
+}
+
+BoundingBox3D SphereCloud::_boundingBox( unsigned int i ) const
+{
+	Point3D c( _centers[0][i] , _centers[1][i] , _centers[2][i] ) , r( _radii[i] , _radii[i] , _radii[i] );
+	return BoundingBox3D( c-r , c+r );
+}
+
+void SphereCloud::_build( void )
+{
+	std::vector< unsigned int > indices( size() );
+	for( unsigned int i=0 ; i<indices.size() ; i++ ) indices[i] = i;
+	_nodes.clear();
+	_nodes.reserve( 2 * ( size() + LeafSize - 1 ) / LeafSize );
+	_build( indices , 0 , (unsigned int)indices.size() );
+
+	// Permute the spheres so that the spheres in each leaf are contiguous
+	for( int d=0 ; d<3 ; d++ )
+	{
+		std::vector< float > centers( size() );
+		for( size_t i=0 ; i<size() ; i++ ) centers[i] = _centers[d][ indices[i] ];
+		_centers[d].swap( centers );
+	}
+	std::vector< float > radii( size() );
+	for( size_t i=0 ; i<size() ; i++ ) radii[i] = _radii[ indices[i] ];
+	_radii.swap( radii );
+}
+
+void SphereCloud::_build( std::vector< unsigned int > &indices , unsigned int start , unsigned int end )
+{
+	size_t n = _nodes.size();
+	_nodes.push_back( _Node() );
+	_nodes[n].bBox = _boundingBox( indices[start] );
+	for( unsigned int i=start+1 ; i<end ; i++ ) _nodes[n].bBox += _boundingBox( indices[i] );
+
+	if( end-start<=LeafSize )
+	{
+		_nodes[n].offset = start;
+		_nodes[n].count = end-start;
+		return;
+	}
+
+	// Split at the median along the axis in which the centers are most spread out
+	Point3D min , max;
+	for( unsigned int i=start ; i<end ; i++ ) for( int d=0 ; d<3 ; d++ )
+	{
+		double c = _centers[d][ indices[i] ];
+		if( i==start || c<min[d] ) min[d] = c;
+		if( i==start || c>max[d] ) max[d] = c;
+	}
+	int axis = 0;
+	for( int d=1 ; d<3 ; d++ ) if( max[d]-min[d]>max[axis]-min[axis] ) axis = d;
+	unsigned int mid = ( start + end ) / 2;
+	const std::vector< float > &centers = _centers[axis];
+	std::nth_element( indices.begin()+start , indices.begin()+mid , indices.begin()+end , [&]( unsigned int i1 , unsigned int i2 ){ return centers[i1]<centers[i2]; } );
+
+	_nodes[n].count = 0;
+	_build( indices , start , mid );
+	_nodes[n].offset = (unsigned int)_nodes.size();
+	_build( indices , mid , end );
+}
+
+void SphereCloud::init( const LocalSceneData &data )
+{
+	// Set the material pointer
+	if( _materialIndex<0 ) THROW( "negative material index: %d" , _materialIndex );
+	else if( (size_t)_materialIndex>=data.materials.size() ) THROW( "material index out of bounds: %d <= %d" , _materialIndex , (int)data.materials.size() );
+	else _material = &data.materials[ _materialIndex ];
+}
+
+void SphereCloud::updateBoundingBox( void ){ _bBox = _nodes[0].bBox; }
+
+void SphereCloud::initOpenGL( void ){ WARN_ONCE( "method undefined" ); }
+
+void SphereCloud::drawOpenGL( GLSLProgram * ) const { WARN_ONCE( "method undefined" ); }
+
+double SphereCloud::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
+{
+	// The release builds assume finite math, so neither infinite inverse directions nor comparisons against Infinity can be relied on.
+	// Axes along which the ray does not move are tested for containment, and misses are tracked with flags.
+	Point3D inverseDirection;
+	bool moves[3];
+	for( int d=0 ; d<3 ; d++ ) moves[d] = ray.direction[d]!=0 , inverseDirection[d] = moves[d] ? 1./ray.direction[d] : 0;
+	double a = ray.direction.squareNorm();
+
+	// Returns true if the ray enters the box before the prescribed value, setting the entry value
+	auto Entry = [&]( const BoundingBox3D &bBox , double tMax , double &entry )
+	{
+		RayTracingStats::IncrementRayBoundingBoxIntersectionNum();
+		double start = range[0][0] , end = tMax;
+		for( int d=0 ; d<3 ; d++ )
+		{
+			if( !moves[d] )
+			{
+				if( ray.position[d]<bBox[0][d] || ray.position[d]>bBox[1][d] ) return false;
+				continue;
+			}
+			double t0 = ( bBox[0][d] - ray.position[d] ) * inverseDirection[d];
+			double t1 = ( bBox[1][d] - ray.position[d] ) * inverseDirection[d];
+			if( inverseDirection[d]<0 ) std::swap( t0 , t1 );
+			start = std::max( start , t0 ) , end = std::min( end , t1 );
+		}
+		entry = start;
+		return start<=end;
+	};
+
+	double tBest = range[1][0] , entry;
+	unsigned int hit = (unsigned int)-1;
+	unsigned int stack[64];
+	unsigned int stackSize = 0;
+	if( Entry( _nodes[0].bBox , tBest , entry ) ) stack[stackSize++] = 0;
+
+	while( stackSize )
+	{
+		const _Node &node = _nodes[ stack[--stackSize] ];
+		if( node.count )
+		{
+			// Compute the roots for all the spheres in the leaf with a branch-free loop, and then take the nearest valid root within the range
+			// (so that rays leaving a sphere's surface towards its interior hit the far side rather than grazing the near one)
+			double t[2][LeafSize];
+			bool valid[LeafSize];
+			const float *x = &_centers[0][ node.offset ] , *y = &_centers[1][ node.offset ] , *z = &_centers[2][ node.offset ] , *r = &_radii[ node.offset ];
+			for( unsigned int k=0 ; k<node.count ; k++ )
+			{
+				double px = ray.position[0]-x[k] , py = ray.position[1]-y[k] , pz = ray.position[2]-z[k];
+				double b = ray.direction[0]*px + ray.direction[1]*py + ray.direction[2]*pz;
+				double c = px*px + py*py + pz*pz - (double)r[k]*r[k];
+				double disc = b*b - a*c;
+				double s = std::sqrt( disc<0 ? 0 : disc );
+				t[0][k] = ( -b - s ) / a , t[1][k] = ( -b + s ) / a;
+				valid[k] = disc>=0;
+			}
+			for( unsigned int k=0 ; k<node.count ; k++ )
+			{
+				RayTracingStats::IncrementRayPrimitiveIntersectionNum();
+				if( !valid[k] ) continue;
+				// Fall back to the far root if the near one is out of range or rejected
+				for( int i=0 ; i<2 ; i++ )
+				{
+					double tt = t[i][k];
+					if( tt>=range[0][0] && tt<=tBest && ( hit==(unsigned int)-1 || tt<tBest ) && validityLambda( tt ) )
+					{
+						tBest = tt , hit = node.offset + k;
+						break;
+					}
+				}
+			}
+		}
+		else
+		{
+			// Visit the nearer child first by pushing it last
+			unsigned int c1 = (unsigned int)( &node - &_nodes[0] ) + 1 , c2 = node.offset;
+			double t1 = 0 , t2 = 0;
+			bool hit1 = Entry( _nodes[c1].bBox , tBest , t1 ) , hit2 = Entry( _nodes[c2].bBox , tBest , t2 );
+			if( hit1 && hit2 )
+			{
+				if( t1>t2 ) std::swap( c1 , c2 );
+				stack[stackSize++] = c2 , stack[stackSize++] = c1;
+			}
+			else if( hit1 ) stack[stackSize++] = c1;
+			else if( hit2 ) stack[stackSize++] = c2;
+		}
+	}
+	if( hit==(unsigned int)-1 ) return Infinity;
+
+	Point3D center( _centers[0][hit] , _centers[1][hit] , _centers[2][hit] );
+	iInfo.material = _material;
+	iInfo.position = ray.position + ray.direction * tBest;
+	iInfo.normal = ( iInfo.position - center ).unit();
+	return tBest;
+}
+
+bool SphereCloud::isInside( Point3D p ) const
+{
+	unsigned int stack[64];
+	unsigned int stackSize = 0;
+	if( _nodes[0].bBox.isInside( p ) ) stack[stackSize++] = 0;
+	while( stackSize )
+	{
+		const _Node &node = _nodes[ stack[--stackSize] ];
+		if( node.count )
+		{
+			for( unsigned int k=node.offset ; k<node.offset+node.count ; k++ )
+			{
+				Point3D q( p[0]-_centers[0][k] , p[1]-_centers[1][k] , p[2]-_centers[2][k] );
+				if( q.squareNorm()<(double)_radii[k]*_radii[k] ) return true;
+			}
+		}
+		else
+		{
+			unsigned int c1 = (unsigned int)( &node - &_nodes[0] ) + 1 , c2 = node.offset;
+			if( _nodes[c1].bBox.isInside( p ) ) stack[stackSize++] = c1;
+			if( _nodes[c2].bBox.isInside( p ) ) stack[stackSize++] = c2;
+		}
+	}
+	return false;
+}
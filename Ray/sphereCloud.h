@@ -0,0 +1,97 @@
+#ifndef SPHERE_CLOUD_INCLUDED
+#define SPHERE_CLOUD_INCLUDED
+#include <string>
+#include <vector>
+#include <Util/geometry.h>
+#include "shape.h"
+
+namespace Ray
+{
+	/** This class describes a cloud of spheres sharing a single material, as used for particle and point-cloud scenes.
+	*** Rather than storing a Shape per sphere, the centers and radii are stored in (single-precision) structure-of-arrays form
+	*** and are indexed by an internal bounding volume hierarchy whose leaves reference contiguous batches of spheres.
+	*** The spheres in a leaf are tested against the ray together, with a branch-free loop that the compiler can vectorize.
+	*** The spheres are either listed inline:
+	***		#shape_sphere_cloud <material index> <sphere count> <center x> <center y> <center z> <radius> ...
+	*** or read from a binary file of (little-endian, single-precision) center/radius quadruples:
+	***		#shape_sphere_cloud <material index> <file name> */
+	class SphereCloud : public Shape
+	{
+		/** A node in the bounding volume hierarchy */
+		struct _Node
+		{
+			/** The bounding box of the spheres in the sub-tree */
+			Util::BoundingBox3D bBox;
+
+			/** For a leaf, the index of the first sphere. For an interior node, the index of the second child (the first child immediately follows the node). */
+			unsigned int offset;
+
+			/** The number of spheres in a leaf (zero for an interior node) */
+			unsigned int count;
+		};
+
+		/** The index of the material associated with the spheres */
+		int _materialIndex;
+
+		/** The material associated with the spheres */
+		const class Material *_material;
+
+		/** The name of the binary file the spheres were read from (empty if the spheres were listed inline) */
+		std::string _fileName;
+
+		/** The coordinates of the sphere centers */
+		std::vector< float > _centers[3];
+
+		/** The radii of the spheres */
+		std::vector< float > _radii;
+
+		/** The nodes of the hierarchy, in depth-first order */
+		std::vector< _Node > _nodes;
+
+		/** This method adds a sphere to the cloud. */
+		void _add( float x , float y , float z , float r );
+
+		/** This method reads the spheres from the binary file. */
+		void _readFile( void );
+
+		/** This method builds the hierarchy, reordering the spheres so that the spheres in each leaf are contiguous. */
+		void _build( void );
+
+		/** This method builds the sub-tree over the prescribed range of (sorted) sphere indices. */
+		void _build( std::vector< unsigned int > &indices , unsigned int start , unsigned int end );
+
+		/** This method returns the bounding box of the prescribed sphere. */
+		Util::BoundingBox3D _boundingBox( unsigned int i ) const;
+
+	public:
+		/** The maximum number of spheres in a leaf of the hierarchy */
+		static const unsigned int LeafSize = 8;
+
+		/** This static method returns the directive describing the shape. */
+		static std::string Directive( void ){ return "shape_sphere_cloud"; }
+
+		/** The default constructor */
+		SphereCloud( void );
+
+		/** This method returns the number of spheres in the cloud. */
+		size_t size( void ) const;
+
+		///////////////////
+		// Shape methods //
+		///////////////////
+	private:
+		void _write( std::ostream &stream ) const;
+		void _read( std::istream &stream );
+	public:
+		std::string name( void ) const { return "sphere cloud"; }
+		void init( const class LocalSceneData &data );
+		void initOpenGL( void );
+		void updateBoundingBox( void );
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
+		bool isInside( Util::Point3D p ) const;
+		void drawOpenGL( GLSLProgram * glslProgram ) const;
+		size_t primitiveNum( void ) const;
+		unsigned int maxSpanNum( void ) const;
+	};
+}
+#endif // SPHERE_CLOUD_INCLUDED
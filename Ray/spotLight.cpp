@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
 #include <Util/exceptions.h>
 #include <Util/geometry.h>
 #include "spotLight.h"
@@ -24,3 +25,26 @@ void SpotLight::_write( std::ostream &stream ) const
 {
 	stream << "#" << Directive() << "  " << _ambient << "  " << _diffuse << "  " << _specular << "  " << _location << "  " << _constAtten << " " << _linearAtten << " " << _quadAtten << "  " << _cutOffAngle << "  " << _dropOffRate;
 }
+
+bool SpotLight::getAttenuation( Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const
+{
+	// The angular fall-off is at most one, so the attenuation bounds the contribution
+	location = _location , constAtten = _constAtten , linearAtten = _linearAtten , quadAtten = _quadAtten;
+	return true;
+}
+
+void SpotLight::setShadowCasters( const ShapeList &shapes )
+{
+	// Only the points within the cone are lit, and the segments from them to the light stay within the cone,
+	// so the shapes that can cast shadows are the ones whose bounding spheres overlap the cone
+	_casters.set( shapes , [&]( const BoundingBox3D &bBox )
+	{
+		Point3D v = ( bBox[0] + bBox[1] ) / 2 - _location;
+		double radius = ( bBox[1] - bBox[0] ).length() / 2 , distance = v.length();
+		if( distance<=radius ) return true;
+		double angle = acos( std::max< double >( -1. , std::min< double >( 1. , v.dot( _direction ) / distance ) ) );
+		return angle - asin( radius / distance )<=_cutOffAngle + 1e-6;
+	} );
+}
+
+BoundingBox3D SpotLight::shadowVolume( const BoundingBox3D &bBox , const BoundingBox3D &region ) const { return _ShadowVolume( BoundingBox3D( _location , _location ) , bBox , region ); }
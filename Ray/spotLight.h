@@ -1,6 +1,7 @@
 #ifndef SPOT_LIGHT_INCLUDED
 #define SPOT_LIGHT_INCLUDED
 #include "light.h"
+#include "shadowCasters.h"
 
 namespace Ray
 {
@@ -33,6 +34,9 @@ namespace Ray
 		/** The rate at which the intensity falls off as light travels in the non-preferred direction (should be in the range [0,128]) */
 		double _dropOffRate;
 
+		/** The part of the scene-graph that can cast shadows from within the cone of the light */
+		ShadowCasters _casters;
+
 	public:
 		/** This static method returns the directive describing the Light. */
 		static std::string Directive( void ){ return "light_spot"; }
@@ -45,6 +49,9 @@ namespace Ray
 		void _read( std::istream &stream );
 	public:
 		std::string name( void ) const { return "spot light"; }
+		bool getAttenuation( Util::Point3D &location , double &constAtten , double &linearAtten , double &quadAtten ) const;
+		void setShadowCasters( const class ShapeList &shapes );
+		Util::BoundingBox3D shadowVolume( const Util::BoundingBox3D &bBox , const Util::BoundingBox3D &region ) const;
 		Util::Point3D getAmbient ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
 		Util::Point3D getDiffuse ( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
 		Util::Point3D getSpecular( Util::Ray3D ray , const class RayShapeIntersectionInfo& iInfo ) const;
@@ -109,9 +109,10 @@ bool SpotLight::isInShadow( const RayShapeIntersectionInfo& iInfo , const Shape*
 
     Point3D p0 = iInfo.position + L_dir * 1e-5; // Offset to avoid self-intersection
     Ray3D ray(p0, L_dir);
-    BoundingBox1D range(Epsilon, L.length()); // Range up to light position
+    BoundingBox1D range(Epsilon, (_location - p0).length()); // Range up to light position
     RayShapeIntersectionInfo info;
-    double t = shape->intersect(ray, info, range);
+    // Only the shapes that overlap the cone can block the light, and the last occluder is tested first
+    double t = _casters.built() ? _casters.intersect(ray, info, range) : shape->intersect(ray, info, range);
     if (t < Infinity) {
         return true; // Occluder found between point and light
     }
@@ -132,16 +133,23 @@ Point3D SpotLight::transparency( const RayShapeIntersectionInfo &iInfo , const S
         return Point3D(1.0, 1.0, 1.0); // Outside cone, fully transparent (no light contribution)
     }
 
+    // Only the shapes that overlap the cone can block the light, and the last occluder is tested first
+    auto occluders = [&](Ray3D ray, RayShapeIntersectionInfo &info, BoundingBox1D range) {
+        return _casters.built() ? _casters.intersect(ray, info, range) : shape.intersect(ray, info, range);
+    };
+
     Point3D p0 = iInfo.position + L_dir * 1e-5; // Offset to avoid self-intersection
     Ray3D ray(p0, L_dir);
     Point3D trans = Point3D(1.0, 1.0, 1.0);
-    BoundingBox1D range(Epsilon, L.length()); // Range up to light position
+    BoundingBox1D range(Epsilon, (_location - p0).length()); // Range up to light position
     RayShapeIntersectionInfo dummy;
-    double intersect = shape.intersect(ray, dummy, range);
+    double intersect = occluders(ray, dummy, range);
     while (intersect < Infinity && trans[0] > cLimit[0] && trans[1] > cLimit[1] && trans[2] > cLimit[2]) {
         trans *= dummy.material->transparent;
         Ray3D new_ray = Ray3D(dummy.position + L_dir * 1e-5, L_dir);
-        intersect = shape.intersect(new_ray, dummy, range);
+        range = BoundingBox1D(Epsilon, (_location - new_ray.position).dot(L_dir)); // Range up to light position, from the new origin
+        if (range[1][0] <= Epsilon) break;
+        intersect = occluders(new_ray, dummy, range);
     }
     return trans;
 }
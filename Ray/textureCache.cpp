@@ -0,0 +1,107 @@
+#include <algorithm>
+#include "textureCache.h"
+#include "shape.h"
+
+using namespace Ray;
+
+//////////////////
+// TextureCache //
+//////////////////
+const unsigned int TextureCache::TileRes;
+size_t TextureCache::Budget = (size_t)256<<20;
+std::unordered_map< TextureCache::_Key , TextureCache::_Entry , TextureCache::_KeyHash > TextureCache::_Entries;
+std::list< TextureCache::_Key > TextureCache::_Recency;
+size_t TextureCache::_Size = 0;
+size_t TextureCache::_PeakSize = 0;
+std::mutex TextureCache::_Mutex;
+std::atomic< unsigned int > TextureCache::_TextureCount( 0 );
+thread_local std::vector< TextureCache::_LocalEntry > TextureCache::_Local;
+
+size_t TextureCache::_KeyHash::operator()( const _Key &key ) const
+{
+	size_t hash = key.texture;
+	hash = hash * 31 + key.level;
+	hash = hash * 1000003 + key.x;
+	hash = hash * 1000003 + key.y;
+	return hash;
+}
+
+size_t TextureCache::_Bytes( const Tile &tile ){ return sizeof( Tile ) + tile.texels.size() * sizeof( Texel ); }
+
+unsigned int TextureCache::NewTexture( void ){ return _TextureCount++; }
+
+size_t TextureCache::PeakSize( void )
+{
+	std::lock_guard< std::mutex > lock( _Mutex );
+	return _PeakSize;
+}
+
+std::shared_ptr< const TextureCache::Tile > TextureCache::Get( unsigned int texture , unsigned int level , unsigned int x , unsigned int y , const std::function< void ( Tile & ) > &set )
+{
+	// Look in the tiles kept by the thread first
+	_Key key = { texture , level , x , y };
+	if( _Local.size()!=LocalSize ) _Local.resize( LocalSize );
+	size_t slot = _KeyHash()( key ) % LocalSize;
+	if( _Local[slot].tile && _Local[slot].key==key )
+	{
+		RayTracingStats::AddTextureTileLookup( true );
+		return _Local[slot].tile;
+	}
+
+	std::shared_ptr< const Tile > tile;
+	{
+		std::lock_guard< std::mutex > lock( _Mutex );
+		auto iter = _Entries.find( key );
+		if( iter!=_Entries.end() )
+		{
+			_Recency.splice( _Recency.begin() , _Recency , iter->second.recency );
+			tile = iter->second.tile;
+		}
+	}
+	RayTracingStats::AddTextureTileLookup( (bool)tile );
+
+	// Set the tile without holding the lock, as setting a tile accesses (and may add) other tiles
+	if( !tile )
+	{
+		std::shared_ptr< Tile > _tile = std::make_shared< Tile >();
+		set( *_tile );
+		tile = _Insert( key , _tile );
+	}
+	_Local[slot] = _LocalEntry{ key , tile };
+	return tile;
+}
+
+void TextureCache::Put( unsigned int texture , unsigned int level , unsigned int x , unsigned int y , const std::shared_ptr< const Tile > &tile )
+{
+	_Key key = { texture , level , x , y };
+	_Insert( key , tile );
+}
+
+std::shared_ptr< const TextureCache::Tile > TextureCache::_Insert( const _Key &key , const std::shared_ptr< const Tile > &tile )
+{
+	std::lock_guard< std::mutex > lock( _Mutex );
+	auto iter = _Entries.find( key );
+	if( iter!=_Entries.end() )
+	{
+		// Another thread set the tile in the meantime
+		_Recency.splice( _Recency.begin() , _Recency , iter->second.recency );
+		return iter->second.tile;
+	}
+	_Recency.push_front( key );
+	_Entries[key] = _Entry{ tile , _Recency.begin() };
+	_Size += _Bytes( *tile );
+
+	// Evict the least recently used tiles, keeping the one just added
+	size_t evictionNum = 0;
+	while( _Size>Budget && _Recency.size()>1 )
+	{
+		auto _iter = _Entries.find( _Recency.back() );
+		_Size -= _Bytes( *_iter->second.tile );
+		_Entries.erase( _iter );
+		_Recency.pop_back();
+		evictionNum++;
+	}
+	if( evictionNum ) RayTracingStats::AddTextureTileEvictions( evictionNum );
+	_PeakSize = std::max< size_t >( _PeakSize , _Size );
+	return tile;
+}
@@ -0,0 +1,108 @@
+#ifndef TEXTURE_CACHE_INCLUDED
+#define TEXTURE_CACHE_INCLUDED
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+namespace Ray
+{
+	/** This class stores the tiles of the mip-map pyramids of the textures, shared by all textures and threads, and is the only place
+	*** the decoded texels are kept.
+	*** Tiles are added when a texture is decoded, or created on access by a function supplied by the texture (which decodes the texture
+	*** again, or filters the tiles of the finer level), and the least recently used tiles are evicted once
+	*** the memory held by the cache exceeds the budget. Tiles are handed out as shared pointers, so a tile that is evicted while a
+	*** thread is sampling it remains valid until the thread releases it.
+	*** Each thread also keeps the last tiles it looked up, so that most lookups neither lock the cache nor update the recency
+	*** list. These tiles can outlive their eviction, adding at most LocalSize tiles per thread to the memory held.
+	*** Each tile stores TileRes x TileRes texels together with the row and column of texels that follow it, so that the four
+	*** texels of a bilinear lookup are always found in a single tile. */
+	class TextureCache
+	{
+	public:
+		/** The number of texels along each side of a tile, not counting the texels shared with the neighboring tiles */
+		static const unsigned int TileRes = 64;
+
+		/** The number of tiles kept by each thread */
+		static const unsigned int LocalSize = 64;
+
+		/** A texel, with 8 bits per channel */
+		struct Texel{ unsigned char c[4]; };
+
+		/** A tile of texels */
+		struct Tile
+		{
+			unsigned int width , height;
+			std::vector< Texel > texels;
+			const Texel &operator()( unsigned int x , unsigned int y ) const { return texels[ y*width+x ]; }
+		};
+
+		/** The maximum number of bytes held by the cache */
+		static size_t Budget;
+
+		/** This static method returns a new identifier for a texture. */
+		static unsigned int NewTexture( void );
+
+		/** This static method returns the tile of the prescribed texture, level, and tile coordinates, setting it with the function on a miss. */
+		static std::shared_ptr< const Tile > Get( unsigned int texture , unsigned int level , unsigned int x , unsigned int y , const std::function< void ( Tile & ) > &set );
+
+		/** This static method adds the tile of the prescribed texture, level, and tile coordinates, unless the cache already holds it. */
+		static void Put( unsigned int texture , unsigned int level , unsigned int x , unsigned int y , const std::shared_ptr< const Tile > &tile );
+
+		/** This static method returns the largest number of bytes held by the cache. */
+		static size_t PeakSize( void );
+	private:
+		/** The key identifying a tile */
+		struct _Key
+		{
+			unsigned int texture , level , x , y;
+			bool operator == ( const _Key &key ) const { return texture==key.texture && level==key.level && x==key.x && y==key.y; }
+		};
+
+		/** The hash function for keys */
+		struct _KeyHash{ size_t operator()( const _Key &key ) const; };
+
+		/** A tile kept by a thread */
+		struct _LocalEntry
+		{
+			_Key key;
+			std::shared_ptr< const Tile > tile;
+		};
+
+		/** The tiles kept by the calling thread, indexed by the hash of their keys */
+		static thread_local std::vector< _LocalEntry > _Local;
+
+		/** A tile held by the cache, together with its position in the recency list */
+		struct _Entry
+		{
+			std::shared_ptr< const Tile > tile;
+			std::list< _Key >::iterator recency;
+		};
+
+		/** The tiles held by the cache */
+		static std::unordered_map< _Key , _Entry , _KeyHash > _Entries;
+
+		/** The keys of the tiles held by the cache, from most to least recently used */
+		static std::list< _Key > _Recency;
+
+		/** The number of bytes held by the cache, and the largest such number */
+		static size_t _Size , _PeakSize;
+
+		/** The mutex guarding the state of the cache */
+		static std::mutex _Mutex;
+
+		/** The counter used to assign texture identifiers */
+		static std::atomic< unsigned int > _TextureCount;
+
+		/** This static method returns the number of bytes held by a tile. */
+		static size_t _Bytes( const Tile &tile );
+
+		/** This static method adds the tile to the shared tiles and returns it, unless they already hold a tile with the key, in which case
+		*** that tile is returned. It evicts the least recently used tiles (other than the returned one) if the budget is exceeded. */
+		static std::shared_ptr< const Tile > _Insert( const _Key &key , const std::shared_ptr< const Tile > &tile );
+	};
+}
+#endif // TEXTURE_CACHE_INCLUDED
@@ -64,7 +64,7 @@ void Torus::initOpenGL( void )
 	ASSERT_OPEN_GL_STATE();	
 }
 
-double Torus::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Torus::intersect( Ray3D ray , RayShapeIntersectionInfo &iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
 
@@ -8,7 +8,7 @@ using namespace Util;
 //////////////
 // Triangle //
 //////////////
-Triangle::Triangle( void ) { _v[0] = _v[1] = _v[2] = NULL; }
+Triangle::Triangle( void ) : _materialIndex(0) , _material(NULL) { _v[0] = _v[1] = _v[2] = NULL , _cv[0] = _cv[1] = _cv[2] = NULL; }
 
 void Triangle::_read( std::istream &stream )
 {
@@ -29,3 +29,21 @@ void Triangle::addTrianglesOpenGL( std::vector< TriangleIndex >& triangles )
 }
 
 size_t Triangle::primitiveNum( void ) const { return 1; }
+
+Point3D Triangle::center( void ) const { return ( _position(0) + _position(1) + _position(2) ) / 3.; }
+
+void Triangle::boundTextureFootprints( const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const
+{
+	if( _material && _material->tex ) boundTextureFootprint( _material->tex , toWorld , eye , pixelAngle , footprints );
+}
+
+void Triangle::boundTextureFootprint( const Texture *texture , const Matrix4D &toWorld , Point3D eye , double pixelAngle , std::unordered_map< const Texture * , double > &footprints ) const
+{
+	// As in Triangle::intersect, the texel scale is computed in the coordinates of the triangle, and degenerate triangles are never hit
+	Point3D e1 = _position(1) - _position(0) , e2 = _position(2) - _position(0);
+	Point2D t1 = _texCoordinate(1) - _texCoordinate(0) , t2 = _texCoordinate(2) - _texCoordinate(0);
+	double area = Point3D::CrossProduct( e1 , e2 ).length();
+	if( area<Epsilon ) return;
+	Point3D v[] = { toWorld * _position(0) , toWorld * _position(1) , toWorld * _position(2) };
+	Texture::BoundFootprints( footprints , texture , BoundingBox3D( v , 3 ) , eye , pixelAngle , sqrt( fabs( t1[0] * t2[1] - t1[1] * t2[0] ) / area ) );
+}
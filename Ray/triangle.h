@@ -36,12 +36,21 @@ namespace Ray
 		/** The vertices associated with the triangle */
 		const class Vertex* _v[3];
 
+		/** The compact vertices associated with the triangle, if the vertices were read in compact form */
+		const class CompactVertex* _cv[3];
+
 		/** The index of the material associated with the box */
 		int _materialIndex;
 
 		/** The material associated with the sphere */
 		const class Material *_material;
 
+		/** This method returns the position of the i-th vertex */
+		Util::Point3D _position( int i ) const { return _v[i] ? _v[i]->position : _cv[i]->position(); }
+
+		/** This method returns the texture coordinates of the i-th vertex */
+		Util::Point2D _texCoordinate( int i ) const { return _v[i] ? _v[i]->texCoordinate : _cv[i]->texCoordinate(); }
+
 	public:
 		/** This static method returns the directive describing the shape. */
 		static std::string Directive( void ){ return "shape_triangle"; }
@@ -49,6 +58,12 @@ namespace Ray
 		/** The default constructor */
 		Triangle( void );
 
+		/** This method returns the centroid of the triangle. */
+		Util::Point3D center( void ) const;
+
+		/** This method lowers the bound on the footprints of the rays hitting the triangle with the prescribed texture (see Shape::boundTextureFootprints). */
+		void boundTextureFootprint( const class Texture *texture , const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
+
 		///////////////////
 		// Shape methods //
 		///////////////////
@@ -60,9 +75,10 @@ namespace Ray
 		void init( const class LocalSceneData &data );
 		void initOpenGL( void );
 		void updateBoundingBox( void );
-		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , std::function< bool (double) > validityFunction = [] ( double t ){ return true; } ) const;
+		double intersect( Util::Ray3D ray , class RayShapeIntersectionInfo &iInfo , Util::BoundingBox1D range = Util::BoundingBox1D( Util::Epsilon , Util::Infinity ) , ValidityFunction validityFunction = ValidityFunction() ) const;
 		bool isInside( Util::Point3D p ) const;
 		void addTrianglesOpenGL( std::vector< TriangleIndex >& triangles );
+		void boundTextureFootprints( const Util::Matrix4D &toWorld , Util::Point3D eye , double pixelAngle , std::unordered_map< const class Texture * , double > &footprints ) const;
 		void drawOpenGL( GLSLProgram * glslProgram ) const;
 		size_t primitiveNum( void ) const;
 	};
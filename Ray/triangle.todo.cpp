@@ -16,8 +16,10 @@ void Triangle::init( const LocalSceneData &data )
 	for( int i=0 ; i<3 ; i++ )
 	{
 		if( _vIndices[i]==-1 ) THROW( "negative vertex index: %d" , _vIndices[i] );
-		else if( _vIndices[i]>=data.vertices.size() ) THROW( "vertex index out of bounds: %d <= %d" , _vIndices[i] , (int)data.vertices.size() );
-		else _v[i] = &data.vertices[ _vIndices[i] ];
+		else if( _vIndices[i]>=data.vertexNum() ) THROW( "vertex index out of bounds: %d <= %d" , _vIndices[i] , (int)data.vertexNum() );
+		if( data.vertexMap.size() ) _vIndices[i] = data.vertexMap[ _vIndices[i] ];
+		if( data.compactVertices.size() ) _v[i] = NULL , _cv[i] = &data.compactVertices[ _vIndices[i] ];
+		else _v[i] = &data.vertices[ _vIndices[i] ] , _cv[i] = NULL;
 	}
 
 	///////////////////////////////////
@@ -45,9 +47,9 @@ void Triangle::updateBoundingBox( void )
 	// THROW( "method undefined" );
 	// std::cout<<"_bBox triangle"<<_bBox<<std::endl;
 
-	Point3D p1 = _v[0]->position;
-	Point3D p2 = _v[1]->position;
-	Point3D p3 = _v[2]->position;
+	Point3D p1 = _position(0);
+	Point3D p2 = _position(1);
+	Point3D p3 = _position(2);
 
 	float x_min = fmin(fmin(p1[0], p2[0]), p3[0]);
 	float x_max = fmax(fmax(p1[0], p2[0]), p3[0]);
@@ -86,7 +88,7 @@ Point3D CrossProduct(Point3D p1, Point3D p2){
 		return result;
 }
 
-double Triangle::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , BoundingBox1D range , std::function< bool (double) > validityLambda ) const
+double Triangle::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , BoundingBox1D range , ValidityFunction validityLambda ) const
 {
 	RayTracingStats::IncrementRayPrimitiveIntersectionNum();
 
@@ -95,9 +97,9 @@ double Triangle::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , Boundi
 	// Compute the intersection of the shape with the ray here //
 	/////////////////////////////////////////////////////////////
 	
-    Util::Point3D v1 = _v[0]->position;
-    Util::Point3D v2 = _v[1]->position;
-    Util::Point3D v3 = _v[2]->position;
+    Util::Point3D v1 = _position(0);
+    Util::Point3D v2 = _position(1);
+    Util::Point3D v3 = _position(2);
 
     Util::Point3D e1 = v2 - v1;
     Util::Point3D e2 = v3 - v1;
@@ -133,7 +135,9 @@ double Triangle::intersect( Ray3D ray , RayShapeIntersectionInfo& iInfo , Boundi
 
     iInfo.position = P;
     iInfo.normal = normal;
-    iInfo.texture = alpha * _v[1]->texCoordinate + beta * _v[2]->texCoordinate + gamma * _v[0]->texCoordinate;
+    iInfo.texture = alpha * _texCoordinate(1) + beta * _texCoordinate(2) + gamma * _texCoordinate(0);
+    Util::Point2D t1 = _texCoordinate(1) - _texCoordinate(0), t2 = _texCoordinate(2) - _texCoordinate(0);
+    iInfo.texelScale = sqrt(fabs(t1[0] * t2[1] - t1[1] * t2[0]) / fabs(area));
     iInfo.material = _material; // Using the inherited _material
 
     return t;
@@ -0,0 +1,222 @@
+#include <cmath>
+#include <algorithm>
+#include <Util/timer.h>
+#include <Util/morton.h>
+#include "wavefront.h"
+#include "scene.h"
+#include "scratchArena.h"
+
+using namespace Ray;
+using namespace Util;
+using namespace Image;
+
+//////////////
+// RayQueue //
+//////////////
+const size_t RayQueue::NoRay;
+
+size_t RayQueue::size( void ) const { return positions.size(); }
+
+Ray3D RayQueue::ray( size_t i ) const { return Ray3D( positions[i] , directions[i] ); }
+
+size_t RayQueue::push( Ray3D ray , int depth , Point3D cLimit )
+{
+	positions.push_back( ray.position );
+	directions.push_back( ray.direction );
+	depths.push_back( depth );
+	cLimits.push_back( cLimit );
+	t.push_back( Infinity );
+	iInfos.push_back( RayShapeIntersectionInfo() );
+	shadows.push_back( 0 );
+	reflected.push_back( NoRay );
+	refracted.push_back( NoRay );
+	colors.push_back( Point3D() );
+	return positions.size()-1;
+}
+
+/////////////////
+// ShadowQueue //
+/////////////////
+size_t ShadowQueue::size( void ) const { return rays.size(); }
+
+void ShadowQueue::push( size_t ray , unsigned int light , bool selected )
+{
+	rays.push_back( ray );
+	lights.push_back( light );
+	transparency.push_back( Point3D() );
+	this->selected.push_back( selected );
+}
+
+void ShadowQueue::clear( void ){ rays.clear() , lights.clear() , transparency.clear() , selected.clear(); }
+
+///////////////////////
+// WavefrontRenderer //
+///////////////////////
+const unsigned int WavefrontRenderer::_CellBits;
+
+WavefrontRenderer::WavefrontRenderer( Scene &scene , size_t batchSize ) : _scene(scene) , _batchSize(batchSize) {}
+
+unsigned long long WavefrontRenderer::_binKey( Point3D position , Point3D direction ) const
+{
+	unsigned int octant = 0 , cell[3];
+	for( int d=0 ; d<3 ; d++ )
+	{
+		if( direction[d]<0 ) octant |= 1<<d;
+		double extent = _bBox[1][d] - _bBox[0][d];
+		double x = std::isfinite( extent ) && extent>0 ? ( position[d] - _bBox[0][d] ) / extent : 0;
+		x = std::max( 0. , std::min( x , 1. ) );
+		cell[d] = (unsigned int)( x * ( ( 1<<_CellBits ) - 1 ) );
+	}
+	return ( (unsigned long long)octant<<( 3*_CellBits ) ) | MortonCode( cell[0] , cell[1] , cell[2] );
+}
+
+void WavefrontRenderer::_extend( RayQueue &queue , bool bin )
+{
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	if( !bin || !_batchSize )
+	{
+		for( size_t i=0 ; i<queue.size() ; i++ )
+		{
+			arena.reset();
+			queue.t[i] = _scene.intersect( queue.ray(i) , queue.iInfos[i] );
+		}
+		return;
+	}
+
+	// Sort each batch of rays by bin and intersect in sorted order, writing the results back to the rays' slots
+	for( size_t start=0 ; start<queue.size() ; start+=_batchSize )
+	{
+		size_t end = std::min< size_t >( start+_batchSize , queue.size() );
+		_order.resize( 0 );
+		for( size_t i=start ; i<end ; i++ ) _order.push_back( std::make_pair( _binKey( queue.positions[i] , queue.directions[i] ) , i ) );
+		std::sort( _order.begin() , _order.end() );
+		for( size_t k=0 ; k<_order.size() ; k++ )
+		{
+			size_t i = _order[k].second;
+			arena.reset();
+			queue.t[i] = _scene.intersect( queue.ray(i) , queue.iInfos[i] );
+		}
+	}
+}
+
+void WavefrontRenderer::_shade( RayQueue &queue , _Bounce &next )
+{
+	unsigned int lightNum = (unsigned int)_scene._globalData.lights.size();
+	const LightTree &lightTree = _scene._globalData.lightTree;
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	arena.reset();
+	bool *selected = lightTree.size() ? arena.allocate< bool >( lightNum ) : NULL;
+	for( size_t i=0 ; i<queue.size() ; i++ ) if( queue.t[i]<Infinity )
+	{
+		const RayShapeIntersectionInfo &iInfo = queue.iInfos[i];
+
+		// Queue the shadow rays, using the same selection of lights as Scene::directColor
+		queue.shadows[i] = _shadows.size();
+		if( selected ) lightTree.select( iInfo.position , *iInfo.material , queue.cLimits[i] , selected );
+		for( unsigned int l=0 ; l<lightNum ; l++ ) _shadows.push( i , l , !selected || selected[l] );
+
+		// Queue the secondary rays, using the same criteria as Scene::shade
+		int depth = queue.depths[i]-1;
+		Point3D cLimit = queue.cLimits[i];
+		Point3D kS = iInfo.material->specular , kT = iInfo.material->transparent;
+		Ray3D refracted;
+		if( depth>0 && Scene::Propagates( kS , cLimit ) ) queue.reflected[i] = next.reflected.push( Scene::ReflectedRay( queue.ray(i) , iInfo ) , depth-1 , cLimit/kS );
+		if( Scene::RefractedRay( queue.ray(i) , iInfo , refracted ) && depth>0 && Scene::Propagates( kT , cLimit ) ) queue.refracted[i] = next.refracted.push( refracted , depth-1 , cLimit/kT );
+	}
+}
+
+void WavefrontRenderer::_connect( RayQueue &queue )
+{
+	ScratchArena &arena = ScratchArena::ThreadArena();
+	for( size_t s=0 ; s<_shadows.size() ; s++ )
+	{
+		arena.reset();
+		size_t i = _shadows.rays[s];
+		if( _shadows.selected[s] ) _shadows.transparency[s] = _scene._globalData.lights[ _shadows.lights[s] ]->transparency( queue.iInfos[i] , _scene , queue.cLimits[i] );
+	}
+
+	unsigned int lightNum = (unsigned int)_scene._globalData.lights.size();
+	bool culled = _scene._globalData.lightTree.size()!=0;
+	for( size_t i=0 ; i<queue.size() ; i++ ) if( queue.t[i]<Infinity )
+	{
+		arena.reset();
+		bool *selected = culled ? arena.allocate< bool >( lightNum ) : NULL;
+		if( selected ) for( unsigned int l=0 ; l<lightNum ; l++ ) selected[l] = _shadows.selected[ queue.shadows[i]+l ];
+		queue.colors[i] = _scene.directColor( queue.ray(i) , queue.iInfos[i] , _shadows.transparency.data() + queue.shadows[i] , selected );
+	}
+	_shadows.clear();
+}
+
+void WavefrontRenderer::_resolve( RayQueue &queue , const _Bounce &next ) const
+{
+	for( size_t i=0 ; i<queue.size() ; i++ )
+	{
+		if( queue.t[i]<Infinity )
+		{
+			Point3D color = queue.colors[i];
+			if( queue.reflected[i]!=RayQueue::NoRay ) color += next.reflected.colors[ queue.reflected[i] ] * queue.iInfos[i].material->specular;
+			if( queue.refracted[i]!=RayQueue::NoRay ) color += next.refracted.colors[ queue.refracted[i] ] * queue.iInfos[i].material->transparent;
+			queue.colors[i] = Scene::Clamp( color );
+		}
+		else queue.colors[i] = Point3D();
+	}
+}
+
+Image32 WavefrontRenderer::render( int width , int height , int rLimit , double cLimit , int pixelOrder )
+{
+	_scene.updateBoundingBox();
+	_bBox = _scene.boundingBox();
+	_scene._setPixelAngle( height );
+	Image32 img;
+	img.setSize( width , height );
+
+	// Make sure the traversal scratch memory is in place before tracing begins
+	ScratchArena::ThreadArena().reserve( ScratchArena::DefaultBlockSize );
+
+	// Generate the primary rays
+	PixelOrder order( pixelOrder , width , height );
+	RayQueue primary;
+	for( size_t k=0 ; k<order.size() ; k++ ) primary.push( _scene._globalData.camera.getRay( order[k].x , height-order[k].y-1 , width , height ) , rLimit , Point3D( cLimit , cLimit , cLimit ) );
+
+	// Process the primary rays
+	Timer timer;
+	_extend( primary , false );
+	RayTracingStats::AddPrimaryRays( primary.size() , timer.elapsed() );
+	std::vector< _Bounce > bounces( 1 );
+	_shade( primary , bounces[0] );
+	_connect( primary );
+
+	// Process the secondary rays, one bounce at a time
+	for( size_t b=0 ; bounces[b].size() ; b++ )
+	{
+		bounces.resize( b+2 );
+		RayQueue *queues[] = { &bounces[b].reflected , &bounces[b].refracted };
+		for( int q=0 ; q<2 ; q++ )
+		{
+			timer.reset();
+			_extend( *queues[q] , true );
+			RayTracingStats::AddSecondaryRays( queues[q]->size() , timer.elapsed() );
+			_shade( *queues[q] , bounces[b+1] );
+			_connect( *queues[q] );
+		}
+	}
+
+	// Resolve the paths from the deepest bounce up and write the colors into the framebuffer
+	for( size_t b=bounces.size()-1 ; b>0 ; b-- )
+	{
+		_resolve( bounces[b-1].reflected , bounces[b] );
+		_resolve( bounces[b-1].refracted , bounces[b] );
+	}
+	_resolve( primary , bounces[0] );
+
+	for( size_t k=0 ; k<order.size() ; k++ )
+	{
+		Point3D c = primary.colors[k];
+		Pixel32 p;
+		p.r = (int)(c[0]*255);
+		p.g = (int)(c[1]*255);
+		p.b = (int)(c[2]*255);
+		img( order[k].x , order[k].y ) = p;
+	}
+	return img;
+}
@@ -0,0 +1,143 @@
+#ifndef WAVEFRONT_INCLUDED
+#define WAVEFRONT_INCLUDED
+#include <vector>
+#include <Util/geometry.h>
+#include <Image/image.h>
+#include "shape.h"
+#include "pixelOrder.h"
+
+namespace Ray
+{
+	class Scene;
+
+	/** This class stores a queue of rays, and the state of the paths they belong to, in structure-of-arrays form. */
+	class RayQueue
+	{
+	public:
+		/** The index used to indicate that no secondary ray was spawned */
+		static const size_t NoRay = (size_t)-1;
+
+		/** The ray positions */
+		std::vector< Util::Point3D > positions;
+
+		/** The ray directions */
+		std::vector< Util::Point3D > directions;
+
+		/** The remaining recursion depth of the rays */
+		std::vector< int > depths;
+
+		/** The cut-off values of the rays */
+		std::vector< Util::Point3D > cLimits;
+
+		/** The distances along the rays to the intersections (Infinity if there is no intersection) */
+		std::vector< double > t;
+
+		/** The intersection information */
+		std::vector< RayShapeIntersectionInfo > iInfos;
+
+		/** The offset of each ray's entries in the shadow queue */
+		std::vector< size_t > shadows;
+
+		/** The indices of the spawned reflected and refracted rays within the queues of the next bounce */
+		std::vector< size_t > reflected , refracted;
+
+		/** The colors of the rays, first the direct lighting and, once the path has been resolved, the final color */
+		std::vector< Util::Point3D > colors;
+
+		/** This method returns the number of rays in the queue. */
+		size_t size( void ) const;
+
+		/** This method returns the i-th ray. */
+		Util::Ray3D ray( size_t i ) const;
+
+		/** This method adds a ray to the queue and returns its index. */
+		size_t push( Util::Ray3D ray , int depth , Util::Point3D cLimit );
+	};
+
+	/** This class stores the queue of shadow rays, connecting intersections to the lights, in structure-of-arrays form. */
+	class ShadowQueue
+	{
+	public:
+		/** The indices of the intersections (within the ray queue) the shadow rays start at */
+		std::vector< size_t > rays;
+
+		/** The indices of the lights the shadow rays are cast towards */
+		std::vector< unsigned int > lights;
+
+		/** The transparency along the shadow rays */
+		std::vector< Util::Point3D > transparency;
+
+		/** Whether the lights the shadow rays are cast towards were selected by the light hierarchy (the others are neither traced nor shaded) */
+		std::vector< bool > selected;
+
+		/** This method returns the number of shadow rays in the queue. */
+		size_t size( void ) const;
+
+		/** This method adds a shadow ray to the queue. */
+		void push( size_t ray , unsigned int light , bool selected=true );
+
+		/** This method empties the queue. */
+		void clear( void );
+	};
+
+	/** This class ray-traces a scene in breadth-first order. Rather than following each path recursively, all of the rays at
+	*** a given bounce are stored in queues and processed together, one stage at a time:
+	***		extend: the rays are intersected with the scene;
+	***		shade: shadow rays are queued for the intersections and the reflected and refracted rays are queued for the next bounce;
+	***		connect: the shadow rays are traced and the direct lighting is accumulated.
+	*** Once no rays remain, the bounces are resolved from the deepest up, adding the attenuated colors of the secondary rays
+	*** in the same order as Scene::shade so that the image matches the one computed by Scene::rayTrace.
+	*** To improve the coherence of traversal, secondary rays can be binned by direction octant and (the Morton code of) the
+	*** cell containing the origin, in batches of prescribed size, and are then extended in bin order. */
+	class WavefrontRenderer
+	{
+		/** The rays spawned at a single bounce */
+		struct _Bounce
+		{
+			RayQueue reflected , refracted;
+			size_t size( void ) const { return reflected.size() + refracted.size(); }
+		};
+
+		/** The scene being rendered */
+		Scene &_scene;
+
+		/** The shadow rays of the queue being processed */
+		ShadowQueue _shadows;
+
+		/** The number of secondary rays binned together (zero if the rays are not binned) */
+		size_t _batchSize;
+
+		/** The bounding box of the scene, used to define the cells the rays are binned into */
+		Util::BoundingBox3D _bBox;
+
+		/** The bin keys and indices of the rays in the batch being extended */
+		std::vector< std::pair< unsigned long long , size_t > > _order;
+
+		/** The number of bits per dimension used to index the origin cells */
+		static const unsigned int _CellBits = 10;
+
+		/** This method returns the bin key of a ray, with the direction octant in the high bits and the Morton code of the origin cell in the low bits. */
+		unsigned long long _binKey( Util::Point3D position , Util::Point3D direction ) const;
+
+		/** This method intersects the rays in the queue with the scene, binning them first if requested. */
+		void _extend( RayQueue &queue , bool bin );
+
+		/** This method queues the shadow rays for the intersections and the secondary rays for the next bounce.
+		*** If the lights are culled, the shadow rays to the lights that are not selected are marked as such. */
+		void _shade( RayQueue &queue , _Bounce &next );
+
+		/** This method traces the shadow rays and computes the direct lighting at the intersections. */
+		void _connect( RayQueue &queue );
+
+		/** This method computes the final colors of the rays in the queue from the final colors of the rays they spawned. */
+		void _resolve( RayQueue &queue , const _Bounce &next ) const;
+
+	public:
+		/** The constructor takes the scene to be rendered and the number of secondary rays to bin together (zero for no binning) */
+		WavefrontRenderer( Scene &scene , size_t batchSize=0 );
+
+		/** This method ray-traces the scene and returns the computed image, generating the primary rays in the prescribed PixelOrder. */
+		Image::Image32 render( int width , int height , int rLimit , double cLimit , int pixelOrder=PixelOrder::SCANLINE );
+	};
+}
+#endif // WAVEFRONT_INCLUDED
@@ -1,32 +1,29 @@
 #ifndef FACTORY_INCLUDED
 #define FACTORY_INCLUDED
 
+#include <vector>
+#include <new>
 #include <type_traits>
 
 namespace Util
 {
 	/** This templated class represents a factory for generating objects of type BaseType.
-	  * It tracks the objects created and deletes them in the destructor. */
+	  * The factory owns the objects it creates and deallocates them in the destructor. */
 	template< typename BaseType >
 	class BaseFactory
 	{
-		/** The list of BaseType created by the factory */
+		/** The list of BaseType created on the heap by the templated create method */
 		std::vector< BaseType * > _baseTypes;
 
-		/** The virtual method creating an object of type BaseType on the heap */
+		/** The virtual method creating an object of type BaseType, which remains owned by the factory */
 		virtual BaseType *_create( void ) = 0;
 
 	public:
-		/** The destructor is responsible for deallocating all the BaseType created */
+		/** The destructor is responsible for deallocating all the BaseType created on the heap */
 		virtual ~BaseFactory( void ){ for( int i=0 ; i<_baseTypes.size() ; i++ ) delete _baseTypes[i]; }
 
 		/** The (publicly accessible) method for creating a new object */
-		BaseType *create( void )
-		{
-			BaseType *baseType = _create();
-			_baseTypes.push_back( baseType );
-			return baseType;
-		}
+		BaseType *create( void ){ return _create(); }
 
 		/** The method for creating a new derived object */
 		template< typename DerivedType >
@@ -39,16 +36,61 @@ namespace Util
 		}
 	};
 
-	/** This derived template class is a factory for creating derived objects of type DerivedType */
+	/** This derived template class is a factory for creating derived objects of type DerivedType.
+	  * Rather than allocating the objects individually, it constructs them in place within blocks of memory that
+	  * grow geometrically, so that objects of the same type are contiguous and a scene with millions of nodes
+	  * requires only a few allocations. The objects are destroyed, and the blocks released, when the factory is. */
 	template< typename BaseType , typename DerivedType >
 	class DerivedFactory : public BaseFactory< BaseType >
 	{
 		static_assert( std::is_base_of< BaseType , DerivedType >::value , "[ERROR] BaseType must be base of DerivedType" );
 
+		/** The blocks of memory the objects are constructed in */
+		std::vector< DerivedType * > _blocks;
+
+		/** The number of objects constructed in the last block */
+		size_t _size;
+
+		/** The number of objects that fit in the last block */
+		size_t _capacity;
+
+		/** This static method returns the number of objects that fit in the i-th block */
+		static size_t _BlockCapacity( size_t i ){ return i<MaxBlockLog-MinBlockLog ? (size_t)1<<( MinBlockLog+i ) : (size_t)1<<MaxBlockLog; }
+
+	public:
+		/** The (log of the) number of objects in the first and largest blocks */
+		static const size_t MinBlockLog = 6 , MaxBlockLog = 16;
+
+		/** The default constructor */
+		DerivedFactory( void ) : _size(0) , _capacity(0) {}
+
+		/** The destructor destroys the objects and releases the blocks */
+		~DerivedFactory( void )
+		{
+			for( size_t i=0 ; i<_blocks.size() ; i++ )
+			{
+				size_t size = i+1==_blocks.size() ? _size : _BlockCapacity( i );
+				for( size_t j=0 ; j<size ; j++ ) _blocks[i][j].~DerivedType();
+				::operator delete( _blocks[i] );
+			}
+		}
+
 		/////////////////////////////////////
 		// BaseFactory< BaseType > methods //
 		/////////////////////////////////////
-		BaseType *_create( void ){ return new DerivedType(); }
+	private:
+		BaseType *_create( void )
+		{
+			if( _size==_capacity )
+			{
+				_capacity = _BlockCapacity( _blocks.size() );
+				_blocks.push_back( (DerivedType *)::operator new( sizeof( DerivedType ) * _capacity ) );
+				_size = 0;
+			}
+			DerivedType *derivedType = new( _blocks.back() + _size ) DerivedType();
+			_size++;
+			return derivedType;
+		}
 	};
 }
 #endif // FACTORY_INCLUDED
@@ -0,0 +1,35 @@
+#ifndef MORTON_INCLUDED
+#define MORTON_INCLUDED
+
+namespace Util
+{
+	/** This function spreads out the lower 21 bits of the value, inserting two zero bits between consecutive bits. */
+	inline unsigned long long SpreadBits3( unsigned int v )
+	{
+		unsigned long long x = v & 0x1fffff;
+		x = ( x | x<<32 ) & 0x001f00000000ffffull;
+		x = ( x | x<<16 ) & 0x001f0000ff0000ffull;
+		x = ( x | x<< 8 ) & 0x100f00f00f00f00full;
+		x = ( x | x<< 4 ) & 0x10c30c30c30c30c3ull;
+		x = ( x | x<< 2 ) & 0x1249249249249249ull;
+		return x;
+	}
+
+	/** This function spreads out the lower 16 bits of the value, inserting a zero bit between consecutive bits. */
+	inline unsigned int SpreadBits2( unsigned int v )
+	{
+		unsigned int x = v & 0xffff;
+		x = ( x | x<<8 ) & 0x00ff00ff;
+		x = ( x | x<<4 ) & 0x0f0f0f0f;
+		x = ( x | x<<2 ) & 0x33333333;
+		x = ( x | x<<1 ) & 0x55555555;
+		return x;
+	}
+
+	/** This function returns the Morton code of the 2D cell with the prescribed integer coordinates, each of which is assumed to be less than 2^16. */
+	inline unsigned int MortonCode( unsigned int x , unsigned int y ){ return SpreadBits2( x ) | ( SpreadBits2( y )<<1 ); }
+
+	/** This function returns the Morton code of the cell with the prescribed integer coordinates, each of which is assumed to be less than 2^21. */
+	inline unsigned long long MortonCode( unsigned int x , unsigned int y , unsigned int z ){ return SpreadBits3( x ) | ( SpreadBits3( y )<<1 ) | ( SpreadBits3( z )<<2 ); }
+}
+#endif // MORTON_INCLUDED
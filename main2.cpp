@@ -9,12 +9,27 @@
 #include <Ray/cone.h>
 #include <Ray/cylinder.h>
 #include <Ray/sphere.h>
+#include <Ray/sphereCloud.h>
+#include <Ray/heightField.h>
+#include <Ray/implicitSurface.h>
 #include <Ray/torus.h>
 #include <Ray/triangle.h>
 #include <Ray/fileInstance.h>
 #include <Ray/directionalLight.h>
 #include <Ray/pointLight.h>
 #include <Ray/spotLight.h>
+#include <Ray/areaLight.h>
+#include <Ray/wavefront.h>
+#include <Ray/relightingCache.h>
+#include <Ray/animationRenderer.h>
+#include <Ray/compiledScene.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment( lib , "psapi.lib" )
+#else // !_WIN32
+#include <sys/resource.h>
+#endif // _WIN32
 
 using namespace std;
 using namespace Ray;
@@ -29,13 +44,46 @@ CmdLineParameter< int > ImageWidth( "width" , 640 );
 CmdLineParameter< int > ImageHeight( "height" , 480 );
 CmdLineParameter< int > RecursionLimit( "rLimit" , 5 );
 CmdLineParameter< float > CutOffThreshold( "cutOff" , 0.0001f );
+CmdLineParameter< int > PacketWidth( "packet" , 1 );
+CmdLineReadable Wavefront( "wavefront" );
+CmdLineReadable Compile( "compile" );
+CmdLineReadable CompactVertices( "compactVertices" );
+CmdLineReadable SpatialOrder( "spatialOrder" );
+CmdLineReadable CullLights( "cullLights" );
+CmdLineReadable MipMap( "mipMap" );
+CmdLineParameter< int > SortBatch( "sortBatch" , 0 );
+CmdLineParameter< string > TraversalOrder( "order" , "scanline" );
+CmdLineParameter< int > Threads( "threads" , 1 );
+CmdLineParameter< int > TextureCacheBudget( "textureCache" , 256 );
+CmdLineParameter< string > RelightingCacheFile( "relight" );
+CmdLineParameter< int > Frames( "frames" , 0 );
+CmdLineParameter< float > FramesPerSecond( "fps" , 24.f );
+CmdLineParameter< string > IncrementalMode( "incremental" , "conservative" );
 
 CmdLineReadable* params[] =
 {
-	&InputRayFile , &OutputImageFile , &ImageWidth , &ImageHeight , &RecursionLimit , &CutOffThreshold ,
+	&InputRayFile , &OutputImageFile , &ImageWidth , &ImageHeight , &RecursionLimit , &CutOffThreshold , &PacketWidth , &Wavefront , &SortBatch , &TraversalOrder , &Threads , &Compile , &CompactVertices , &SpatialOrder , &CullLights , &MipMap , &TextureCacheBudget , &RelightingCacheFile , &Frames , &FramesPerSecond , &IncrementalMode ,
 	NULL
 };
 
+/** This function returns the peak resident set size of the process, in bytes. */
+size_t PeakMemoryUsage( void )
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if( !GetProcessMemoryInfo( GetCurrentProcess() , &counters , sizeof(counters) ) ) return 0;
+	return counters.PeakWorkingSetSize;
+#else // !_WIN32
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF , &usage ) ) return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else // !__APPLE__
+	return (size_t)usage.ru_maxrss<<10;
+#endif // __APPLE__
+#endif // _WIN32
+}
+
 void ShowUsage( const string &ex )
 {
 	cout << "Usage " << ex << ":" << endl;
@@ -45,6 +93,35 @@ void ShowUsage( const string &ex )
 	cout << "\t[--" << ImageHeight.name << " <image height>=" << ImageHeight.value << "]" << endl;
 	cout << "\t[--" << RecursionLimit.name << " <recursion limit>=" << RecursionLimit.value << "]" << endl;
 	cout << "\t[--" << CutOffThreshold.name << " <cut-off threshold>=" << CutOffThreshold.value << "]" << endl;
+	cout << "\t[--" << PacketWidth.name << " <primary ray packet width (1, 2, or 4)>=" << PacketWidth.value << "]" << endl;
+	cout << "\t[--" << Wavefront.name << "]" << endl;
+	cout << "\t[--" << SortBatch.name << " <wavefront secondary ray binning batch size (0 for no binning)>=" << SortBatch.value << "]" << endl;
+	cout << "\t[--" << TraversalOrder.name << " <pixel traversal order (";
+	for( int i=0 ; i<PixelOrder::COUNT ; i++ ) cout << ( i ? ", " : "" ) << PixelOrder::Names[i];
+	cout << ")>=" << TraversalOrder.value << "]" << endl;
+	cout << "\t[--" << Threads.name << " <number of threads (recursive renderer)>=" << Threads.value << "]" << endl;
+	cout << "\t[--" << Compile.name << "]" << endl;
+	cout << "\t[--" << CompactVertices.name << "]" << endl;
+	cout << "\t[--" << SpatialOrder.name << "]" << endl;
+	cout << "\t[--" << CullLights.name << "]" << endl;
+	cout << "\t[--" << MipMap.name << "]" << endl;
+	cout << "\t[--" << TextureCacheBudget.name << " <texture cache budget (in MB)>=" << TextureCacheBudget.value << "]" << endl;
+	cout << "\t[--" << RelightingCacheFile.name << " <relighting cache file>]" << endl;
+	cout << "\t[--" << Frames.name << " <number of animation frames (0 for a single image)>=" << Frames.value << "]" << endl;
+	cout << "\t[--" << FramesPerSecond.name << " <animation frames per second>=" << FramesPerSecond.value << "]" << endl;
+	cout << "\t[--" << IncrementalMode.name << " <pixels re-traced per animation frame (";
+	for( int i=0 ; i<AnimationRenderer::COUNT ; i++ ) cout << ( i ? ", " : "" ) << AnimationRenderer::Names[i];
+	cout << ")>=" << IncrementalMode.value << "]" << endl;
+}
+
+/** This function returns the name of the output file for the prescribed frame, with the frame number inserted before the extension. */
+string FrameFileName( const string &fileName , int frame )
+{
+	char number[16];
+	sprintf( number , ".%04d" , frame );
+	size_t idx = fileName.rfind( '.' );
+	if( idx==string::npos ) return fileName + number;
+	return fileName.substr( 0 , idx ) + number + fileName.substr( idx );
 }
 
 /** A wrapper class for size_t that prints out comma-separated numbers */
@@ -91,13 +168,17 @@ int main( int argc , char *argv[] )
 		ShapeList::ShapeFactories[ Box              ::Directive() ] = new DerivedFactory< Shape , Box >();
 		ShapeList::ShapeFactories[ Cone             ::Directive() ] = new DerivedFactory< Shape , Cone >();
 		ShapeList::ShapeFactories[ Cylinder         ::Directive() ] = new DerivedFactory< Shape , Cylinder >();
+		ShapeList::ShapeFactories[ HeightField      ::Directive() ] = new DerivedFactory< Shape , HeightField >();
+		ShapeList::ShapeFactories[ ImplicitSurface  ::Directive() ] = new DerivedFactory< Shape , ImplicitSurface >();
 		ShapeList::ShapeFactories[ Sphere           ::Directive() ] = new DerivedFactory< Shape , Sphere >();
+		ShapeList::ShapeFactories[ SphereCloud      ::Directive() ] = new DerivedFactory< Shape , SphereCloud >();
 		ShapeList::ShapeFactories[ Torus            ::Directive() ] = new DerivedFactory< Shape , Torus >();
 		ShapeList::ShapeFactories[ Triangle         ::Directive() ] = new DerivedFactory< Shape , Triangle >();
 		ShapeList::ShapeFactories[ FileInstance     ::Directive() ] = new DerivedFactory< Shape , FileInstance >();
 		ShapeList::ShapeFactories[ ShapeList        ::Directive() ] = new DerivedFactory< Shape , ShapeList >();
 		ShapeList::ShapeFactories[ TriangleList     ::Directive() ] = new DerivedFactory< Shape , TriangleList >();
 		ShapeList::ShapeFactories[ StaticAffineShape::Directive() ] = new DerivedFactory< Shape , StaticAffineShape >();
+		ShapeList::ShapeFactories[ DynamicAffineShape::Directive() ] = new DerivedFactory< Shape , DynamicAffineShape >();
 		ShapeList::ShapeFactories[ Union            ::Directive() ] = new DerivedFactory< Shape , Union >();
 		ShapeList::ShapeFactories[ Intersection     ::Directive() ] = new DerivedFactory< Shape , Intersection >();
 		ShapeList::ShapeFactories[ Difference       ::Directive() ] = new DerivedFactory< Shape , Difference >();
@@ -105,26 +186,89 @@ int main( int argc , char *argv[] )
 		GlobalSceneData::LightFactories[ DirectionalLight::Directive() ] = new DerivedFactory< Light , DirectionalLight >();
 		GlobalSceneData::LightFactories[ PointLight      ::Directive() ] = new DerivedFactory< Light , PointLight >();
 		GlobalSceneData::LightFactories[ SpotLight       ::Directive() ] = new DerivedFactory< Light , SpotLight >();
+		GlobalSceneData::LightFactories[ AreaLight       ::Directive() ] = new DerivedFactory< Light , AreaLight >();
 
 		ifstream istream;
 		istream.open( InputRayFile.value );
 		if( !istream ) THROW( "Failed to open file for reading: %s\n" , InputRayFile.value.c_str() );
 
+		LocalSceneData::CompactVertices = CompactVertices.set;
+		LocalSceneData::SpatialOrder = SpatialOrder.set;
+		GlobalSceneData::CullLights = CullLights.set;
+		Texture::MipMap = MipMap.set;
+		if( TextureCacheBudget.value<0 ) THROW( "texture cache budget must be non-negative: %d" , TextureCacheBudget.value );
+		TextureCache::Budget = (size_t)TextureCacheBudget.value<<20;
+
 		Timer timer;
 		istream >> scene;
 		std::cout << "\tRead: " << timer.elapsed() << " seconds" << std::endl;
+		std::cout << "\tPeak memory: " << ( PeakMemoryUsage()>>20 ) << " MB" << std::endl;
+
+		if( Compile.set )
+		{
+			timer.reset();
+			scene.compile();
+			std::cout << "\tCompiled: " << timer.elapsed() << " seconds" << std::endl;
+		}
 
 		timer.reset();
 		RayTracingStats::Reset();
-		Image32 img = scene.rayTrace( ImageWidth.value , ImageHeight.value , RecursionLimit.value , CutOffThreshold.value );
-		std::cout << "\tRay-traced: " << timer.elapsed() << " seconds" << std::endl;
+		Image32 img;
+		int pixelOrder = PixelOrder::Type( TraversalOrder.value );
+		bool relit = false;
+		size_t pixelNum = (size_t)ImageWidth.value * ImageHeight.value , retracedNum = 0;
+		double traceTime = 0;
+		if( Frames.value<0 ) THROW( "number of frames must be non-negative: %d" , Frames.value );
+		if( Frames.value )
+		{
+			// Ray-trace the frames, writing each one out as it is done (without counting the writing in the ray-tracing time)
+			scene.setKeyFrameEvaluator< TransformationParameter< TrivialRotationParameter > >();
+			if( FramesPerSecond.value<=0 ) THROW( "frames per second must be positive: %f" , FramesPerSecond.value );
+			AnimationRenderer renderer( scene , AnimationRenderer::Mode( IncrementalMode.value ) , Threads.value );
+			for( int f=0 ; f<Frames.value ; f++ )
+			{
+				timer.reset();
+				img = renderer.render( f / FramesPerSecond.value , Interpolation::NEAREST , ImageWidth.value , ImageHeight.value , RecursionLimit.value , CutOffThreshold.value );
+				traceTime += timer.elapsed();
+				retracedNum += renderer.retraced();
+				if( OutputImageFile.set ) img.write( FrameFileName( OutputImageFile.value , f ) );
+			}
+			pixelNum *= Frames.value;
+		}
+		else if( RelightingCacheFile.set )
+		{
+			RelightingCache cache( scene , RelightingCacheFile.value );
+			img = cache.render( ImageWidth.value , ImageHeight.value , RecursionLimit.value , CutOffThreshold.value , Threads.value );
+			relit = cache.reused();
+		}
+		else if( Wavefront.set ) img = WavefrontRenderer( scene , SortBatch.value ).render( ImageWidth.value , ImageHeight.value , RecursionLimit.value , CutOffThreshold.value , pixelOrder );
+		else img = scene.rayTrace( ImageWidth.value , ImageHeight.value , RecursionLimit.value , CutOffThreshold.value , PacketWidth.value , pixelOrder , Threads.value );
+		if( !Frames.value ) traceTime = timer.elapsed();
+		std::cout << "\tRay-traced: " << traceTime << " seconds" << std::endl;
+		if( Frames.value ) std::cout << "\tFrames: " << Frames.value << " (" << Size_t( retracedNum ) << " of " << Size_t( pixelNum ) << " pixels re-traced, " << 100. * retracedNum / pixelNum << "%)" << std::endl;
+		if( RelightingCacheFile.set ) std::cout << "\tRelighting cache: " << ( relit ? "reused" : "rebuilt" ) << std::endl;
 		std::cout << "\tPixels: " << Size_t( ImageWidth.value ) << " x " << Size_t( ImageHeight.value ) << std::endl;
 		std::cout << "\tPrimitives: " << Size_t( scene.primitiveNum() ) << std::endl;
-		std::cout << "\tRays: " << Size_t( RayTracingStats::RayNum() ) << " (" << (double)RayTracingStats::RayNum()/(ImageWidth.value*ImageHeight.value) << " rays/pixel)" << std::endl;
+		std::cout << "\tVertices: " << Size_t( scene.vertexNum() ) << " (" << ( CompactVertices.set ? sizeof( CompactVertex ) : sizeof( Vertex ) ) * 1000000. / ( 1<<20 ) << " MB per million vertices)" << std::endl;
+		std::cout << "\tGraph depth: " << scene.unflattenedDepth() << " -> " << scene.depth() << std::endl;
+		if( scene.compiledScene() )
+		{
+			std::cout << "\tCompiled nodes:";
+			for( int i=0 ; i<CompiledScene::COUNT ; i++ ) if( scene.compiledScene()->nodeNum(i) ) std::cout << " " << CompiledScene::Names[i] << "=" << Size_t( scene.compiledScene()->nodeNum(i) );
+			std::cout << std::endl;
+		}
+		std::cout << "\tRays: " << Size_t( RayTracingStats::RayNum() ) << " (" << (double)RayTracingStats::RayNum()/pixelNum << " rays/pixel)" << std::endl;
+		std::cout << "\tPrimary rays: " << Size_t( RayTracingStats::PrimaryRayNum() ) << " (" << Size_t( (size_t)( RayTracingStats::PrimaryRayNum()/RayTracingStats::PrimaryRayTime() ) ) << " rays/second)" << std::endl;
+		if( RayTracingStats::SecondaryRayNum() ) std::cout << "\tSecondary rays: " << Size_t( RayTracingStats::SecondaryRayNum() ) << " (" << Size_t( (size_t)( RayTracingStats::SecondaryRayNum()/RayTracingStats::SecondaryRayTime() ) ) << " rays/second)" << std::endl;
 		std::cout << "\tPrimitive intersections: " << Size_t( RayTracingStats::RayPrimitiveIntersectionNum() ) << " (" << (double)RayTracingStats::RayPrimitiveIntersectionNum()/RayTracingStats::RayNum() << " intersections/ray)" << std::endl;
 		std::cout << "\tBounding-box intersections: " << Size_t( RayTracingStats::RayBoundingBoxIntersectionNum() ) << " (" << (double)RayTracingStats::RayBoundingBoxIntersectionNum()/RayTracingStats::RayNum() << " intersections/ray)" << std::endl;
+		std::cout << "\tScratch heap allocations: " << Size_t( RayTracingStats::ScratchAllocationNum() ) << std::endl;
+		if( size_t selectionNum = RayTracingStats::LightSelectionNum() ) std::cout << "\tLights evaluated: " << (double)RayTracingStats::SelectedLightNum()/selectionNum << " of " << (double)( RayTracingStats::SelectedLightNum() + RayTracingStats::CulledLightNum() )/selectionNum << " per shading point (culling error bound: " << RayTracingStats::CulledLightError()/selectionNum << " on average, relative to the ray's weight)" << std::endl;
+		if( size_t testNum = RayTracingStats::OccluderCacheTestNum() ) std::cout << "\tOccluder cache hits: " << Size_t( RayTracingStats::OccluderCacheHitNum() ) << " of " << Size_t( testNum ) << " (" << 100. * RayTracingStats::OccluderCacheHitNum() / testNum << "%)" << std::endl;
+		if( size_t shadingNum = RayTracingStats::AreaLightShadingNum() ) std::cout << "\tArea-light shadow rays: " << (double)RayTracingStats::AreaLightSampleNum()/shadingNum << " per shading point (" << 100. * RayTracingStats::AreaLightPenumbraNum() / shadingNum << "% in penumbra)" << std::endl;
+		if( size_t lookupNum = RayTracingStats::TextureTileHitNum() + RayTracingStats::TextureTileMissNum() ) std::cout << "\tTexture tiles: " << Size_t( RayTracingStats::TextureTileHitNum() ) << " hits, " << Size_t( RayTracingStats::TextureTileMissNum() ) << " misses, " << Size_t( RayTracingStats::TextureTileEvictionNum() ) << " evictions (" << 100. * RayTracingStats::TextureTileHitNum() / lookupNum << "% hit rate, peak " << ( TextureCache::PeakSize()>>20 ) << " MB cached)" << std::endl;
 
-		if( OutputImageFile.set ) img.write( OutputImageFile.value );
+		if( OutputImageFile.set && !Frames.value ) img.write( OutputImageFile.value );
 	}
 	catch( const exception &e )
 	{